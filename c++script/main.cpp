@@ -9,6 +9,20 @@
 #include <ctime>
 #include <algorithm>
 #include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <map>
+#include <sys/ioctl.h>
+
+#include "batch.h"
+#include "bench.h"
+#include "config.h"
+#include "installer.h"
+#include "log.h"
+#include "offline.h"
+#include "process.h"
+#include "subvolumes.h"
 
 using namespace std;
 
@@ -34,13 +48,48 @@ string BOOT_FS_TYPE = "fat32";
 string LOCALE_LANG = "en_GB.UTF-8";
 vector<string> REPOS;
 vector<string> CUSTOM_PACKAGES;
-int COMPRESSION_LEVEL;
+int COMPRESSION_LEVEL = -1;     // 0 = auto, -1 = ask
+int ESP_SIZE = 512;
+int SWAP_SIZE = 0;
+bool FAST_INSTALL = false;      // install at zstd:1, recompress after first boot
+bool COMPRESSION_COMPARE = false;   // measure the levels even when COMPRESSION_LEVEL is fixed
+vector<SubvolumeSpec> SUBVOLUMES = default_subvolume_layout();
+bool INSTALL_GAMING = false;
+bool GAMING_SET = false;         // GAMING given, so nothing to ask
+string PREFETCH_DIR = DEFAULT_PREFETCH_DIR;
+vector<string> CACHE_DIRS;
+string MIRROR_BUNDLE = DEFAULT_MIRROR_BUNDLE;
+string CPU_LEVEL = "auto";
+string WIPE_MODE = "discard";
+int PARALLEL_DOWNLOADS = 0;      // pacman's ParallelDownloads, 0 = measure, -1 = keep pacman.conf's
+string IMAGE;                    // install from this golden image
+string IMAGE_BUILD;              // export the finished install as a golden image
+string OFFLINE_REPO;             // install from this local repository, no network
+string OFFLINE_REPO_BUILD;       // --build-offline-repo: build it here instead of installing
+bool HEADLESS = false;           // never ask; missing settings are an error
+vector<string> TARGET_DISKS;     // one install per disk, all at once
+vector<string> TARGET_CONFIGS;   // one install per config file, all at once
+string MOUNT_ROOT;               // per-disk config files; default /mnt/<disk>
+int DISK_SLOTS = 0;              // batch: disk-heavy steps at a time, 0 = auto
+int CPU_SLOTS = 0;               // batch: CPU-heavy steps at a time, 0 = auto
+bool BENCHMARK = false;          // --benchmark: install the matrix onto a loop device
+BenchMatrix BENCH_MATRIX;        // empty lists keep the installer.conf value
+string BENCH_DIR = DEFAULT_BENCH_DIR;
+int BENCH_IMAGE_SIZE = 64;       // GiB, sparse
+int BENCH_BANDWIDTH = 0;         // KiB/s the package stand-in serves at, 0 = unlimited
+int BENCH_LATENCY_MS = 0;
+
+// Exit codes
+const int EXIT_OK = 0;
+const int EXIT_FAILED = 1;       // the install failed, or every disk of a batch did
+const int EXIT_PARTIAL = 2;      // some disks of a batch failed
+const int EXIT_NOT_STARTED = 3;  // bad or incomplete settings, not root, no UEFI
 
 // Log file
 ofstream log_file("installation_log.txt");
 
 void show_ascii() {
-    system("clear");
+    cout << "\033[H\033[2J";
     cout << COLOR_RED << R"(
 ░█████╗░██╗░░░░░░█████╗░██║░░░██╗██████╗░███████╗███╗░░░███╗░█████╗░██████╗░░██████╗
 ██╔══██╗██║░░░░░██╔══██╗██║░░░██║██╔══██╗██╔════╝████╗░████║██╔══██╗██╔══██╗██╔════╝
@@ -51,18 +100,66 @@ void show_ascii() {
 cout << COLOR_CYAN << "CachyOS Btrfs Installer v1.2" << COLOR_RESET << endl << endl;
 }
 
-void draw_progress_bar(int progress, int total, int width = 50) {
-    float percentage = static_cast<float>(progress) / total;
-    int filled = static_cast<int>(percentage * width);
+// Overall progress, drawn on the last terminal line. Output clears it and
+// the ticker redraws it, so a silent command still shows its idle time.
+// Callers hold terminal_mutex.
+Installer* installer = nullptr;
+BatchInstall* batch = nullptr;
+mutex terminal_mutex;
+bool progress_ticking = false;
+
+// A batch gets one line of "disk percent stage" for every disk
+void draw_batch_progress() {
+    string line;
+    for (size_t i = 0; i < batch->size(); ++i) {
+        ostringstream entry;
+        entry << disk_label(batch->target(i).config.target_disk) << " " << static_cast<int>(batch->fraction(i) * 100)
+              << "% " << batch->status(i);
+        line += (i ? " | " : "") + entry.str();
+    }
+    winsize terminal{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &terminal) == 0 && terminal.ws_col > 1 && line.size() >= terminal.ws_col) {
+        line.resize(terminal.ws_col - 1);
+    }
+    cout << "\r\033[K" << COLOR_CYAN << line << COLOR_RESET << "\r";
+    cout.flush();
+}
 
-    cout << COLOR_CYAN << "[";
+void draw_progress_bar(int width = 50) {
+    if (batch) {
+        draw_batch_progress();
+        return;
+    }
+    if (!installer) return;
+    double fraction = installer->fraction();
+    int filled = static_cast<int>(fraction * width);
+
+    string status = installer->status();
+    winsize terminal{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &terminal) == 0 && terminal.ws_col > width + 8) {
+        size_t room = terminal.ws_col - width - 8;
+        if (status.size() > room) status.resize(room);
+    }
+
+    cout << "\r\033[K" << COLOR_CYAN << "[";
     for (int i = 0; i < width; ++i) {
         if (i < filled) cout << "=";
         else cout << " ";
     }
-    cout << "] " << setw(3) << static_cast<int>(percentage * 100) << "%\r";
+    cout << "] " << setw(3) << static_cast<int>(fraction * 100) << "% " << status << COLOR_RESET << "\r";
     cout.flush();
-    cout << COLOR_RESET;
+}
+
+void start_progress_ticker() {
+    progress_ticking = true;
+    thread([]() {
+        while (true) {
+            this_thread::sleep_for(chrono::seconds(1));
+            lock_guard<mutex> lock(terminal_mutex);
+            if (!progress_ticking) return;
+            draw_progress_bar();
+        }
+    }).detach();
 }
 
 string get_current_time() {
@@ -75,37 +172,23 @@ string get_current_time() {
 
 void log_message(const string& message) {
     string timestamped_msg = "[" + get_current_time() + "] " + message;
-    cout << COLOR_YELLOW << timestamped_msg << COLOR_RESET << endl;
+    lock_guard<mutex> lock(terminal_mutex);
+    cout << "\033[K" << COLOR_YELLOW << timestamped_msg << COLOR_RESET << endl;
     log_file << timestamped_msg << endl;
 }
 
-void execute_command(const string& cmd) {
-    cout << COLOR_CYAN;
-    fflush(stdout);
-    string full_cmd = "sudo " + cmd;
-    log_message("[EXEC] " + full_cmd);
-    int status = system(full_cmd.c_str());
-    cout << COLOR_RESET;
-    if (status != 0) {
-        log_message("Error executing: " + full_cmd);
-        cerr << COLOR_RED << "Error executing: " << full_cmd << COLOR_RESET << endl;
-        exit(1);
-    }
-}
-
-string run_command(const string& cmd) {
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) return "";
-    char buffer[128];
-    string result;
-    while (fgets(buffer, sizeof(buffer), pipe)) {
-        result += buffer;
-    }
-    pclose(pipe);
-    if (!result.empty() && result.back() == '\n') {
-        result.pop_back();
-    }
-    return result;
+// dialog draws on the terminal and prints the answer on stderr
+string ask_dialog(const vector<string>& args) {
+    vector<string> cmd = {"dialog"};
+    cmd.insert(cmd.end(), args.begin(), args.end());
+    ProcessOptions options;
+    options.elevate = false;
+    options.pipe_stdout = false;
+    options.capture = true;
+    ProcessResult result = run_process(cmd, options);
+    string answer = result.stderr_text;
+    while (!answer.empty() && answer.back() == '\n') answer.pop_back();
+    return answer;
 }
 
 bool file_exists(const string& filename) {
@@ -128,10 +211,32 @@ vector<string> read_file_lines(const string& filename) {
     return lines;
 }
 
-void load_config_file() {
-    if (file_exists("installer.conf")) {
-        log_message("Loading configuration from installer.conf");
-        vector<string> lines = read_file_lines("installer.conf");
+void fail_setup(const string& error) {
+    log_message("Error: " + error);
+    cerr << COLOR_RED << "Error: " << error << COLOR_RESET << endl;
+    exit(EXIT_NOT_STARTED);
+}
+
+vector<string> split_list(const string& value) {
+    vector<string> items;
+    stringstream list(value);
+    string item;
+    while (getline(list, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parse_yes(const string& value) {
+    return value == "true" || value == "yes" || value == "1";
+}
+
+// Settings a per-disk config file leaves out keep the installer.conf value
+void load_config_file(const string& path) {
+    if (file_exists(path)) {
+        log_message("Loading configuration from " + path);
+        vector<string> lines = read_file_lines(path);
+        bool custom_layout = false;
 
         for (const string& line : lines) {
             size_t pos = line.find('=');
@@ -152,10 +257,61 @@ void load_config_file() {
                 else if (key == "BOOTLOADER") BOOTLOADER = value;
                 else if (key == "BOOT_FS_TYPE") BOOT_FS_TYPE = value;
                 else if (key == "LOCALE_LANG") LOCALE_LANG = value;
-                else if (key == "COMPRESSION_LEVEL") COMPRESSION_LEVEL = stoi(value);
+                else if (key == "COMPRESSION_LEVEL") COMPRESSION_LEVEL = value == "auto" ? 0 : stoi(value);
+                else if (key == "ESP_SIZE") ESP_SIZE = stoi(value);
+                else if (key == "SWAP_SIZE") SWAP_SIZE = stoi(value);
+                else if (key == "FAST_INSTALL") FAST_INSTALL = parse_yes(value);
+                else if (key == "COMPRESSION_COMPARE") COMPRESSION_COMPARE = parse_yes(value);
+                else if (key == "PREFETCH_DIR") PREFETCH_DIR = value;
+                else if (key == "MIRROR_BUNDLE") MIRROR_BUNDLE = value;
+                else if (key == "CPU_LEVEL") CPU_LEVEL = value;
+                else if (key == "WIPE_MODE") WIPE_MODE = value;
+                else if (key == "PARALLEL_DOWNLOADS") PARALLEL_DOWNLOADS = value == "auto" ? 0 : stoi(value);
+                else if (key == "IMAGE") IMAGE = value;
+                else if (key == "IMAGE_BUILD") IMAGE_BUILD = value;
+                else if (key == "OFFLINE_REPO") OFFLINE_REPO = value;
+                else if (key == "GAMING") {
+                    INSTALL_GAMING = parse_yes(value);
+                    GAMING_SET = true;
+                }
+                else if (key == "HEADLESS") HEADLESS = parse_yes(value);
+                else if (key == "TARGET_DISKS") TARGET_DISKS = split_list(value);
+                else if (key == "TARGET_CONFIGS") TARGET_CONFIGS = split_list(value);
+                else if (key == "MOUNT_ROOT") MOUNT_ROOT = value;
+                else if (key == "DISK_SLOTS") DISK_SLOTS = stoi(value);
+                else if (key == "CPU_SLOTS") CPU_SLOTS = stoi(value);
+                else if (key == "BENCH_KERNELS") BENCH_MATRIX.kernels = split_list(value);
+                else if (key == "BENCH_BOOTLOADERS") BENCH_MATRIX.bootloaders = split_list(value);
+                else if (key == "BENCH_INITRAMFS") BENCH_MATRIX.initramfs = split_list(value);
+                else if (key == "BENCH_DESKTOPS") BENCH_MATRIX.desktops = split_list(value);
+                else if (key == "BENCH_SOURCES") BENCH_MATRIX.sources = split_list(value);
+                else if (key == "BENCH_DIR") BENCH_DIR = value;
+                else if (key == "BENCH_IMAGE_SIZE") BENCH_IMAGE_SIZE = stoi(value);
+                else if (key == "BENCH_BANDWIDTH") BENCH_BANDWIDTH = stoi(value);
+                else if (key == "BENCH_LATENCY_MS") BENCH_LATENCY_MS = stoi(value);
+                else if (key == "SUBVOLUME") {
+                    // The first SUBVOLUME line replaces the default layout
+                    SubvolumeSpec spec;
+                    string error;
+                    if (!parse_subvolume_spec(value, spec, error)) fail_setup(error);
+                    if (!custom_layout) SUBVOLUMES.clear();
+                    custom_layout = true;
+                    SUBVOLUMES.push_back(spec);
+                }
+                else if (key == "REPOS") REPOS = split_list(value);
+                else if (key == "CACHE_DIRS") CACHE_DIRS = split_list(value);
             }
         }
     }
+
+    string error;
+    if (!validate_subvolume_layout(SUBVOLUMES, error)) fail_setup(error);
+    // A level on the / entry is the filesystem's level; other algorithms
+    // have nothing to tune
+    const SubvolumeSpec* root = root_subvolume(SUBVOLUMES);
+    if (root->level > 0 || root->compression != "zstd") {
+        COMPRESSION_LEVEL = root->level;
+    }
 }
 
 void load_packages_file() {
@@ -165,513 +321,442 @@ void load_packages_file() {
     }
 }
 
+bool batch_mode() {
+    return !TARGET_DISKS.empty() || !TARGET_CONFIGS.empty();
+}
+
+// Nothing is asked: what installer.conf leaves open gets its default
+// (compression measured, no gaming packages), or fails the check in
+// perform_installation
+void configure_headless() {
+    if (COMPRESSION_LEVEL == -1) COMPRESSION_LEVEL = 0;
+}
+
 void configure_installation() {
-    load_config_file();
+    load_config_file("installer.conf");
+    if (HEADLESS || batch_mode() || !OFFLINE_REPO_BUILD.empty() || BENCHMARK) {
+        configure_headless();
+        load_packages_file();
+        return;
+    }
 
     if (TARGET_DISK.empty()) {
-        TARGET_DISK = run_command("dialog --title \"Target Disk\" --inputbox \"Enter target disk (e.g. /dev/nvme0n1):\" 10 50 2>&1 >/dev/tty");
+        TARGET_DISK = ask_dialog({"--title", "Target Disk", "--inputbox", "Enter target disk (e.g. /dev/nvme0n1):", "10", "50"});
     }
 
     if (BOOT_FS_TYPE.empty()) {
-        string fs_choice = run_command("dialog --title \"Boot Filesystem\" --menu \"Select filesystem (Recommended: fat32 for UEFI):\" 15 40 2 \"fat32\" \"FAT32 (Recommended)\" \"ext4\" \"EXT4\" 2>&1 >/dev/tty");
+        string fs_choice = ask_dialog({"--title", "Boot Filesystem", "--menu", "Select filesystem (Recommended: fat32 for UEFI):", "15", "40", "2", "fat32", "FAT32 (Recommended)", "ext4", "EXT4"});
         BOOT_FS_TYPE = (fs_choice == "fat32") ? "fat32" : "ext4";
     }
 
     if (HOSTNAME.empty()) {
-        HOSTNAME = run_command("dialog --title \"Hostname\" --inputbox \"Enter hostname (e.g. mypc):\" 10 50 2>&1 >/dev/tty");
+        HOSTNAME = ask_dialog({"--title", "Hostname", "--inputbox", "Enter hostname (e.g. mypc):", "10", "50"});
     }
     if (TIMEZONE.empty()) {
-        TIMEZONE = run_command("dialog --title \"Timezone\" --inputbox \"Enter timezone (e.g. Europe/London):\" 10 50 2>&1 >/dev/tty");
+        TIMEZONE = ask_dialog({"--title", "Timezone", "--inputbox", "Enter timezone (e.g. Europe/London):", "10", "50"});
     }
     if (KEYMAP.empty()) {
-        KEYMAP = run_command("dialog --title \"Keymap\" --inputbox \"Enter keymap (e.g. uk):\" 10 50 2>&1 >/dev/tty");
+        KEYMAP = ask_dialog({"--title", "Keymap", "--inputbox", "Enter keymap (e.g. uk):", "10", "50"});
     }
     if (USER_NAME.empty()) {
-        USER_NAME = run_command("dialog --title \"Username\" --inputbox \"Enter username (lowercase, no spaces):\" 10 50 2>&1 >/dev/tty");
+        USER_NAME = ask_dialog({"--title", "Username", "--inputbox", "Enter username (lowercase, no spaces):", "10", "50"});
     }
     if (USER_PASSWORD.empty()) {
-        USER_PASSWORD = run_command("dialog --title \"User Password\" --passwordbox \"Enter password (min 8 chars):\" 10 50 2>&1 >/dev/tty");
+        USER_PASSWORD = ask_dialog({"--title", "User Password", "--passwordbox", "Enter password (min 8 chars):", "10", "50"});
     }
     if (ROOT_PASSWORD.empty()) {
-        ROOT_PASSWORD = run_command("dialog --title \"Root Password\" --passwordbox \"Enter root password (min 8 chars):\" 10 50 2>&1 >/dev/tty");
+        ROOT_PASSWORD = ask_dialog({"--title", "Root Password", "--passwordbox", "Enter root password (min 8 chars):", "10", "50"});
     }
 
+    load_packages_file();
+    // The image's manifest decides the rest
+    if (!IMAGE.empty()) return;
+
     if (KERNEL_TYPE.empty()) {
-        KERNEL_TYPE = run_command("dialog --title \"Kernel\" --menu \"Select kernel (Recommended: Bore for performance):\" 15 40 6 \"Bore\" \"CachyOS Bore\" \"Bore-Extra\" \"Bore with extras\" \"CachyOS\" \"Standard\" \"CachyOS-Extra\" \"With extras\" \"LTS\" \"Long-term\" \"Zen\" \"Zen kernel\" 2>&1 >/dev/tty");
+        KERNEL_TYPE = ask_dialog({"--title", "Kernel", "--menu", "Select kernel (Recommended: Bore for performance):", "15", "40", "6", "Bore", "CachyOS Bore", "Bore-Extra", "Bore with extras", "CachyOS", "Standard", "CachyOS-Extra", "With extras", "LTS", "Long-term", "Zen", "Zen kernel"});
     }
     if (INITRAMFS.empty()) {
-        INITRAMFS = run_command("dialog --title \"Initramfs\" --menu \"Select initramfs (Recommended: mkinitcpio):\" 15 40 4 \"mkinitcpio\" \"Default\" \"dracut\" \"Alternative\" \"booster\" \"Fast\" \"mkinitcpio-pico\" \"Minimal\" 2>&1 >/dev/tty");
+        INITRAMFS = ask_dialog({"--title", "Initramfs", "--menu", "Select initramfs (Recommended: mkinitcpio):", "15", "40", "4", "mkinitcpio", "Default", "dracut", "Alternative", "booster", "Fast", "mkinitcpio-pico", "Minimal"});
     }
     if (BOOTLOADER.empty()) {
-        BOOTLOADER = run_command("dialog --title \"Bootloader\" --menu \"Select bootloader (Recommended: GRUB for flexibility):\" 15 40 3 \"GRUB\" \"GRUB\" \"systemd-boot\" \"Minimal\" \"rEFInd\" \"Graphical\" 2>&1 >/dev/tty");
+        BOOTLOADER = ask_dialog({"--title", "Bootloader", "--menu", "Select bootloader (Recommended: GRUB for flexibility):", "15", "40", "3", "GRUB", "GRUB", "systemd-boot", "Minimal", "rEFInd", "Graphical"});
     }
     if (DESKTOP_ENV.empty()) {
-        DESKTOP_ENV = run_command("dialog --title \"Desktop\" --menu \"Select desktop environment (Recommended: KDE Plasma):\" 20 50 12 \"KDE Plasma\" \"KDE\" \"GNOME\" \"GNOME\" \"XFCE\" \"XFCE\" \"MATE\" \"MATE\" \"LXQt\" \"LXQt\" \"Cinnamon\" \"Cinnamon\" \"Budgie\" \"Budgie\" \"Deepin\" \"Deepin\" \"i3\" \"i3\" \"Sway\" \"Sway\" \"Hyprland\" \"Hyprland\" \"None\" \"None\" 2>&1 >/dev/tty");
+        DESKTOP_ENV = ask_dialog({"--title", "Desktop", "--menu", "Select desktop environment (Recommended: KDE Plasma):", "20", "50", "12", "KDE Plasma", "KDE", "GNOME", "GNOME", "XFCE", "XFCE", "MATE", "MATE", "LXQt", "LXQt", "Cinnamon", "Cinnamon", "Budgie", "Budgie", "Deepin", "Deepin", "i3", "i3", "Sway", "Sway", "Hyprland", "Hyprland", "None", "None"});
+    }
+
+    // Asked up front so the prefetch stage knows the full package set
+    if (DESKTOP_ENV != "None" && !GAMING_SET) {
+        ProcessOptions options;
+        options.elevate = false;
+        options.pipe_stdout = false;
+        options.pipe_stderr = false;
+        INSTALL_GAMING = run_process({"dialog", "--title", "Gaming Packages", "--yesno", "Install cachyos-gaming-meta package?", "7", "40"}, options).ok();
     }
 
-    if (COMPRESSION_LEVEL == 0) {
-        string comp_level = run_command("dialog --title \"Compression\" --inputbox \"Enter BTRFS compression level (1-22, Recommended: 3):\" 10 50 2>&1 >/dev/tty");
-        COMPRESSION_LEVEL = stoi(comp_level);
+    if (COMPRESSION_LEVEL == -1) {
+        string comp_level = ask_dialog({"--title", "Compression", "--inputbox", "Enter BTRFS compression level (1-15, or auto to measure this machine; Recommended: auto):", "10", "60", "auto"});
+        COMPRESSION_LEVEL = (comp_level == "auto" || comp_level.empty()) ? 0 : stoi(comp_level);
     }
 
     if (LOCALE_LANG == "en_GB.UTF-8") {
-        LOCALE_LANG = run_command("dialog --title \"Locale\" --inputbox \"Enter locale (e.g. en_GB.UTF-8):\" 10 50 2>&1 >/dev/tty");
+        LOCALE_LANG = ask_dialog({"--title", "Locale", "--inputbox", "Enter locale (e.g. en_GB.UTF-8):", "10", "50"});
     }
+}
 
-    load_packages_file();
+void use_config(const InstallConfig& config) {
+    TARGET_DISK = config.target_disk;
+    HOSTNAME = config.hostname;
+    TIMEZONE = config.timezone;
+    KEYMAP = config.keymap;
+    USER_NAME = config.user_name;
+    USER_PASSWORD = config.user_password;
+    ROOT_PASSWORD = config.root_password;
+    DESKTOP_ENV = config.desktop_env;
+    KERNEL_TYPE = config.kernel_type;
+    INITRAMFS = config.initramfs;
+    BOOTLOADER = config.bootloader;
+    BOOT_FS_TYPE = config.boot_fs_type;
+    LOCALE_LANG = config.locale_lang;
+    REPOS = config.repos;
+    CPU_LEVEL = config.cpu_level;
+    WIPE_MODE = config.wipe_mode;
+    IMAGE = config.image;
+    IMAGE_BUILD = config.image_build;
+    OFFLINE_REPO = config.offline_repo;
+    CUSTOM_PACKAGES = config.custom_packages;
+    COMPRESSION_LEVEL = config.compression_level;
+    ESP_SIZE = config.esp_size_mib;
+    SWAP_SIZE = config.swap_size_mib;
+    FAST_INSTALL = config.fast_install;
+    COMPRESSION_COMPARE = config.compare_compression;
+    SUBVOLUMES = config.subvolumes;
+    INSTALL_GAMING = config.install_gaming;
 }
 
-void setup_locale_conf() {
-    ofstream locale_conf("/mnt/etc/locale.conf");
-    locale_conf << "LANG=" << LOCALE_LANG << "\n"
-    << "LC_ADDRESS=" << LOCALE_LANG << "\n"
-    << "LC_IDENTIFICATION=" << LOCALE_LANG << "\n"
-    << "LC_MEASUREMENT=" << LOCALE_LANG << "\n"
-    << "LC_MONETARY=" << LOCALE_LANG << "\n"
-    << "LC_NAME=" << LOCALE_LANG << "\n"
-    << "LC_NUMERIC=" << LOCALE_LANG << "\n"
-    << "LC_PAPER=" << LOCALE_LANG << "\n"
-    << "LC_TELEPHONE=" << LOCALE_LANG << "\n"
-    << "LC_TIME=" << LOCALE_LANG << "\n";
-    locale_conf.close();
+InstallConfig current_config() {
+    InstallConfig config;
+    config.target_disk = TARGET_DISK;
+    config.hostname = HOSTNAME;
+    config.timezone = TIMEZONE;
+    config.keymap = KEYMAP;
+    config.user_name = USER_NAME;
+    config.user_password = USER_PASSWORD;
+    config.root_password = ROOT_PASSWORD;
+    config.desktop_env = DESKTOP_ENV;
+    config.kernel_type = KERNEL_TYPE;
+    config.initramfs = INITRAMFS;
+    config.bootloader = BOOTLOADER;
+    config.boot_fs_type = BOOT_FS_TYPE;
+    config.locale_lang = LOCALE_LANG;
+    config.repos = REPOS;
+    config.cpu_level = CPU_LEVEL;
+    config.wipe_mode = WIPE_MODE;
+    config.image = IMAGE;
+    config.image_build = IMAGE_BUILD;
+    config.offline_repo = OFFLINE_REPO;
+    config.custom_packages = CUSTOM_PACKAGES;
+    config.compression_level = COMPRESSION_LEVEL;
+    config.esp_size_mib = ESP_SIZE;
+    config.swap_size_mib = SWAP_SIZE;
+    config.fast_install = FAST_INSTALL;
+    config.compare_compression = COMPRESSION_COMPARE;
+    config.subvolumes = SUBVOLUMES;
+    config.install_gaming = INSTALL_GAMING;
+    return config;
 }
 
-void perform_installation() {
-    show_ascii();
-    log_message("Starting installation process");
+// TARGET_DISKS: installer.conf as it is on every disk. TARGET_CONFIGS: one
+// file per disk (TARGET_DISK, HOSTNAME, ...) on top of installer.conf.
+vector<BatchTarget> batch_targets() {
+    vector<BatchTarget> targets;
+    InstallConfig base = current_config();
+    for (const string& disk : TARGET_DISKS) {
+        BatchTarget target;
+        target.config = base;
+        target.config.target_disk = disk;
+        targets.push_back(target);
+    }
+    for (const string& path : TARGET_CONFIGS) {
+        if (!file_exists(path)) fail_setup("Cannot read " + path);
+        use_config(base);
+        MOUNT_ROOT.clear();
+        load_config_file(path);
+        configure_headless();
+        BatchTarget target;
+        target.config = current_config();
+        target.target_root = MOUNT_ROOT;
+        targets.push_back(target);
+    }
+    use_config(base);
+    return targets;
+}
 
+void check_system() {
     if (getuid() != 0) {
         cout << COLOR_RED << "Must be run as root!" << COLOR_RESET << endl;
-        exit(1);
+        exit(EXIT_NOT_STARTED);
     }
 
     if (access("/sys/firmware/efi", F_OK) == -1) {
         cout << COLOR_RED << "UEFI required!" << COLOR_RESET << endl;
-        exit(1);
+        exit(EXIT_NOT_STARTED);
     }
+}
 
-    const int TOTAL_STEPS = 15;
-    int current_step = 0;
-
-    // Wipe disk
-    log_message("Wiping disk");
-    execute_command("wipefs -a " + TARGET_DISK);
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Partition names
-    string boot_part = TARGET_DISK + (TARGET_DISK.find("nvme") != string::npos ? "p1" : "1");
-    string root_part = TARGET_DISK + (TARGET_DISK.find("nvme") != string::npos ? "p2" : "2");
-
-    // Partitioning
-    log_message("Partitioning disk");
-    execute_command("parted -s " + TARGET_DISK + " mklabel gpt");
-    execute_command("parted -s " + TARGET_DISK + " mkpart primary 1MiB 513MiB");
-    execute_command("parted -s " + TARGET_DISK + " set 1 esp on");
-    execute_command("parted -s " + TARGET_DISK + " mkpart primary 513MiB 100%");
-    draw_progress_bar(++current_step, TOTAL_STEPS);
+int perform_batch_installation() {
+    show_ascii();
+    log_message("Starting batch installation");
+    check_system();
+
+    BatchOptions options;
+    options.staging_dir = PREFETCH_DIR;
+    options.mirror_bundle = MIRROR_BUNDLE;
+    options.cache_dirs = CACHE_DIRS;
+    options.disk_slots = DISK_SLOTS;
+    options.cpu_slots = CPU_SLOTS;
+    options.parallel_downloads = PARALLEL_DOWNLOADS;
+
+    // Command output of several disks at once only goes to the log file,
+    // each line tagged with its disk
+    vector<BatchTarget> targets = batch_targets();
+    BatchInstall install(targets, options, [&targets](size_t index) {
+        string label = disk_label(targets[index].config.target_disk) + ": ";
+        InstallerEvents events;
+        events.output = [label](const string& line) {
+            lock_guard<mutex> lock(terminal_mutex);
+            log_file << label << line << endl;
+        };
+        events.command_done = [label](const ProcessResult& result) {
+            lock_guard<mutex> lock(terminal_mutex);
+            log_file << "[" << get_current_time() << "] " << label << "[DONE] " << format_argv(result.argv) << ": exit "
+                     << result.exit_code << " in " << fixed << setprecision(2) << result.seconds() << "s" << endl;
+        };
+        return events;
+    });
+    string error;
+    if (!install.validate(error)) fail_setup(error);
+
+    {
+        lock_guard<mutex> lock(terminal_mutex);
+        batch = &install;
+    }
+    start_progress_ticker();
+    vector<BatchResult> results = install.run();
+    {
+        lock_guard<mutex> lock(terminal_mutex);
+        progress_ticking = false;
+        batch = nullptr;
+        cout << "\r\033[K";
+    }
 
-    // Formatting
-    log_message("Formatting partitions");
-    if (BOOT_FS_TYPE == "fat32") {
-        execute_command("mkfs.vfat -F32 " + boot_part);
+    size_t failed = 0;
+    cout << endl << COLOR_CYAN << left << setw(16) << "Disk" << setw(16) << "Hostname" << setw(8) << "Result"
+         << setw(10) << "Time" << "Error" << COLOR_RESET << endl;
+    for (const BatchResult& result : results) {
+        if (!result.ok) ++failed;
+        ostringstream seconds;
+        seconds << fixed << setprecision(0) << result.seconds << "s";
+        cout << (result.ok ? COLOR_GREEN : COLOR_RED) << left << setw(16) << result.disk << setw(16) << result.hostname
+             << setw(8) << (result.ok ? "ok" : "FAILED") << setw(10) << seconds.str() << result.error << COLOR_RESET
+             << endl;
+        log_message(result.disk + ": " + (result.ok ? "installed in " + seconds.str() : "failed: " + result.error));
+    }
+    if (write_batch_report(BATCH_REPORT_FILE, results, error)) {
+        cout << COLOR_CYAN << "Results saved to " << BATCH_REPORT_FILE << ", command timings per disk to "
+             << "installation_trace-<disk>.json" << COLOR_RESET << endl;
     } else {
-        execute_command("mkfs.ext4 " + boot_part);
-    }
-    execute_command("mkfs.btrfs -f " + root_part);
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Mounting and subvolumes
-    log_message("Setting up Btrfs subvolumes");
-    execute_command("mount " + root_part + " /mnt");
-    execute_command("btrfs subvolume create /mnt/@");
-    execute_command("btrfs subvolume create /mnt/@home");
-    execute_command("btrfs subvolume create /mnt/@root");
-    execute_command("btrfs subvolume create /mnt/@srv");
-    execute_command("btrfs subvolume create /mnt/@cache");
-    execute_command("btrfs subvolume create /mnt/@tmp");
-    execute_command("btrfs subvolume create /mnt/@log");
-    execute_command("umount /mnt");
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Remount with compression
-    log_message("Mounting with compression");
-    execute_command("mount -o subvol=@,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt");
-    execute_command("mkdir -p /mnt/boot/efi");
-    execute_command("mount " + boot_part + " /mnt/boot/efi");
-    execute_command("mkdir -p /mnt/home");
-    execute_command("mkdir -p /mnt/root");
-    execute_command("mkdir -p /mnt/srv");
-    execute_command("mkdir -p /mnt/tmp");
-    execute_command("mkdir -p /mnt/var/cache");
-    execute_command("mkdir -p /mnt/var/log");
-    execute_command("mount -o subvol=@home,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt/home");
-    execute_command("mount -o subvol=@root,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt/root");
-    execute_command("mount -o subvol=@srv,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt/srv");
-    execute_command("mount -o subvol=@tmp,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt/tmp");
-    execute_command("mount -o subvol=@cache,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt/var/cache");
-    execute_command("mount -o subvol=@log,compress=zstd:" + to_string(COMPRESSION_LEVEL) + ",compress-force=zstd:" + to_string(COMPRESSION_LEVEL) + " " + root_part + " /mnt/var/log");
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Kernel package
-    string KERNEL_PKG;
-    if (KERNEL_TYPE == "Bore") KERNEL_PKG = "linux-cachyos-bore";
-    else if (KERNEL_TYPE == "Bore-Extra") KERNEL_PKG = "linux-cachyos-bore-extra";
-    else if (KERNEL_TYPE == "CachyOS") KERNEL_PKG = "linux-cachyos";
-    else if (KERNEL_TYPE == "CachyOS-Extra") KERNEL_PKG = "linux-cachyos-extra";
-    else if (KERNEL_TYPE == "LTS") KERNEL_PKG = "linux-lts";
-    else if (KERNEL_TYPE == "Zen") KERNEL_PKG = "linux-zen";
-
-    // Base packages
-    string BASE_PKGS = "base " + KERNEL_PKG + " linux-firmware sudo dosfstools arch-install-scripts btrfs-progs nano --needed --disable-download-timeout";
-
-    // Add custom packages if any
-    if (!CUSTOM_PACKAGES.empty()) {
-        BASE_PKGS += " ";
-        for (const string& pkg : CUSTOM_PACKAGES) {
-            BASE_PKGS += pkg + " ";
-        }
+        log_message("Warning: " + error);
     }
 
-    if (BOOTLOADER == "GRUB") {
-        BASE_PKGS += " grub efibootmgr dosfstools cachyos-grub-theme --needed --disable-download-timeout";
-    } else if (BOOTLOADER == "systemd-boot") {
-        BASE_PKGS += " efibootmgr --needed --disable-download-timeout";
-    } else if (BOOTLOADER == "rEFInd") {
-        BASE_PKGS += " refind --needed --disable-download-timeout";
-    }
-
-    if (INITRAMFS == "mkinitcpio") {
-        BASE_PKGS += " mkinitcpio --needed";
-    } else if (INITRAMFS == "dracut") {
-        BASE_PKGS += " dracut --needed";
-    } else if (INITRAMFS == "booster") {
-        BASE_PKGS += " booster --needed";
-    } else if (INITRAMFS == "mkinitcpio-pico") {
-        BASE_PKGS += " mkinitcpio-pico --needed";
-    }
-
-    if (DESKTOP_ENV == "None") {
-        BASE_PKGS += " networkmanager --needed --disable-download-timeout";
-    }
-
-    // Base system installation
-    log_message("Installing base system");
-    execute_command("pacstrap -i /mnt " + BASE_PKGS);
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Generate fstab
-    log_message("Generating fstab");
-    string ROOT_UUID = run_command("blkid -s UUID -o value " + root_part);
-    ofstream fstab("/mnt/etc/fstab", ios::app);
-    fstab << "\n# Btrfs subvolumes\n"
-    << "UUID=" << ROOT_UUID << " / btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@ 0 0\n"
-    << "UUID=" << ROOT_UUID << " /home btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@home 0 0\n"
-    << "UUID=" << ROOT_UUID << " /root btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@root 0 0\n"
-    << "UUID=" << ROOT_UUID << " /srv btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@srv 0 0\n"
-    << "UUID=" << ROOT_UUID << " /var/cache btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@cache 0 0\n"
-    << "UUID=" << ROOT_UUID << " /var/tmp btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@tmp 0 0\n"
-    << "UUID=" << ROOT_UUID << " /var/log btrfs rw,noatime,compress=zstd:" << COMPRESSION_LEVEL << ",subvol=@log 0 0\n";
-    fstab.close();
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Setup locale
-    log_message("Configuring locale");
-    setup_locale_conf();
-    draw_progress_bar(++current_step, TOTAL_STEPS);
-
-    // Chroot setup
-    log_message("Preparing chroot environment");
-    string chroot_script = R"(#!/bin/bash
-# System config
-echo ")" + HOSTNAME + R"(" > /etc/hostname
-ln -sf /usr/share/zoneinfo/)" + TIMEZONE + R"( /etc/localtime
-hwclock --systohc
-echo ")" + LOCALE_LANG + R"(" >> /etc/locale.gen
-locale-gen
-
-# Users
-echo "root:)" + ROOT_PASSWORD + R"(" | chpasswd
-useradd -m -G wheel,audio,video,storage,optical -s /bin/bash ")" + USER_NAME + R"("
-echo ")" + USER_NAME + ":" + USER_PASSWORD + R"(" | chpasswd
-echo "%wheel ALL=(ALL) ALL" > /etc/sudoers.d/wheel
-
-# Bootloader
-)";
-
-if (BOOTLOADER == "GRUB") {
-    chroot_script += R"(
-grub-install --target=x86_64-efi --efi-directory=/boot/efi --bootloader-id=CachyOS
-grub-mkconfig -o /boot/grub/grub.cfg
-)";
-} else if (BOOTLOADER == "systemd-boot") {
-    chroot_script += R"(
-bootctl --path=/boot/efi install
-mkdir -p /boot/efi/loader/entries
-cat > /boot/efi/loader/loader.conf << 'LOADER'
-default arch
-timeout 3
-editor  yes
-LOADER
-
-cat > /boot/efi/loader/entries/arch.conf << 'ENTRY'
-title   CachyOS Linux
-linux   /vmlinuz-)" + KERNEL_PKG + R"(
-    initrd  /initramfs-)" + KERNEL_PKG + R"(.img
-    options root=UUID=)" + ROOT_UUID + R"( rootflags=subvol=@ rw
-    ENTRY
-    )";
-} else if (BOOTLOADER == "rEFInd") {
-    chroot_script += R"(
-refind-install
-mkdir -p /boot/efi/EFI/refind/refind.conf
-cat > /boot/efi/EFI/refind/refind.conf << 'REFIND'
-menuentry "CachyOS Linux" {
-    icon     /EFI/refind/icons/os_arch.png
-    loader   /vmlinuz-)" + KERNEL_PKG + R"(
-        initrd   /initramfs-)" + KERNEL_PKG + R"(.img
-        options  "root=UUID=)" + ROOT_UUID + R"( rootflags=subvol=@ rw"
-}
-REFIND
-)";
+    if (failed == 0) return EXIT_OK;
+    return failed == results.size() ? EXIT_FAILED : EXIT_PARTIAL;
 }
 
-chroot_script += R"(
-# Initramfs
-)";
-
-if (INITRAMFS == "mkinitcpio") {
-    chroot_script += "mkinitcpio -P\n";
-} else if (INITRAMFS == "dracut") {
-    chroot_script += "dracut --regenerate-all --force\n";
-} else if (INITRAMFS == "booster") {
-    chroot_script += "booster generate\n";
-} else if (INITRAMFS == "mkinitcpio-pico") {
-    chroot_script += "mkinitcpio -P\n";
-}
-
-chroot_script += R"(
-# Network
-)";
+// Only the system settings matter: they decide the package set
+int build_offline_repo() {
+    log_message("Building local repository " + OFFLINE_REPO_BUILD);
+    if (getuid() != 0) {
+        cout << COLOR_RED << "Must be run as root!" << COLOR_RESET << endl;
+        return EXIT_NOT_STARTED;
+    }
+    vector<string> missing;
+    for (const string& name : missing_settings(current_config())) {
+        if (name == "DESKTOP_ENV" || name == "KERNEL_TYPE" || name == "INITRAMFS" || name == "BOOTLOADER") {
+            missing.push_back(name);
+        }
+    }
+    if (!missing.empty()) {
+        string names;
+        for (const string& name : missing) names += (names.empty() ? "" : ", ") + name;
+        fail_setup("installer.conf has no " + names);
+    }
 
-if (DESKTOP_ENV == "None") {
-    chroot_script += "systemctl enable NetworkManager\n";
-    chroot_script += "systemctl start NetworkManager\n";
+    string error;
+    if (!build_install_repo(current_config(), PREFETCH_DIR, MIRROR_BUNDLE, CACHE_DIRS, OFFLINE_REPO_BUILD, error)) {
+        log_message("Error: " + error);
+        cerr << COLOR_RED << "Error: " << error << COLOR_RESET << endl;
+        return EXIT_FAILED;
+    }
+    cout << COLOR_GREEN << "Local repository ready in " << OFFLINE_REPO_BUILD << COLOR_RESET << endl;
+    cout << COLOR_CYAN << "Install from it with OFFLINE_REPO=" << OFFLINE_REPO_BUILD << " in installer.conf"
+         << COLOR_RESET << endl;
+    return EXIT_OK;
 }
 
-chroot_script += R"(
-# Desktop environments
-)";
+// Every case of the matrix, one after the other, compared with the
+// previous bench_baseline.json
+int perform_benchmark() {
+    log_message("Starting benchmark");
+    if (getuid() != 0) {
+        cout << COLOR_RED << "Must be run as root!" << COLOR_RESET << endl;
+        return EXIT_NOT_STARTED;
+    }
+    vector<BenchCase> cases = bench_matrix(current_config(), BENCH_MATRIX);
+    for (const BenchCase& bench_case : cases) {
+        string names;
+        for (const string& name : missing_settings(bench_case.config)) {
+            if (name != "TARGET_DISK") names += (names.empty() ? "" : ", ") + name;
+        }
+        if (!names.empty()) fail_setup(bench_case.name + " has no " + names);
+    }
 
-if (DESKTOP_ENV != "None") {
-    chroot_script += "pacman -S --noconfirm --needed --disable-download-timeout ";
-}
+    BenchOptions options;
+    options.work_dir = BENCH_DIR;
+    options.mirror_bundle = MIRROR_BUNDLE;
+    options.cache_dirs = CACHE_DIRS;
+    options.image_bytes = static_cast<uint64_t>(BENCH_IMAGE_SIZE) << 30;
+    options.bandwidth = static_cast<uint64_t>(BENCH_BANDWIDTH) * 1024;
+    options.latency_ms = BENCH_LATENCY_MS;
+
+    // Command output only goes to the log file
+    InstallerEvents events;
+    events.output = [](const string& line) {
+        lock_guard<mutex> lock(terminal_mutex);
+        log_file << line << endl;
+    };
+    events.command_done = [](const ProcessResult& result) {
+        lock_guard<mutex> lock(terminal_mutex);
+        log_file << "[" << get_current_time() << "] [DONE] " << format_argv(result.argv) << ": exit "
+                 << result.exit_code << " in " << fixed << setprecision(2) << result.seconds() << "s" << endl;
+    };
+
+    map<string, double> baseline = read_bench_report(BENCH_REPORT_FILE);
+    vector<BenchResult> results;
+    size_t failed = 0;
+    cout << COLOR_CYAN << left << setw(40) << "Case" << setw(10) << "Time" << setw(10) << "Before" << setw(12)
+         << "Written" << "Used" << COLOR_RESET << endl;
+    for (const BenchCase& bench_case : cases) {
+        cout << left << setw(40) << bench_case.name << flush;
+        BenchResult result = run_bench_case(bench_case, options, events);
+        results.push_back(result);
+        if (!result.ok) {
+            ++failed;
+            cout << COLOR_RED << "FAILED: " << result.error << COLOR_RESET << endl;
+            log_message(result.name + " failed: " + result.error);
+            continue;
+        }
+        ostringstream seconds, before, written, used;
+        seconds << fixed << setprecision(0) << result.seconds << "s";
+        if (baseline.count(result.name)) before << fixed << setprecision(0) << baseline[result.name] << "s";
+        written << result.bytes_written / (1 << 20) << " MiB";
+        used << result.disk_used / (1 << 20) << " MiB";
+        cout << COLOR_GREEN << setw(10) << seconds.str() << setw(10) << before.str() << setw(12) << written.str()
+             << used.str() << COLOR_RESET << endl;
+        log_message(result.name + ": " + seconds.str() + ", " + written.str() + " written, " + used.str() + " used");
+    }
+    string error;
+    if (write_bench_report(BENCH_REPORT_FILE, options, results, error)) {
+        cout << COLOR_CYAN << "Results saved to " << BENCH_REPORT_FILE << ", traces per case in " << BENCH_DIR
+             << "/cases" << COLOR_RESET << endl;
+    } else {
+        log_message("Warning: " + error);
+    }
 
-if (DESKTOP_ENV == "KDE Plasma") {
-    chroot_script += R"(
-plasma-desktop qt6-base qt6-wayland wayland kde-applications-meta sddm cachyos-kde-settings ntfs-3g gtk3
-systemctl enable sddm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-echo 'blacklist ntfs3' | tee /etc/modprobe.d/disable-ntfs3.conf
-pacman -S --noconfirm --needed --disable-download-timeout firefox kate ksystemlog partitionmanager dolphin konsole pulseaudio pavucontrol
-plymouth-set-default-theme -R cachyos-bootanimation
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "GNOME") {
-    chroot_script += R"(
-gnome gnome-extra gdm
-systemctl enable gdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox gnome-terminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "XFCE") {
-    chroot_script += R"(
-xfce4 xfce4-goodies lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox mousepad xfce4-terminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "MATE") {
-    chroot_script += R"(
-mate mate-extra mate-media lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox pluma mate-terminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "LXQt") {
-    chroot_script += R"(
-lxqt breeze-icons sddm
-systemctl enable sddm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox qterminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "Cinnamon") {
-    chroot_script += R"(
-cinnamon cinnamon-translations lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox xed gnome-terminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "Budgie") {
-    chroot_script += R"(
-budgie-desktop budgie-extras gnome-control-center gnome-terminal lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox gnome-text-editor gnome-terminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "Deepin") {
-    chroot_script += R"(
-deepin deepin-extra lightdm
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox deepin-terminal pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "i3") {
-    chroot_script += R"(
-i3-wm i3status i3lock dmenu lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox alacritty pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "Sway") {
-    chroot_script += R"(
-sway swaylock swayidle waybar wofi lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox foot pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-)";
-} else if (DESKTOP_ENV == "Hyprland") {
-    chroot_script += R"(
-hyprland waybar rofi wofi kitty swaybg swaylock-effects wl-clipboard lightdm lightdm-gtk-greeter
-systemctl enable lightdm
-systemctl enable NetworkManager
-systemctl start NetworkManager
-pacman -S --noconfirm --needed --disable-download-timeout firefox kitty pulseaudio pavucontrol
-if [ -f /setup-chroot-gaming ]; then
-    pacman -S --noconfirm --needed --disable-download-timeout cachyos-gaming-meta
-fi
-
-# Hyprland config
-mkdir -p /home/)" + USER_NAME + R"(/.config/hypr
-cat > /home/)" + USER_NAME + R"(/.config/hypr/hyprland.conf << 'HYPRCONFIG'
-exec-once = waybar &
-exec-once = swaybg -i ~/wallpaper.jpg &
-monitor=,preferred,auto,1
-input {
-    kb_layout = us
-    follow_mouse = 1
-    touchpad { natural_scroll = yes }
-}
-general {
-    gaps_in = 5
-    gaps_out = 10
-    border_size = 2
-    col.active_border = rgba(33ccffee) rgba(00ff99ee) 45deg
-    col.inactive_border = rgba(595959aa)
-}
-decoration {
-    rounding = 5
-    blur = yes
-    blur_size = 3
-    blur_passes = 1
-}
-animations {
-    enabled = yes
-    bezier = myBezier, 0.05, 0.9, 0.1, 1.05
-    animation = windows, 1, 7, myBezier
-    animation = windowsOut, 1, 7, default, popin 80%
-    animation = border, 1, 10, default
-    animation = fade, 1, 7, default
-    animation = workspaces, 1, 6, default
-}
-bind = SUPER, Return, exec, kitty
-bind = SUPER, Q, killactive
-bind = SUPER, M, exit
-bind = SUPER, V, togglefloating
-bind = SUPER, F, fullscreen
-bind = SUPER, D, exec, rofi -show drun
-bind = SUPER, P, pseudo
-bind = SUPER, J, togglesplit
-HYPRCONFIG
-chown -R )" + USER_NAME + ":" + USER_NAME + " /home/" + USER_NAME + R"(/.config
-)";
+    if (failed == 0) return EXIT_OK;
+    return failed == results.size() ? EXIT_FAILED : EXIT_PARTIAL;
 }
 
-chroot_script += R"(
-# Clean up
-rm /setup-chroot.sh
-if [ -f /setup-chroot-gaming ]; then
-    rm /setup-chroot-gaming
-fi
-)";
-
-ofstream chroot_file("/mnt/setup-chroot.sh");
-chroot_file << chroot_script;
-chroot_file.close();
-
-// Check if gaming packages should be installed
-if (run_command("dialog --title \"Gaming Packages\" --yesno \"Install cachyos-gaming-meta package?\" 7 40") == "0") {
-    ofstream gaming_flag("/mnt/setup-chroot-gaming");
-    gaming_flag.close();
-}
+void perform_installation() {
+    show_ascii();
+    log_message("Starting installation process");
+    check_system();
 
-execute_command("chmod +x /mnt/setup-chroot.sh");
-log_message("Running chroot configuration");
-execute_command("arch-chroot /mnt /setup-chroot.sh");
-draw_progress_bar(++current_step, TOTAL_STEPS);
+    vector<string> missing = missing_settings(current_config());
+    if (HEADLESS && !missing.empty()) {
+        string names;
+        for (const string& name : missing) names += (names.empty() ? "" : ", ") + name;
+        fail_setup("installer.conf has no " + names);
+    }
 
-// Final cleanup
-log_message("Finalizing installation");
-execute_command("umount -R /mnt");
-draw_progress_bar(TOTAL_STEPS, TOTAL_STEPS);
+    InstallerOptions options;
+    options.staging_dir = PREFETCH_DIR;
+    options.mirror_bundle = MIRROR_BUNDLE;
+    options.cache_dirs = CACHE_DIRS;
+    options.parallel_downloads = PARALLEL_DOWNLOADS;
+
+    // Steps run on worker threads; every write to the terminal holds terminal_mutex
+    InstallerEvents events;
+    events.output = [](const string& line) {
+        lock_guard<mutex> lock(terminal_mutex);
+        cout << "\033[K" << COLOR_CYAN << line << COLOR_RESET << endl;
+        log_file << line << endl;
+    };
+    events.command_done = [](const ProcessResult& result) {
+        lock_guard<mutex> lock(terminal_mutex);
+        log_file << "[" << get_current_time() << "] [DONE] " << format_argv(result.argv) << ": exit "
+                 << result.exit_code << " in " << fixed << setprecision(2) << result.seconds() << "s" << endl;
+    };
+    events.progress = []() {
+        lock_guard<mutex> lock(terminal_mutex);
+        draw_progress_bar();
+    };
+
+    Installer install(current_config(), options, events);
+    {
+        lock_guard<mutex> lock(terminal_mutex);
+        installer = &install;
+    }
+    start_progress_ticker();
+    string error;
+    bool ok = install.run(error);
+    {
+        lock_guard<mutex> lock(terminal_mutex);
+        progress_ticking = false;
+        if (ok) draw_progress_bar();
+        installer = nullptr;
+    }
+    if (!ok) {
+        log_message("Error: " + error);
+        cerr << COLOR_RED << "Error: " << error << COLOR_RESET << endl;
+        exit(EXIT_FAILED);
+    }
 
-cout << COLOR_GREEN << "\n[" << get_current_time() << "] Installation complete!" << COLOR_RESET << endl;
-cout << COLOR_YELLOW << "You can now reboot into your new CachyOS installation." << COLOR_RESET << endl;
-cout << COLOR_CYAN << "Installation log saved to installation_log.txt" << COLOR_RESET << endl;
+    cout << COLOR_GREEN << "\n[" << get_current_time() << "] Installation complete!" << COLOR_RESET << endl;
+    cout << COLOR_YELLOW << "You can now reboot into your new CachyOS installation." << COLOR_RESET << endl;
+    cout << COLOR_CYAN << "Installation log saved to installation_log.txt" << COLOR_RESET << endl;
+    cout << COLOR_CYAN << "Command timings saved to " << TRACE_FILE << " and " << TRACE_SUMMARY_FILE << COLOR_RESET << endl;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    set_log_sink(log_message);
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--headless") HEADLESS = true;
+        else if (string(argv[i]) == "--build-offline-repo" && i + 1 < argc) OFFLINE_REPO_BUILD = argv[++i];
+        else if (string(argv[i]) == "--benchmark") BENCHMARK = true;
+    }
     show_ascii();
     configure_installation();
-    perform_installation();
+    int status = EXIT_OK;
+    if (!OFFLINE_REPO_BUILD.empty()) {
+        status = build_offline_repo();
+    } else if (BENCHMARK) {
+        status = perform_benchmark();
+    } else if (batch_mode()) {
+        status = perform_batch_installation();
+    } else {
+        perform_installation();
+    }
     log_file.close();
-    return 0;
+    return status;
 }
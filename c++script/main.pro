@@ -3,6 +3,10 @@ CONFIG += c++23
 TARGET = Cachyos-Btrfs-Installer
 # Source Files
 SOURCES += main.cpp
+# Shared installer core
+INCLUDEPATH += ../core
+HEADERS += ../core/batch.h ../core/bench.h ../core/btrfs.h ../core/cache.h ../core/chroot.h ../core/compression.h ../core/config.h ../core/cpu.h ../core/disk.h ../core/gpt.h ../core/image.h ../core/installer.h ../core/journal.h ../core/log.h ../core/mirrors.h ../core/mount.h ../core/offline.h ../core/packages.h ../core/prefetch.h ../core/progress.h ../core/process.h ../core/recompress.h ../core/repos.h ../core/scheduler.h ../core/subvolumes.h ../core/trace.h ../core/tuning.h ../core/wipe.h
+SOURCES += ../core/batch.cpp ../core/bench.cpp ../core/btrfs.cpp ../core/cache.cpp ../core/chroot.cpp ../core/compression.cpp ../core/cpu.cpp ../core/disk.cpp ../core/gpt.cpp ../core/image.cpp ../core/installer.cpp ../core/journal.cpp ../core/log.cpp ../core/mirrors.cpp ../core/mount.cpp ../core/offline.cpp ../core/packages.cpp ../core/prefetch.cpp ../core/progress.cpp ../core/process.cpp ../core/recompress.cpp ../core/repos.cpp ../core/scheduler.cpp ../core/subvolumes.cpp ../core/trace.cpp ../core/tuning.cpp ../core/wipe.cpp
+LIBS += -lzstd
 # Qt Modules
 QT += core
-# Resource File
@@ -0,0 +1,229 @@
+#include "batch.h"
+#include "cache.h"
+#include "cpu.h"
+#include "log.h"
+#include "mirrors.h"
+#include "packages.h"
+#include "repos.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static ResourceLimits batch_limits(const BatchOptions& options, size_t targets) {
+    ResourceLimits limits;
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    limits.disk = options.disk_slots > 0 ? options.disk_slots : static_cast<int>(targets) + 1;
+    limits.cpu = options.cpu_slots > 0 ? options.cpu_slots : static_cast<int>(std::max(1u, cores / 4));
+    limits.network = 1;
+    return limits;
+}
+
+// installation_trace.json -> installation_trace-sdb.json
+static std::string labelled(const std::string& file, const std::string& label) {
+    fs::path path(file);
+    return path.stem().string() + "-" + label + path.extension().string();
+}
+
+std::string disk_label(const std::string& disk) {
+    return fs::path(disk).filename().string();
+}
+
+std::vector<std::string> missing_settings(const InstallConfig& config) {
+    std::vector<std::pair<const char*, const std::string*>> required = {
+        {"TARGET_DISK", &config.target_disk},     {"HOSTNAME", &config.hostname},
+        {"TIMEZONE", &config.timezone},           {"KEYMAP", &config.keymap},
+        {"USER_NAME", &config.user_name},         {"USER_PASSWORD", &config.user_password},
+        {"ROOT_PASSWORD", &config.root_password}, {"DESKTOP_ENV", &config.desktop_env},
+        {"KERNEL_TYPE", &config.kernel_type},     {"INITRAMFS", &config.initramfs},
+        {"BOOTLOADER", &config.bootloader},
+    };
+    // An image brings its own system settings; the first seven are per host
+    if (!config.image.empty()) required.resize(7);
+    std::vector<std::string> missing;
+    for (const auto& [name, value] : required) {
+        if (value->empty()) missing.push_back(name);
+    }
+    return missing;
+}
+
+BatchInstall::BatchInstall(std::vector<BatchTarget> batch_targets, const BatchOptions& options,
+                           const std::function<InstallerEvents(size_t target)>& events_for)
+    : targets(std::move(batch_targets)), options(options), pool(batch_limits(options, targets.size())),
+      installers(targets.size()) {
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (targets[i].target_root.empty()) targets[i].target_root = "/mnt/" + disk_label(targets[i].config.target_disk);
+        events.push_back(events_for ? events_for(i) : InstallerEvents());
+    }
+}
+
+bool BatchInstall::validate(std::string& error) const {
+    if (targets.empty()) {
+        error = "No target disks";
+        return false;
+    }
+    std::set<std::string> disks, roots;
+    for (const BatchTarget& target : targets) {
+        std::vector<std::string> missing = missing_settings(target.config);
+        if (!missing.empty()) {
+            std::string names;
+            for (const std::string& name : missing) names += (names.empty() ? "" : ", ") + name;
+            error = (target.config.target_disk.empty() ? "A target" : target.config.target_disk) + " has no " + names;
+            return false;
+        }
+        // /dev/disk/by-id links and the node they point at are the same disk
+        std::error_code ec;
+        std::string disk = fs::weakly_canonical(target.config.target_disk, ec).string();
+        if (ec) disk = target.config.target_disk;
+        if (!disks.insert(disk).second) {
+            error = target.config.target_disk + " is listed more than once";
+            return false;
+        }
+        if (!roots.insert(target.target_root).second) {
+            error = "Two disks would be mounted at " + target.target_root;
+            return false;
+        }
+    }
+    return true;
+}
+
+double BatchInstall::fraction(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return installers[index] ? installers[index]->fraction() : 0.0;
+}
+
+std::string BatchInstall::status(size_t index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return installers[index] ? installers[index]->status() : "Waiting";
+}
+
+std::vector<BatchResult> BatchInstall::run() {
+    std::error_code ignored;
+    fs::create_directories(options.staging_dir, ignored);
+    core_log("Installing " + std::to_string(targets.size()) + " disks, at most " + std::to_string(pool.limits().disk) +
+             " disk-heavy and " + std::to_string(pool.limits().cpu) + " CPU-heavy steps at a time");
+
+    // Done once for the whole batch: caches (none of them on a target),
+    // mirror ranking and one download per CPU level
+    std::vector<std::string> target_disks;
+    for (const BatchTarget& target : targets) target_disks.push_back(target.config.target_disk);
+    std::vector<PackageCache> caches = find_package_caches(target_disks, options.cache_dirs);
+    std::vector<std::string> cache_dirs;
+    for (const PackageCache& cache : caches) cache_dirs.push_back(cache.path);
+
+    std::string ranked_mirrors = rank_bundled_mirrors(options.mirror_bundle, options.staging_dir + "/mirrors");
+    int parallel_downloads = options.parallel_downloads;
+    if (parallel_downloads == 0) parallel_downloads = tune_parallel_downloads(ranked_mirrors);
+    install_live_download_settings(ranked_mirrors, parallel_downloads);
+    if (parallel_downloads == 0) parallel_downloads = -1;
+
+    std::map<std::string, std::vector<size_t>> by_level;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        InstallConfig& config = targets[i].config;
+        config.cpu_level = cpu_level_name(resolve_cpu_level(config.cpu_level));
+        // Disks installed from an image or a local repository download nothing
+        if (config.image.empty() && config.offline_repo.empty()) by_level[config.cpu_level].push_back(i);
+    }
+    for (const auto& [level_name, members] : by_level) {
+        CpuLevel level = CpuLevel::Generic;
+        parse_cpu_level(level_name, level);
+        std::string dir = options.staging_dir + "/" + level_name;
+        fs::create_directories(dir, ignored);
+
+        // Every repo and package any of these disks asks for
+        std::vector<std::string> repos, packages;
+        for (size_t i : members) {
+            for (const std::string& repo : targets[i].config.repos) {
+                if (std::find(repos.begin(), repos.end(), repo) == repos.end()) repos.push_back(repo);
+            }
+            for (const std::string& package : full_package_set(targets[i].config)) {
+                if (std::find(packages.begin(), packages.end(), package) == packages.end()) packages.push_back(package);
+            }
+        }
+        auto prefetcher = std::make_unique<PackagePrefetcher>(dir);
+        std::string pacman_conf = dir + "/pacman.target.conf";
+        if (write_target_pacman_conf("/etc/pacman.conf", level, repos, pacman_conf)) {
+            if (parallel_downloads > 0) {
+                set_pacman_option(pacman_conf, "ParallelDownloads", std::to_string(parallel_downloads));
+            }
+            if (!ranked_mirrors.empty() && write_install_pacman_conf(pacman_conf, ranked_mirrors, dir + "/pacman.conf")) {
+                pacman_conf = dir + "/pacman.conf";
+            }
+            prefetcher->set_pacman_config(pacman_conf);
+        }
+        prefetcher->add_cache_dirs(cache_dirs);
+        prefetcher->start(packages);
+        prefetchers[level_name] = std::move(prefetcher);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < targets.size(); ++i) {
+            std::string label = disk_label(targets[i].config.target_disk);
+            InstallerOptions installer_options;
+            installer_options.staging_dir = options.staging_dir;
+            installer_options.state_dir = options.staging_dir + "/targets/" + label;
+            installer_options.mirror_bundle = options.mirror_bundle;
+            installer_options.cache_dirs = cache_dirs;
+            installer_options.find_caches = false;
+            installer_options.target_root = targets[i].target_root;
+            installer_options.workers = options.workers;
+            installer_options.trace_file = labelled(TRACE_FILE, label);
+            installer_options.summary_file = labelled(TRACE_SUMMARY_FILE, label);
+            installer_options.log_prefix = label + ": ";
+            installer_options.shared_pool = &pool;
+            auto prefetcher = prefetchers.find(targets[i].config.cpu_level);
+            if (prefetcher != prefetchers.end()) installer_options.shared_prefetch = prefetcher->second.get();
+            installer_options.ranked_mirrors = ranked_mirrors;
+            installer_options.parallel_downloads = parallel_downloads;
+            installers[i] = std::make_unique<Installer>(targets[i].config, installer_options, events[i]);
+        }
+    }
+
+    std::vector<BatchResult> results(targets.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        BatchResult& result = results[i];
+        result.disk = targets[i].config.target_disk;
+        result.hostname = targets[i].config.hostname;
+        result.target_root = targets[i].target_root;
+        result.trace_file = labelled(TRACE_FILE, disk_label(result.disk));
+        threads.emplace_back([&result, installer = installers[i].get()]() {
+            int64_t started = monotonic_ns();
+            result.ok = installer->run(result.error);
+            result.seconds = (monotonic_ns() - started) / 1e9;
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+
+    for (auto& [level_name, prefetcher] : prefetchers) prefetcher->wait();
+    release_package_caches(caches);
+    return results;
+}
+
+bool write_batch_report(const std::string& path, const std::vector<BatchResult>& results, std::string& error) {
+    std::ofstream out(path);
+    out << "{\"disks\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BatchResult& result = results[i];
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%.3f", result.seconds);
+        out << (i ? ",\n" : "\n") << "{\"disk\":" << json_string(result.disk)
+            << ",\"hostname\":" << json_string(result.hostname) << ",\"target_root\":" << json_string(result.target_root)
+            << ",\"ok\":" << (result.ok ? "true" : "false") << ",\"error\":" << json_string(result.error)
+            << ",\"seconds\":" << seconds << ",\"trace_file\":" << json_string(result.trace_file) << "}";
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out) {
+        error = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "config.h"
+#include "installer.h"
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One disk of a batch and the settings it is installed with
+struct BatchTarget {
+    InstallConfig config;
+    std::string target_root;    // empty: /mnt/<disk name>
+};
+
+struct BatchOptions {
+    std::string staging_dir = DEFAULT_PREFETCH_DIR;
+    std::string mirror_bundle = DEFAULT_MIRROR_BUNDLE;
+    std::vector<std::string> cache_dirs;
+    int workers = 4;            // per disk
+    int disk_slots = 0;         // disk-heavy steps at once across all disks; 0: one per disk plus one
+    int cpu_slots = 0;          // CPU-heavy steps at once across all disks; 0: a quarter of the cores
+    int parallel_downloads = 0; // pacman's ParallelDownloads; 0: measure once, -1: keep
+};
+
+struct BatchResult {
+    std::string disk;
+    std::string hostname;
+    std::string target_root;
+    bool ok = false;
+    std::string error;
+    double seconds = 0;
+    std::string trace_file;
+};
+
+// Installs several disks at once without asking anything, for imaging a
+// batch of drives on one workstation. Each disk gets its own mount root,
+// journal and trace files and runs its own Installer on its own thread.
+// What they have in common is done once: the mirrors are ranked once, and
+// the union of the package sets is downloaded once per CPU level into the
+// shared staging cache, which every pacstrap reads from. Disk- and
+// CPU-heavy steps of all installs draw from one resource pool, so a batch
+// of eight disks does not run eight mkinitcpio or eight mkfs at a time.
+class BatchInstall {
+public:
+    // events_for(i) is called once per target, before run(), for the
+    // hooks of that target's install
+    BatchInstall(std::vector<BatchTarget> targets, const BatchOptions& options,
+                 const std::function<InstallerEvents(size_t target)>& events_for);
+
+    // Distinct disks and mount roots, and nothing left for a dialog to ask
+    bool validate(std::string& error) const;
+
+    // Blocks until every install has finished or failed. One result per
+    // target, in the order given.
+    std::vector<BatchResult> run();
+
+    size_t size() const { return targets.size(); }
+    const BatchTarget& target(size_t index) const { return targets[index]; }
+    double fraction(size_t index) const;
+    std::string status(size_t index) const;
+
+private:
+    std::vector<BatchTarget> targets;
+    BatchOptions options;
+    std::vector<InstallerEvents> events;
+    ResourcePool pool;
+    std::map<std::string, std::unique_ptr<PackagePrefetcher>> prefetchers;  // by CPU level
+    mutable std::mutex mutex;       // installers, created by run()
+    std::vector<std::unique_ptr<Installer>> installers;
+};
+
+// Short name of a disk for mount roots, state directories and log prefixes:
+// /dev/nvme0n1 -> nvme0n1, /dev/disk/by-id/usb-X -> usb-X
+std::string disk_label(const std::string& disk);
+
+// The settings a non-interactive install cannot do without, by their
+// installer.conf names, that config leaves empty. With an image only the
+// per-host ones count.
+std::vector<std::string> missing_settings(const InstallConfig& config);
+
+// results as JSON: per disk the result, error, seconds and trace file
+bool write_batch_report(const std::string& path, const std::vector<BatchResult>& results, std::string& error);
+
+inline constexpr const char* BATCH_REPORT_FILE = "batch_report.json";
@@ -0,0 +1,413 @@
+#include "bench.h"
+#include "log.h"
+#include "mirrors.h"
+#include "offline.h"
+#include "process.h"
+#include "repos.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static constexpr size_t SEND_CHUNK = 64 * 1024;
+
+PackageServer::~PackageServer() {
+    stop();
+}
+
+bool PackageServer::start(const std::string& served_root, uint64_t bytes_per_second, int latency, std::string& error) {
+    root = served_root;
+    rate = bytes_per_second;
+    latency_ms = latency;
+    next_send_ns = 0;
+    served = 0;
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        error = std::string("socket: ") + strerror(errno);
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_fd, 64) != 0 ||
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        error = std::string("package server: ") + strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    port = ntohs(address.sin_port);
+    running = true;
+    acceptor = std::thread(&PackageServer::accept_connections, this);
+    core_log("Serving " + root + " at " + url());
+    return true;
+}
+
+void PackageServer::stop() {
+    running = false;
+    if (acceptor.joinable()) acceptor.join();
+    if (listen_fd >= 0) close(listen_fd);
+    listen_fd = -1;
+    std::vector<std::thread> open;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        open.swap(connections);
+    }
+    for (std::thread& connection : open) connection.join();
+}
+
+// Polls so stop() is noticed without a connection coming in
+void PackageServer::accept_connections() {
+    while (running) {
+        pollfd listening = {listen_fd, POLLIN, 0};
+        if (poll(&listening, 1, 200) <= 0) continue;
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        connections.emplace_back(&PackageServer::serve, this, fd);
+    }
+}
+
+// Every connection's chunks queue for the same link: each one books the
+// next free slot of bandwidth and sleeps until it has passed
+void PackageServer::throttle(size_t bytes) {
+    if (rate == 0) return;
+    int64_t now = monotonic_ns();
+    int64_t until;
+    {
+        std::lock_guard<std::mutex> lock(rate_mutex);
+        next_send_ns = std::max(next_send_ns, now) + static_cast<int64_t>(bytes * 1000000000ull / rate);
+        until = next_send_ns;
+    }
+    if (until > now) std::this_thread::sleep_for(std::chrono::nanoseconds(until - now));
+}
+
+static bool send_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// /offline/name-1%3A2.0-1-x86_64.pkg.tar.zst?x -> /offline/name-1:2.0-1-x86_64.pkg.tar.zst
+static std::string request_path(const std::string& target) {
+    std::string path;
+    std::string raw = target.substr(0, target.find('?'));
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] == '%' && i + 2 < raw.size() && std::isxdigit(raw[i + 1]) && std::isxdigit(raw[i + 2])) {
+            path += static_cast<char>(std::stoi(raw.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            path += raw[i];
+        }
+    }
+    return path;
+}
+
+void PackageServer::serve(int fd) {
+    std::string request;
+    char buffer[4096];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16384) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) break;
+        request.append(buffer, static_cast<size_t>(received));
+    }
+    std::istringstream line(request);
+    std::string method, target;
+    line >> method >> target;
+    std::string path = request_path(target);
+    std::string file = root + path;
+    std::error_code ec;
+    bool found = (method == "GET" || method == "HEAD") && !path.empty() && path[0] == '/' &&
+                 path.find("..") == std::string::npos && fs::is_regular_file(file, ec);
+    if (latency_ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(latency_ms));
+
+    if (!found) {
+        std::string response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        send_all(fd, response.data(), response.size());
+        close(fd);
+        return;
+    }
+    std::string header = "HTTP/1.0 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                         std::to_string(fs::file_size(file, ec)) + "\r\nConnection: close\r\n\r\n";
+    bool ok = send_all(fd, header.data(), header.size());
+    if (ok && method == "GET") {
+        std::ifstream in(file, std::ios::binary);
+        std::vector<char> chunk(SEND_CHUNK);
+        while (ok && running && in) {
+            in.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+            size_t bytes = static_cast<size_t>(in.gcount());
+            if (bytes == 0) break;
+            throttle(bytes);
+            ok = send_all(fd, chunk.data(), bytes);
+            if (ok) served += bytes;
+        }
+    }
+    close(fd);
+}
+
+LoopDevice::~LoopDevice() {
+    detach();
+}
+
+bool LoopDevice::attach(const std::string& image_path, uint64_t size, std::string& error) {
+    image = image_path;
+    std::error_code ec;
+    fs::create_directories(fs::path(image).parent_path(), ec);
+    fs::remove(image, ec);
+    std::ofstream(image).close();
+    fs::resize_file(image, size, ec);
+    if (ec) {
+        error = "Could not create " + image + ": " + ec.message();
+        return false;
+    }
+    ProcessOptions options;
+    options.stdin_mode = StdinMode::Null;
+    options.capture = true;
+    ProcessResult result = run_process({"losetup", "--find", "--show", "--partscan", image}, options);
+    path = result.stdout_text.substr(0, result.stdout_text.find('\n'));
+    if (!result.ok() || path.empty()) {
+        error = "losetup " + image + " failed: " + result.stderr_text;
+        path.clear();
+        return false;
+    }
+    return true;
+}
+
+void LoopDevice::detach() {
+    if (!path.empty() && run_quietly({"losetup", "--detach", path}) != 0) {
+        core_log("Warning: could not detach " + path);
+    }
+    path.clear();
+}
+
+// Field 7 of /sys/block/<dev>/stat: sectors written, in 512-byte units
+uint64_t LoopDevice::bytes_written() const {
+    std::ifstream stat("/sys/block/" + fs::path(path).filename().string() + "/stat");
+    uint64_t field = 0;
+    for (int i = 0; i < 7; ++i) stat >> field;
+    return stat ? field * 512 : 0;
+}
+
+uint64_t LoopDevice::allocated() const {
+    struct stat info;
+    if (stat(image.c_str(), &info) != 0) return 0;
+    return static_cast<uint64_t>(info.st_blocks) * 512;
+}
+
+std::vector<BenchCase> bench_matrix(const InstallConfig& base, const BenchMatrix& matrix) {
+    auto values = [](const std::vector<std::string>& list, const std::string& current) {
+        return list.empty() ? std::vector<std::string>{current} : list;
+    };
+    InstallConfig host = base;
+    if (host.hostname.empty()) host.hostname = "bench";
+    if (host.timezone.empty()) host.timezone = "UTC";
+    if (host.keymap.empty()) host.keymap = "us";
+    if (host.user_name.empty()) host.user_name = "bench";
+    if (host.user_password.empty()) host.user_password = "benchmark";
+    if (host.root_password.empty()) host.root_password = "benchmark";
+    host.image.clear();
+    host.image_build.clear();
+    host.firmware_entry = false;
+
+    std::vector<BenchCase> cases;
+    for (const std::string& kernel : values(matrix.kernels, base.kernel_type)) {
+        for (const std::string& bootloader : values(matrix.bootloaders, base.bootloader)) {
+            for (const std::string& initramfs : values(matrix.initramfs, base.initramfs)) {
+                for (const std::string& desktop : values(matrix.desktops, base.desktop_env)) {
+                    BenchCase bench_case;
+                    bench_case.config = host;
+                    bench_case.config.kernel_type = kernel;
+                    bench_case.config.bootloader = bootloader;
+                    bench_case.config.initramfs = initramfs;
+                    bench_case.config.desktop_env = desktop;
+                    for (const std::string& part : {kernel, bootloader, initramfs, desktop}) {
+                        if (!bench_case.repo.empty()) bench_case.repo += "-";
+                        for (char c : part) {
+                            if (c != ' ') bench_case.repo += c;
+                        }
+                    }
+                    for (const std::string& source : values(matrix.sources, "online")) {
+                        bench_case.offline = source == "offline";
+                        bench_case.name = bench_case.repo + (bench_case.offline ? "-offline" : "");
+                        cases.push_back(bench_case);
+                    }
+                }
+            }
+        }
+    }
+    return cases;
+}
+
+// The stand-in as the only mirror of every bundled list. Each repo of the
+// target's pacman.conf gets its <repo>.db next to the repository's own
+// database, so the case's packages are found whichever repo pacman asks.
+static bool write_bench_mirrors(const InstallConfig& config, const std::string& repo_dir, const std::string& server,
+                                const std::string& ranked_dir, std::string& error) {
+    std::error_code ec;
+    fs::create_directories(ranked_dir, ec);
+    std::string database = std::string(OFFLINE_REPO_NAME) + ".db.tar.zst";
+    for (const RepoSection& section : target_repo_sections(resolve_cpu_level(config.cpu_level), config.repos)) {
+        fs::path alias = fs::path(repo_dir) / (section.name + ".db");
+        fs::remove(alias, ec);
+        fs::create_symlink(database, alias, ec);
+        if (ec) {
+            error = "symlink " + alias.string() + ": " + ec.message();
+            return false;
+        }
+    }
+    for (const MirrorList& list : bundled_mirrorlists()) {
+        std::ofstream mirrorlist(ranked_dir + "/" + list.file);
+        mirrorlist << "# Benchmark stand-in\nServer = " << server << "\n";
+        if (!mirrorlist) {
+            error = "Could not write " + ranked_dir + "/" + list.file;
+            return false;
+        }
+    }
+    return true;
+}
+
+BenchResult run_bench_case(const BenchCase& bench_case, const BenchOptions& options, const InstallerEvents& events) {
+    BenchResult result;
+    result.name = bench_case.name;
+    result.offline = bench_case.offline;
+    result.config = bench_case.config;
+    std::string repos = options.work_dir + "/repos";
+    std::string repo_dir = repos + "/" + bench_case.repo;
+    std::string case_dir = options.work_dir + "/cases/" + bench_case.name;
+    std::error_code ec;
+    fs::remove_all(case_dir, ec);
+    fs::create_directories(case_dir, ec);
+
+    if (!fs::exists(repo_dir + "/" + OFFLINE_PACKAGE_LIST)) {
+        // The other cases' repositories have most of the packages already
+        std::vector<std::string> cache_dirs = options.cache_dirs;
+        for (const auto& entry : fs::directory_iterator(repos, ec)) {
+            if (entry.path() != repo_dir && fs::exists(entry.path() / OFFLINE_PACKAGE_LIST)) {
+                cache_dirs.push_back(entry.path().string());
+            }
+        }
+        core_log("Building the package repository for " + bench_case.repo);
+        if (!build_install_repo(bench_case.config, case_dir, options.mirror_bundle, cache_dirs, repo_dir, result.error)) {
+            return result;
+        }
+    }
+
+    PackageServer server;
+    LoopDevice disk;
+    if (!server.start(repos, options.bandwidth, options.latency_ms, result.error) ||
+        !disk.attach(options.work_dir + "/disk.img", options.image_bytes, result.error)) {
+        return result;
+    }
+    InstallConfig config = bench_case.config;
+    config.target_disk = disk.device();
+    InstallerOptions installer_options;
+    installer_options.staging_dir = case_dir;
+    installer_options.state_dir = case_dir + "/state";
+    installer_options.mirror_bundle = options.mirror_bundle;
+    installer_options.find_caches = false;
+    installer_options.target_root = options.work_dir + "/mnt";
+    installer_options.workers = options.workers;
+    installer_options.trace_file = case_dir + "/" + TRACE_FILE;
+    installer_options.summary_file = case_dir + "/" + TRACE_SUMMARY_FILE;
+    installer_options.log_prefix = bench_case.name + ": ";
+    if (bench_case.offline) {
+        config.offline_repo = repo_dir;
+        installer_options.offline_server = server.url() + "/" + bench_case.repo;
+    } else {
+        installer_options.ranked_mirrors = case_dir + "/mirrors/ranked";
+        if (!write_bench_mirrors(config, repo_dir, server.url() + "/" + bench_case.repo,
+                                 installer_options.ranked_mirrors, result.error)) {
+            return result;
+        }
+    }
+
+    core_log("Benchmarking " + bench_case.name + " on " + disk.device());
+    Installer installer(config, installer_options, events);
+    int64_t started = monotonic_ns();
+    result.ok = installer.run(result.error);
+    result.seconds = (monotonic_ns() - started) / 1e9;
+    result.stages = installer.stage_seconds();
+    server.stop();
+    result.bytes_served = server.bytes_served();
+    result.bytes_written = disk.bytes_written();
+    disk.detach();
+    result.disk_used = disk.allocated();
+    fs::remove(options.work_dir + "/disk.img", ec);
+    return result;
+}
+
+static std::string bench_number(double value) {
+    char number[32];
+    std::snprintf(number, sizeof(number), "%.3f", value);
+    return number;
+}
+
+bool write_bench_report(const std::string& path, const BenchOptions& options, const std::vector<BenchResult>& results,
+                        std::string& error) {
+    std::ofstream out(path);
+    out << "{\"bandwidth\":" << options.bandwidth << ",\"latency_ms\":" << options.latency_ms
+        << ",\"image_bytes\":" << options.image_bytes << ",\"cases\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        out << (i ? ",\n" : "\n") << "{\"name\":" << json_string(result.name)
+            << ",\"source\":" << json_string(result.offline ? "offline" : "online")
+            << ",\"kernel\":" << json_string(result.config.kernel_type)
+            << ",\"bootloader\":" << json_string(result.config.bootloader)
+            << ",\"initramfs\":" << json_string(result.config.initramfs)
+            << ",\"desktop\":" << json_string(result.config.desktop_env) << ",\"ok\":" << (result.ok ? "true" : "false")
+            << ",\"error\":" << json_string(result.error) << ",\"seconds\":" << bench_number(result.seconds)
+            << ",\"bytes_written\":" << result.bytes_written << ",\"disk_used\":" << result.disk_used
+            << ",\"bytes_served\":" << result.bytes_served << ",\"stages\":{";
+        for (size_t j = 0; j < result.stages.size(); ++j) {
+            out << (j ? "," : "") << json_string(result.stages[j].first) << ":" << bench_number(result.stages[j].second);
+        }
+        out << "}}";
+    }
+    out << "\n]}\n";
+    out.close();
+    if (!out) {
+        error = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Relies on the layout write_bench_report() writes: one case per line,
+// name first and the total before the per-stage times
+std::map<std::string, double> read_bench_report(const std::string& path) {
+    std::map<std::string, double> totals;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("{\"name\":\"");
+        size_t seconds = line.find(",\"seconds\":");
+        if (name == std::string::npos || seconds == std::string::npos || line.find(",\"ok\":true") == std::string::npos) {
+            continue;
+        }
+        name += 9;
+        totals[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(seconds + 11));
+    }
+    return totals;
+}
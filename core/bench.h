@@ -0,0 +1,139 @@
+#pragma once
+
+#include "config.h"
+#include "installer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// End-to-end benchmark of the installer without a spare disk or the public
+// mirrors: every case installs onto a sparse image attached as a loop
+// device, downloading its packages from a local HTTP stand-in for a mirror
+// with a chosen bandwidth and latency. The stand-in serves a local
+// repository per case (see offline.h), built once and kept in the
+// benchmark directory, so runs are repeatable and comparable.
+//
+// Online cases take the normal download path: ranked mirrorlists whose
+// only server is the stand-in, which answers for every repo with the
+// case's database, so prefetch and the ParallelDownloads tuning run as in
+// a real install. Offline cases install from the repository as with
+// OFFLINE_REPO, through the stand-in.
+
+inline constexpr const char* DEFAULT_BENCH_DIR = "/var/tmp/cachyos-installer-bench";
+inline constexpr const char* BENCH_REPORT_FILE = "bench_baseline.json";
+
+// The values each setting takes; an empty list keeps the base config's value
+struct BenchMatrix {
+    std::vector<std::string> kernels;
+    std::vector<std::string> bootloaders;
+    std::vector<std::string> initramfs;
+    std::vector<std::string> desktops;
+    std::vector<std::string> sources;       // "online", "offline"; empty: online only
+};
+
+struct BenchCase {
+    std::string name;           // Bore-GRUB-mkinitcpio-KDEPlasma, with -offline for offline cases
+    std::string repo;           // the package repository, shared by both sources
+    bool offline = false;
+    InstallConfig config;
+};
+
+struct BenchOptions {
+    std::string work_dir = DEFAULT_BENCH_DIR;   // repos, disk image, per-case state and traces
+    std::string mirror_bundle = DEFAULT_MIRROR_BUNDLE;
+    std::vector<std::string> cache_dirs;        // only for building the repos
+    uint64_t image_bytes = 64ull << 30;
+    uint64_t bandwidth = 0;                     // bytes per second across all connections, 0: unlimited
+    int latency_ms = 0;                         // before every response
+    int workers = 4;
+};
+
+struct BenchResult {
+    std::string name;
+    bool offline = false;
+    InstallConfig config;
+    bool ok = false;
+    std::string error;
+    double seconds = 0;
+    std::vector<std::pair<std::string, double>> stages;   // as Installer::stage_seconds()
+    uint64_t bytes_written = 0;     // to the loop device
+    uint64_t disk_used = 0;         // blocks the image holds afterwards
+    uint64_t bytes_served = 0;      // by the package stand-in
+};
+
+// Serves the files below root over HTTP/1.0 on 127.0.0.1, one thread per
+// connection. Every response waits latency_ms first, and the bodies of all
+// connections together are sent at no more than bytes_per_second.
+class PackageServer {
+public:
+    ~PackageServer();
+
+    // Listens on a free port
+    bool start(const std::string& root, uint64_t bytes_per_second, int latency_ms, std::string& error);
+    // Waits for the open connections to finish
+    void stop();
+
+    std::string url() const { return "http://127.0.0.1:" + std::to_string(port); }
+    uint64_t bytes_served() const { return served; }
+
+private:
+    void accept_connections();
+    void serve(int fd);
+    void throttle(size_t bytes);
+
+    std::string root;
+    uint64_t rate = 0;
+    int latency_ms = 0;
+    int listen_fd = -1;
+    int port = 0;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> served{0};
+    std::thread acceptor;
+    std::mutex connections_mutex;
+    std::vector<std::thread> connections;
+    std::mutex rate_mutex;
+    int64_t next_send_ns = 0;       // when the bandwidth allows the next chunk
+};
+
+// A sparse file attached with losetup --partscan, detached and deleted by
+// detach() or the destructor
+class LoopDevice {
+public:
+    ~LoopDevice();
+
+    bool attach(const std::string& image, uint64_t size, std::string& error);
+    void detach();
+
+    const std::string& device() const { return path; }
+    // Written through the device since it was attached, from its sysfs stat
+    uint64_t bytes_written() const;
+    // What the image file takes on the host filesystem
+    uint64_t allocated() const;
+
+private:
+    std::string image;
+    std::string path;
+};
+
+// Every combination of the matrix on top of base. Per-host settings base
+// leaves empty get throwaway values; the target disk is set per run.
+std::vector<BenchCase> bench_matrix(const InstallConfig& base, const BenchMatrix& matrix);
+
+// Builds the case's repository if the benchmark directory does not have it
+// yet (not timed), then installs it onto a fresh loop device with the
+// packages downloaded from the stand-in. The journal is cleared first, so
+// nothing is resumed.
+BenchResult run_bench_case(const BenchCase& bench_case, const BenchOptions& options, const InstallerEvents& events);
+
+// The settings and results of a run as JSON, one case per line
+bool write_bench_report(const std::string& path, const BenchOptions& options, const std::vector<BenchResult>& results,
+                        std::string& error);
+
+// Total seconds of each successful case in an earlier report, by case name
+std::map<std::string, double> read_bench_report(const std::string& path);
@@ -0,0 +1,120 @@
+#include "btrfs.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/btrfs.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Opens the parent directory of path and checks the new entry's name
+// against max_name, the name field of the ioctl's args struct
+static int open_parent(const std::string& path, size_t max_name, std::string& name, std::string& error) {
+    fs::path target(path);
+    std::string parent = target.parent_path().string();
+    name = target.filename().string();
+    if (parent.empty() || name.empty() || name.size() > max_name) {
+        error = "invalid subvolume path " + path;
+        return -1;
+    }
+    int dir_fd = open(parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) error = "open " + parent + ": " + std::strerror(errno);
+    return dir_fd;
+}
+
+bool create_subvolume(const std::string& path, std::string& error) {
+    btrfs_ioctl_vol_args args{};
+    std::string name;
+    int dir_fd = open_parent(path, sizeof(args.name) - 1, name, error);
+    if (dir_fd < 0) return false;
+
+    std::memcpy(args.name, name.c_str(), name.size());
+    int rc = ioctl(dir_fd, BTRFS_IOC_SUBVOL_CREATE, &args);
+    int saved_errno = errno;
+    close(dir_fd);
+    if (rc != 0) {
+        error = "create subvolume " + path + ": " + std::strerror(saved_errno);
+        return false;
+    }
+    return true;
+}
+
+bool snapshot_subvolume(const std::string& source, const std::string& path, bool read_only, std::string& error) {
+    int source_fd = open(source.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (source_fd < 0) {
+        error = "open " + source + ": " + std::strerror(errno);
+        return false;
+    }
+    btrfs_ioctl_vol_args_v2 args{};
+    std::string name;
+    int dir_fd = open_parent(path, sizeof(args.name) - 1, name, error);
+    if (dir_fd < 0) {
+        close(source_fd);
+        return false;
+    }
+
+    args.fd = source_fd;
+    args.flags = read_only ? BTRFS_SUBVOL_RDONLY : 0;
+    std::memcpy(args.name, name.c_str(), name.size());
+    int rc = ioctl(dir_fd, BTRFS_IOC_SNAP_CREATE_V2, &args);
+    int saved_errno = errno;
+    close(dir_fd);
+    close(source_fd);
+    if (rc != 0) {
+        error = "snapshot " + source + " to " + path + ": " + std::strerror(saved_errno);
+        return false;
+    }
+    return true;
+}
+
+bool delete_subvolume(const std::string& path, std::string& error) {
+    btrfs_ioctl_vol_args args{};
+    std::string name;
+    int dir_fd = open_parent(path, sizeof(args.name) - 1, name, error);
+    if (dir_fd < 0) return false;
+
+    std::memcpy(args.name, name.c_str(), name.size());
+    int rc = ioctl(dir_fd, BTRFS_IOC_SNAP_DESTROY, &args);
+    int saved_errno = errno;
+    close(dir_fd);
+    if (rc != 0) {
+        error = "delete subvolume " + path + ": " + std::strerror(saved_errno);
+        return false;
+    }
+    return true;
+}
+
+bool set_nocow(const std::string& path, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    int flags = 0;
+    int rc = ioctl(fd, FS_IOC_GETFLAGS, &flags);
+    if (rc == 0 && !(flags & FS_NOCOW_FL)) {
+        flags |= FS_NOCOW_FL;
+        rc = ioctl(fd, FS_IOC_SETFLAGS, &flags);
+    }
+    int saved_errno = errno;
+    close(fd);
+    if (rc != 0) {
+        error = "set nodatacow on " + path + ": " + std::strerror(saved_errno);
+        return false;
+    }
+    return true;
+}
+
+bool set_compression_property(const std::string& path, const std::string& algorithm, std::string& error) {
+    if (setxattr(path.c_str(), "btrfs.compression", algorithm.c_str(), algorithm.size(), 0) != 0) {
+        error = "set compression=" + algorithm + " on " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+// Creates a subvolume at path with BTRFS_IOC_SUBVOL_CREATE on its parent
+// directory, which must be on a mounted btrfs filesystem. On failure error
+// says which path and why.
+bool create_subvolume(const std::string& path, std::string& error);
+
+// Snapshots the subvolume at source to path with BTRFS_IOC_SNAP_CREATE_V2,
+// read-only if asked (btrfs send only takes read-only snapshots). Nested
+// subvolumes are not included; they show up as empty directories.
+bool snapshot_subvolume(const std::string& source, const std::string& path, bool read_only, std::string& error);
+
+// Deletes the subvolume at path with BTRFS_IOC_SNAP_DESTROY. Extents shared
+// with a snapshot of it stay with the snapshot.
+bool delete_subvolume(const std::string& path, std::string& error);
+
+// Sets FS_NOCOW_FL on path. On an empty directory (a fresh subvolume) the
+// flag is inherited by everything created below it later.
+bool set_nocow(const std::string& path, std::string& error);
+
+// Sets the btrfs.compression property ("zstd", "zlib", "lzo" or "none") on
+// path, the xattr behind `btrfs property set <path> compression`. New files
+// and directories inherit it; the level stays the filesystem's.
+bool set_compression_property(const std::string& path, const std::string& algorithm, std::string& error);
@@ -0,0 +1,128 @@
+#include "cache.h"
+#include "log.h"
+#include "process.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const char* CACHE_MOUNT_ROOT = "/run/cachyos-installer/caches";
+
+static bool has_packages(const std::string& dir) {
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec)) return false;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        if (entry.path().filename().string().find(".pkg.tar.") != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_cache(std::vector<PackageCache>& caches, const std::string& path,
+                      const std::string& origin, const std::string& mounted_at = "") {
+    std::error_code ec;
+    std::string canonical = fs::weakly_canonical(path, ec).string();
+    if (ec) canonical = path;
+    for (const PackageCache& cache : caches) {
+        if (cache.path == canonical) return;
+    }
+    caches.push_back({canonical, origin, mounted_at});
+    core_log("Using package cache " + canonical + " (" + origin + ")");
+}
+
+// Mount points of everything except the live root, pseudo filesystems and
+// the installation target.
+static std::vector<std::string> media_mount_points() {
+    std::vector<std::string> mounts;
+    std::ifstream proc_mounts("/proc/mounts");
+    std::string line;
+    while (std::getline(proc_mounts, line)) {
+        std::istringstream fields(line);
+        std::string device, mount_point;
+        fields >> device >> mount_point;
+        if (device.rfind("/dev/", 0) != 0) continue;
+        if (mount_point == "/" || mount_point == "/mnt" || mount_point.rfind("/mnt/", 0) == 0) continue;
+        if (mount_point.rfind(CACHE_MOUNT_ROOT, 0) == 0) continue;
+        mounts.push_back(mount_point);
+    }
+    return mounts;
+}
+
+std::vector<PackageCache> find_package_caches(const std::vector<std::string>& target_disks,
+                                              const std::vector<std::string>& configured_dirs) {
+    std::vector<PackageCache> caches;
+
+    for (const std::string& dir : configured_dirs) {
+        if (has_packages(dir)) add_cache(caches, dir, "installer.conf");
+    }
+
+    if (has_packages(HOST_PACKAGE_CACHE)) add_cache(caches, HOST_PACKAGE_CACHE, "host");
+
+    for (const std::string& mount_point : media_mount_points()) {
+        for (const char* sub : {"/var/cache/pacman/pkg", "/pacman-cache"}) {
+            if (has_packages(mount_point + sub)) add_cache(caches, mount_point + sub, "media " + mount_point);
+        }
+    }
+
+    // @cache subvolumes left by earlier runs on other disks (a provisioning
+    // stick, a second drive). The targets' own @cache is about to be wiped.
+    std::vector<std::string> target_names;
+    for (const std::string& disk : target_disks) target_names.push_back(fs::path(disk).filename().string());
+    auto is_target = [&target_names](const std::string& name) {
+        return std::find(target_names.begin(), target_names.end(), name) != target_names.end();
+    };
+    std::istringstream devices(capture_process({"blkid", "-t", "TYPE=btrfs", "-o", "device"}));
+    std::string device;
+    int index = 0;
+    while (std::getline(devices, device)) {
+        if (device.empty()) continue;
+        std::string parent = capture_process({"lsblk", "-no", "PKNAME", device});
+        if (is_target(parent) || is_target(fs::path(device).filename().string())) continue;
+
+        std::string mount_point = std::string(CACHE_MOUNT_ROOT) + "/" + std::to_string(index++);
+        if (run_quietly({"mkdir", "-p", mount_point}) != 0 ||
+            run_quietly({"mount", "-o", "ro,subvol=@cache", device, mount_point}) != 0) {
+            continue;
+        }
+        if (has_packages(mount_point + "/pacman/pkg")) {
+            add_cache(caches, mount_point + "/pacman/pkg", "@cache on " + device, mount_point);
+        } else {
+            run_quietly({"umount", mount_point});
+        }
+    }
+
+    return caches;
+}
+
+void release_package_caches(const std::vector<PackageCache>& caches) {
+    for (const PackageCache& cache : caches) {
+        if (!cache.mounted_at.empty()) {
+            run_quietly({"umount", cache.mounted_at});
+        }
+    }
+}
+
+std::vector<std::string> cachedir_args(const std::vector<std::string>& dirs) {
+    std::vector<std::string> args;
+    for (const std::string& dir : dirs) {
+        args.push_back("--cachedir");
+        args.push_back(dir);
+    }
+    return args;
+}
+
+void seed_sync_databases(const std::string& from_sync_dir, const std::string& to_sync_dir) {
+    std::error_code ec;
+    if (!fs::is_directory(from_sync_dir, ec)) return;
+    std::vector<std::string> cmd = {"cp", "-p"};
+    for (const auto& entry : fs::directory_iterator(from_sync_dir, ec)) {
+        if (entry.path().extension() == ".db") cmd.push_back(entry.path().string());
+    }
+    if (cmd.size() == 2) return;
+    cmd.push_back(to_sync_dir + "/");
+    if (run_quietly({"mkdir", "-p", to_sync_dir}) == 0) run_quietly(cmd);
+}
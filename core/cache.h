@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+inline constexpr const char* HOST_PACKAGE_CACHE = "/var/cache/pacman/pkg";
+inline constexpr const char* HOST_SYNC_DIR = "/var/lib/pacman/sync";
+
+// A directory of already-downloaded packages that pacman can be pointed at
+// with --cachedir. Packages found there are still signature-checked.
+struct PackageCache {
+    std::string path;
+    std::string origin;       // "host", "media /run/media/...", "@cache on /dev/sdb2", ...
+    std::string mounted_at;   // set when the installer mounted it and must release it
+};
+
+// Looks for usable caches: the live system's pacman cache, caches on mounted
+// removable media, the @cache subvolume of earlier installs on disks other
+// than the targets, and directories listed in installer.conf (CACHE_DIRS).
+// Directories without any package files are skipped.
+std::vector<PackageCache> find_package_caches(const std::vector<std::string>& target_disks,
+                                              const std::vector<std::string>& configured_dirs);
+
+// Unmounts the @cache subvolumes find_package_caches() mounted.
+void release_package_caches(const std::vector<PackageCache>& caches);
+
+// "--cachedir <dir>" for each directory, ready to append to a pacman argv.
+std::vector<std::string> cachedir_args(const std::vector<std::string>& dirs);
+
+// Copies the synced repo databases (a few MB) into a new pacman dbpath with
+// their timestamps, so the next -Sy only downloads databases that changed.
+void seed_sync_databases(const std::string& from_sync_dir, const std::string& to_sync_dir);
@@ -0,0 +1,248 @@
+#include "chroot.h"
+#include "packages.h"
+#include "process.h"
+#include "trace.h"
+
+static std::string bootloader_section(const InstallConfig& config, const std::string& root_uuid) {
+    std::string kernel = kernel_package(config.kernel_type);
+    std::string options = "root=UUID=" + root_uuid + " rootflags=subvol=" + root_subvolume(config.subvolumes)->name + " rw";
+    // Without a firmware entry, only the fallback path (EFI/BOOT/BOOTX64.EFI) finds them
+    bool entry = config.firmware_entry;
+    if (config.bootloader == "GRUB") {
+        return std::string("    grub-install --target=x86_64-efi --efi-directory=/boot/efi --bootloader-id=CachyOS") +
+               (entry ? "" : " --no-nvram --removable") + "\n";
+    }
+    if (config.bootloader == "systemd-boot") {
+        return std::string("    bootctl --path=/boot/efi install") + (entry ? "" : " --no-variables") + R"(
+    mkdir -p /boot/efi/loader/entries
+    cat > /boot/efi/loader/loader.conf << 'LOADER'
+default arch
+timeout 3
+editor  yes
+LOADER
+    cat > /boot/efi/loader/entries/arch.conf << 'ENTRY'
+title   CachyOS Linux
+linux   /vmlinuz-)" + kernel + R"(
+initrd  /initramfs-)" + kernel + R"(.img
+options )" + options + R"(
+ENTRY
+)";
+    }
+    if (config.bootloader == "rEFInd") {
+        std::string dir = entry ? "/EFI/refind" : "/EFI/BOOT";
+        return std::string(entry ? "    refind-install" : "    refind-install --usedefault \"$(findmnt -no SOURCE /boot/efi)\"") +
+               "\n    mkdir -p /boot/efi" + dir + "\n    cat > /boot/efi" + dir + R"(/refind.conf << 'REFIND'
+menuentry "CachyOS Linux" {
+    icon     )" + dir + R"(/icons/os_arch.png
+    loader   /vmlinuz-)" + kernel + R"(
+    initrd   /initramfs-)" + kernel + R"(.img
+    options  ")" + options + R"("
+}
+REFIND
+)";
+    }
+    return "    :\n";
+}
+
+// Menus generated from what is in /boot, so only once the images exist
+static std::string boot_menu_section(const InstallConfig& config) {
+    if (config.bootloader == "GRUB") return "    grub-mkconfig -o /boot/grub/grub.cfg\n";
+    return "    :\n";
+}
+
+static std::string hyprland_config(const std::string& user) {
+    std::string home = "/home/" + shell_quote(user);
+    return "    mkdir -p " + home + "/.config/hypr\n"
+           "    cat > " + home + R"(/.config/hypr/hyprland.conf << 'HYPRCONFIG'
+exec-once = waybar &
+exec-once = swaybg -i ~/wallpaper.jpg &
+monitor=,preferred,auto,1
+input {
+    kb_layout = us
+    follow_mouse = 1
+    touchpad { natural_scroll = yes }
+}
+general {
+    gaps_in = 5
+    gaps_out = 10
+    border_size = 2
+    col.active_border = rgba(33ccffee) rgba(00ff99ee) 45deg
+    col.inactive_border = rgba(595959aa)
+}
+decoration {
+    rounding = 5
+    blur = yes
+    blur_size = 3
+    blur_passes = 1
+}
+animations {
+    enabled = yes
+    bezier = myBezier, 0.05, 0.9, 0.1, 1.05
+    animation = windows, 1, 7, myBezier
+    animation = windowsOut, 1, 7, default, popin 80%
+    animation = border, 1, 10, default
+    animation = fade, 1, 7, default
+    animation = workspaces, 1, 6, default
+}
+bind = SUPER, Return, exec, kitty
+bind = SUPER, Q, killactive
+bind = SUPER, M, exit
+bind = SUPER, V, togglefloating
+bind = SUPER, F, fullscreen
+bind = SUPER, D, exec, rofi -show drun
+bind = SUPER, P, pseudo
+bind = SUPER, J, togglesplit
+HYPRCONFIG
+    chown -R )" + shell_quote(user + ":" + user) + " " + home + "/.config\n";
+}
+
+static std::string desktop_section(const InstallConfig& config) {
+    if (config.desktop_env == "None") {
+        return "    systemctl enable NetworkManager\n"
+               "    systemctl start NetworkManager\n";
+    }
+    // Packages were installed by pacstrap
+    std::string section = "    systemctl enable " + desktop_packages(config.desktop_env).display_manager + "\n"
+                          "    systemctl enable NetworkManager\n"
+                          "    systemctl start NetworkManager\n";
+    if (config.desktop_env == "KDE Plasma") {
+        section += "    echo 'blacklist ntfs3' | tee /etc/modprobe.d/disable-ntfs3.conf\n"
+                   "    plymouth-set-default-theme cachyos-bootanimation\n";
+    } else if (config.desktop_env == "Hyprland") {
+        section += hyprland_config(config.user_name);
+    }
+    return section;
+}
+
+std::vector<std::string> regeneration_hooks() {
+    return {"90-mkinitcpio-install.hook", "90-dracut-install.hook", "90-booster-install.hook"};
+}
+
+// The body of build_initramfs, called with one kernel's /usr/lib/modules
+// directory: what the generator's install hook would have done for it
+static std::string initramfs_section(const std::string& initramfs) {
+    if (initramfs == "mkinitcpio" || initramfs == "mkinitcpio-pico") {
+        // The hook's own script: /boot/vmlinuz, the preset, then its images
+        return "    echo \"${1#/}/vmlinuz\" | /usr/share/libalpm/scripts/mkinitcpio install\n";
+    }
+    std::string generate;
+    if (initramfs == "dracut") generate = "dracut --force --kver \"$kver\" \"/boot/initramfs-$pkgbase.img\"";
+    if (initramfs == "booster") generate = "booster build --force --kernel-version \"$kver\" \"/boot/initramfs-$pkgbase.img\"";
+    if (generate.empty()) return "    :\n";
+    return R"(    local pkgbase kver=${1##*/}
+    pkgbase=$(<"$1/pkgbase")
+    install -Dm644 "$1/vmlinuz" "/boot/vmlinuz-$pkgbase"
+    )" + generate + "\n";
+}
+
+static std::string unmask_hooks_section() {
+    std::string section;
+    for (const std::string& hook : regeneration_hooks()) {
+        std::string path = std::string(PACMAN_HOOK_DIR) + "/" + hook;
+        section += "    [ \"$(readlink " + path + ")\" = /dev/null ] && rm " + path + "\n";
+    }
+    return section + "    :\n";
+}
+
+std::string chroot_script(const InstallConfig& config, const std::string& root_uuid) {
+    std::string desktop_step = config.desktop_env == "None" ? "Network" : "Desktop " + config.desktop_env;
+    return "#!/bin/bash\n" + script_trace_functions() + R"(
+system_config() {
+    ln -sf /usr/share/zoneinfo/)" + shell_quote(config.timezone) + R"( /etc/localtime
+    hwclock --systohc
+    echo )" + shell_quote(config.locale_lang) + R"( >> /etc/locale.gen
+    locale-gen
+}
+
+sudoers() {
+    echo "%wheel ALL=(ALL) ALL" > /etc/sudoers.d/wheel
+}
+
+bootloader() {
+)" + bootloader_section(config, root_uuid) + R"(}
+
+desktop() {
+)" + desktop_section(config) + R"(}
+
+build_initramfs() {
+)" + initramfs_section(config.initramfs) + R"(}
+
+# Every installed kernel at once
+initramfs() {
+    local modules status=0 kernels=()
+    for modules in /usr/lib/modules/*; do
+        [ -f "$modules/pkgbase" ] || continue
+        build_initramfs "$modules" &
+        kernels+=($!)
+    done
+    for job in "${kernels[@]}"; do
+        wait "$job" || status=1
+    done
+    return $status
+}
+
+boot_menu() {
+)" + boot_menu_section(config) + R"(}
+
+# Masked while pacstrap ran, so kernel updates rebuild the images again
+unmask_hooks() {
+)" + unmask_hooks_section() + R"(}
+
+# Independent sections side by side. The images are built once, after the
+# desktop section has set the boot theme, and the boot menu after them.
+status=0
+jobs=()
+run_step "System config" system_config &
+jobs+=($!)
+run_step "Sudoers" sudoers &
+jobs+=($!)
+run_step )" + shell_quote("Bootloader " + config.bootloader) + R"( bootloader &
+jobs+=($!)
+run_step )" + shell_quote(desktop_step) + R"( desktop &
+jobs+=($!)
+for job in "${jobs[@]}"; do
+    wait "$job" || status=1
+done
+# A menu without its images would not boot, so it waits for a working build
+if run_step )" + shell_quote("Initramfs " + config.initramfs) + R"( initramfs; then
+    run_step "Boot menu" boot_menu || status=1
+else
+    status=1
+fi
+run_step "Pacman hooks" unmask_hooks || status=1
+
+# Clean up
+rm )" + CHROOT_SCRIPT + R"(
+exit $status
+)";
+}
+
+std::string image_chroot_script(const InstallConfig& config, const std::string& root_uuid) {
+    return "#!/bin/bash\n" + script_trace_functions() + R"(
+machine_id() {
+    rm -f /etc/machine-id
+    systemd-machine-id-setup
+}
+
+timezone() {
+    ln -sf /usr/share/zoneinfo/)" + shell_quote(config.timezone) + R"( /etc/localtime
+}
+
+bootloader() {
+)" + bootloader_section(config, root_uuid) + boot_menu_section(config) + R"(}
+
+run_step "Machine ID" machine_id &
+jobs=($!)
+run_step "Timezone" timezone &
+jobs+=($!)
+run_step )" + shell_quote("Bootloader " + config.bootloader) + R"( bootloader
+status=$?
+for job in "${jobs[@]}"; do
+    wait "$job" || status=1
+done
+
+# Clean up
+rm )" + CHROOT_SCRIPT + R"(
+exit $status
+)";
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+// Where the script is written inside the target, and run with arch-chroot
+inline constexpr const char* CHROOT_SCRIPT = "/setup-chroot.sh";
+
+inline constexpr const char* PACMAN_HOOK_DIR = "/etc/pacman.d/hooks";
+
+// The pacman hooks that build the initramfs whenever a kernel, generator or
+// firmware package is installed. The installer masks them in the target
+// (a /dev/null symlink in PACMAN_HOOK_DIR) while pacstrap runs, so the
+// images are built once, by the chroot script, which unmasks them again.
+std::vector<std::string> regeneration_hooks();
+
+// The configuration run inside the target after pacstrap: timezone and
+// locale-gen, sudoers, bootloader, desktop services, then the initramfs
+// and the boot menu. Each section is a bash function traced with run_step.
+// The sections before the initramfs touch different files and run as
+// parallel jobs; the initramfs is built once they are done, since the
+// desktop section can change what goes into it (the plymouth theme), one
+// job per installed kernel. The GRUB menu lists the images, so it comes
+// last, and not at all if an image failed. The script fails if any
+// section did. root_uuid is the Btrfs filesystem the bootloader entries
+// point at.
+std::string chroot_script(const InstallConfig& config, const std::string& root_uuid);
+
+// The per-host part run after a golden image was received: a new
+// machine-id, this host's timezone and the bootloader installed to this
+// disk's ESP with entries for root_uuid. Everything else came with the
+// image.
+std::string image_chroot_script(const InstallConfig& config, const std::string& root_uuid);
@@ -0,0 +1,246 @@
+#include "compression.h"
+#include "disk.h"
+#include "log.h"
+#include "process.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <zstd.h>
+
+namespace fs = std::filesystem;
+
+static const size_t BTRFS_CHUNK = 128 * 1024;
+static const size_t BTRFS_SECTOR = 4096;
+static const uint64_t PER_PACKAGE_BYTES = 4 * 1024 * 1024;
+static const uint64_t SAMPLE_BYTES = 32 * 1024 * 1024;
+static const uint64_t DISK_PROBE_BYTES = 256 * 1024 * 1024;
+static const int64_t LEVEL_BUDGET_NS = 400 * 1000000LL;
+static const int CANDIDATE_LEVELS[] = {1, 2, 3, 4, 5, 6, 7, 9, 11, 13, 15};
+
+// Appends up to `limit` bytes of the decompressed payload of a .pkg.tar.zst
+static uint64_t append_package_payload(const fs::path& package, std::vector<char>& sample,
+                                       uint64_t limit, double& decompress_seconds) {
+    std::ifstream file(package, std::ios::binary);
+    if (!file.is_open()) return 0;
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    std::vector<char> in(ZSTD_DStreamInSize());
+    std::vector<char> out(ZSTD_DStreamOutSize());
+    uint64_t added = 0;
+    int64_t started = monotonic_ns();
+    while (added < limit && file) {
+        file.read(in.data(), in.size());
+        ZSTD_inBuffer input = {in.data(), static_cast<size_t>(file.gcount()), 0};
+        while (input.pos < input.size && added < limit) {
+            ZSTD_outBuffer output = {out.data(), out.size(), 0};
+            size_t rc = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(rc)) {
+                input.pos = input.size;
+                file.setstate(std::ios::failbit);
+                break;
+            }
+            size_t take = std::min<uint64_t>(output.pos, limit - added);
+            sample.insert(sample.end(), out.data(), out.data() + take);
+            added += take;
+        }
+    }
+    decompress_seconds += (monotonic_ns() - started) / 1e9;
+    ZSTD_freeDCtx(dctx);
+    return added;
+}
+
+std::vector<char> collect_compression_sample(const std::vector<std::string>& cache_dirs,
+                                             uint64_t max_bytes, std::string& source) {
+    std::vector<char> sample;
+    sample.reserve(max_bytes);
+    double seconds = 0;
+    int packages = 0;
+    for (const std::string& dir : cache_dirs) {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir, ec)) {
+            if (sample.size() >= max_bytes) break;
+            std::string name = entry.path().filename().string();
+            if (name.size() < 12 || name.compare(name.size() - 12, 12, ".pkg.tar.zst") != 0) continue;
+            if (append_package_payload(entry.path(), sample, std::min(PER_PACKAGE_BYTES, max_bytes - sample.size()), seconds) > 0) {
+                ++packages;
+            }
+        }
+    }
+    if (!sample.empty()) {
+        source = std::to_string(packages) + " cached packages";
+        return sample;
+    }
+
+    // Nothing cached yet: shared libraries are a fair stand-in for /usr
+    for (const char* dir : {"/usr/lib", "/usr/bin"}) {
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(dir, ec)) {
+            if (sample.size() >= max_bytes) break;
+            if (!entry.is_regular_file(ec)) continue;
+            std::ifstream file(entry.path(), std::ios::binary);
+            std::vector<char> buffer(std::min<uint64_t>(PER_PACKAGE_BYTES, max_bytes - sample.size()));
+            file.read(buffer.data(), buffer.size());
+            sample.insert(sample.end(), buffer.data(), buffer.data() + file.gcount());
+        }
+    }
+    source = "live system /usr";
+    return sample;
+}
+
+// Compresses chunks in a strided order, so whatever prefix fits in the time
+// budget is spread over the whole sample. Slow levels see fewer chunks.
+static void compress_sample(const std::vector<char>& sample, int level, unsigned threads, LevelMeasurement& m) {
+    const size_t chunks = (sample.size() + BTRFS_CHUNK - 1) / BTRFS_CHUNK;
+    const size_t stride = 97;   // prime, so i * stride % chunks visits every chunk
+    const size_t min_chunks = std::min<size_t>(chunks, 4 * threads);
+    const int64_t deadline = monotonic_ns() + LEVEL_BUDGET_NS;
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> raw{0}, stored{0};
+    auto worker = [&]() {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        std::vector<char> out(ZSTD_compressBound(BTRFS_CHUNK));
+        uint64_t local_raw = 0, local_stored = 0;
+        for (size_t i = next++; i < chunks; i = next++) {
+            size_t offset = (chunks % stride ? i * stride % chunks : i) * BTRFS_CHUNK;
+            size_t length = std::min(BTRFS_CHUNK, sample.size() - offset);
+            size_t size = ZSTD_compressCCtx(cctx, out.data(), out.size(), sample.data() + offset, length, level);
+            size_t sectors = (length + BTRFS_SECTOR - 1) / BTRFS_SECTOR * BTRFS_SECTOR;
+            size_t rounded = ZSTD_isError(size) ? sectors : (size + BTRFS_SECTOR - 1) / BTRFS_SECTOR * BTRFS_SECTOR;
+            local_raw += length;
+            local_stored += std::min(rounded, sectors);
+            if (i >= min_chunks && monotonic_ns() > deadline) break;
+        }
+        raw += local_raw;
+        stored += local_stored;
+        ZSTD_freeCCtx(cctx);
+    };
+
+    int64_t started = monotonic_ns();
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; ++i) pool.emplace_back(worker);
+    for (std::thread& t : pool) t.join();
+    double seconds = (monotonic_ns() - started) / 1e9;
+    m.level = level;
+    m.ratio = stored ? static_cast<double>(raw) / stored : 1.0;
+    m.compress_bytes_per_s = seconds > 0 ? raw / seconds : 0;
+}
+
+// pacman extracts packages on one thread; measure how fast zstd can feed it
+static double measure_extract_rate(const std::vector<char>& sample) {
+    size_t length = std::min<size_t>(sample.size(), 16 * 1024 * 1024);
+    ZSTD_CCtx* cctx = ZSTD_createCCtx();
+    std::vector<char> packed(ZSTD_compressBound(length));
+    size_t packed_size = ZSTD_compressCCtx(cctx, packed.data(), packed.size(), sample.data(), length, 3);
+    ZSTD_freeCCtx(cctx);
+    if (ZSTD_isError(packed_size)) return 0;
+
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    std::vector<char> out(ZSTD_DStreamOutSize());
+    ZSTD_inBuffer input = {packed.data(), packed_size, 0};
+    int64_t started = monotonic_ns();
+    while (input.pos < input.size) {
+        ZSTD_outBuffer output = {out.data(), out.size(), 0};
+        if (ZSTD_isError(ZSTD_decompressStream(dctx, &output, &input))) break;
+    }
+    double seconds = (monotonic_ns() - started) / 1e9;
+    ZSTD_freeDCtx(dctx);
+    return seconds > 0 ? length / seconds : 0;
+}
+
+CompressionTuning tune_compression(const std::vector<char>& sample, const std::string& sample_source,
+                                   double disk_bytes_per_s) {
+    CompressionTuning tuning;
+    tuning.sample_bytes = sample.size();
+    tuning.sample_source = sample_source;
+    tuning.threads = std::max(1u, std::thread::hardware_concurrency());
+    tuning.disk_bytes_per_s = disk_bytes_per_s;
+    if (sample.empty()) return tuning;
+    tuning.extract_bytes_per_s = measure_extract_rate(sample);
+
+    for (int level : CANDIDATE_LEVELS) {
+        LevelMeasurement m;
+        compress_sample(sample, level, tuning.threads, m);
+
+        m.install_bytes_per_s = m.compress_bytes_per_s;
+        m.bottleneck = "cpu";
+        if (disk_bytes_per_s > 0 && disk_bytes_per_s * m.ratio < m.install_bytes_per_s) {
+            m.install_bytes_per_s = disk_bytes_per_s * m.ratio;
+            m.bottleneck = "disk";
+        }
+        if (tuning.extract_bytes_per_s > 0 && tuning.extract_bytes_per_s < m.install_bytes_per_s) {
+            m.install_bytes_per_s = tuning.extract_bytes_per_s;
+            m.bottleneck = "pacman";
+        }
+        tuning.levels.push_back(m);
+    }
+
+    double fastest = 0;
+    for (const LevelMeasurement& m : tuning.levels) fastest = std::max(fastest, m.install_bytes_per_s);
+    double best_ratio = 0;
+    for (const LevelMeasurement& m : tuning.levels) {
+        if (m.install_bytes_per_s >= 0.9 * fastest && m.ratio > best_ratio) {
+            best_ratio = m.ratio;
+            tuning.recommended_level = m.level;
+        }
+    }
+    return tuning;
+}
+
+std::vector<std::string> describe_tuning(const CompressionTuning& tuning) {
+    std::vector<std::string> lines;
+    char line[160];
+    snprintf(line, sizeof(line), "Compression sample: %.0f MiB from %s, %u threads, disk %.0f MB/s, pacman extract %.0f MB/s",
+             tuning.sample_bytes / 1048576.0, tuning.sample_source.c_str(), tuning.threads,
+             tuning.disk_bytes_per_s / 1e6, tuning.extract_bytes_per_s / 1e6);
+    lines.push_back(line);
+    for (const LevelMeasurement& m : tuning.levels) {
+        snprintf(line, sizeof(line), "  zstd:%-2d ratio %.2f  compress %6.0f MB/s  install %6.0f MB/s (%s bound)%s",
+                 m.level, m.ratio, m.compress_bytes_per_s / 1e6, m.install_bytes_per_s / 1e6, m.bottleneck,
+                 m.level == tuning.recommended_level ? "  <- recommended" : "");
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+int select_compression_level(int requested, bool compare, const std::string& partition,
+                             const std::vector<std::string>& cache_dirs) {
+    if (requested > BTRFS_ZSTD_MAX_LEVEL) {
+        core_log("btrfs caps zstd at level " + std::to_string(BTRFS_ZSTD_MAX_LEVEL) + ", using " +
+                 std::to_string(BTRFS_ZSTD_MAX_LEVEL) + " instead of " + std::to_string(requested));
+        requested = BTRFS_ZSTD_MAX_LEVEL;
+    }
+    if (requested > 0 && !compare) return requested;
+
+    core_log("Measuring compression levels");
+    std::string error;
+    double disk = measure_write_speed(partition, DISK_PROBE_BYTES, error);
+    if (disk <= 0) core_log("Could not measure the write speed of " + partition + ": " + error);
+    std::string source;
+    std::vector<char> sample = collect_compression_sample(cache_dirs, SAMPLE_BYTES, source);
+    CompressionTuning tuning = tune_compression(sample, source, disk);
+    for (const std::string& line : describe_tuning(tuning)) core_log(line);
+    if (tuning.levels.empty()) return requested ? requested : 3;
+
+    if (requested == 0) {
+        core_log("Using zstd:" + std::to_string(tuning.recommended_level));
+        return tuning.recommended_level;
+    }
+
+    const LevelMeasurement* chosen = nullptr;
+    const LevelMeasurement* recommended = nullptr;
+    for (const LevelMeasurement& m : tuning.levels) {
+        if (m.level <= requested) chosen = &m;
+        if (m.level == tuning.recommended_level) recommended = &m;
+    }
+    if (chosen && recommended && chosen->install_bytes_per_s < 0.75 * recommended->install_bytes_per_s) {
+        char line[200];
+        snprintf(line, sizeof(line), "zstd:%d installs about %.1fx slower than zstd:%d to save another %.1f%% of the uncompressed size",
+                 requested, recommended->install_bytes_per_s / chosen->install_bytes_per_s, recommended->level,
+                 (1.0 / recommended->ratio - 1.0 / chosen->ratio) * 100);
+        core_log(line);
+    }
+    return requested;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// btrfs clamps zstd levels above 15 to 15
+inline constexpr int BTRFS_ZSTD_MAX_LEVEL = 15;
+
+struct LevelMeasurement {
+    int level = 0;
+    double ratio = 1.0;             // uncompressed / stored bytes, btrfs-style
+    double compress_bytes_per_s = 0;  // all cores together, uncompressed bytes
+    double install_bytes_per_s = 0;   // what the install can sustain at this level
+    const char* bottleneck = "";      // "cpu", "disk" or "pacman"
+};
+
+struct CompressionTuning {
+    uint64_t sample_bytes = 0;
+    std::string sample_source;
+    unsigned threads = 0;
+    double disk_bytes_per_s = 0;
+    double extract_bytes_per_s = 0;   // single-threaded package decompression
+    std::vector<LevelMeasurement> levels;
+    int recommended_level = 3;
+};
+
+// Uncompressed package payloads from the caches (decompressed with libzstd,
+// since the .pkg.tar.zst files themselves would not compress any further),
+// or the live system's libraries when no packages are cached yet.
+std::vector<char> collect_compression_sample(const std::vector<std::string>& cache_dirs,
+                                             uint64_t max_bytes, std::string& source);
+
+// Compresses the sample the way btrfs does (128KiB chunks, stored size
+// rounded up to 4KiB, kept raw when it does not shrink) at each candidate
+// level on all cores, and models install throughput as the slowest of CPU
+// compression, disk writes (in uncompressed bytes) and pacman extraction.
+// The recommended level is the one saving the most space while staying
+// within 10% of the fastest level's throughput.
+CompressionTuning tune_compression(const std::vector<char>& sample, const std::string& sample_source,
+                                   double disk_bytes_per_s);
+
+// One line per level, for the log.
+std::vector<std::string> describe_tuning(const CompressionTuning& tuning);
+
+// Returns the level to mount with. requested == 0 means auto-select: the
+// partition's write speed and the sample are measured and the table is
+// logged. A fixed level is kept (clamped to what btrfs supports) without
+// measuring anything, unless compare is set; then the log also says how
+// much slower it is than the recommendation.
+int select_compression_level(int requested, bool compare, const std::string& partition,
+                             const std::vector<std::string>& cache_dirs);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "subvolumes.h"
+
+// Everything the installer needs to know about the target system. The CLI
+// fills this from installer.conf and dialog prompts, the Qt app from its form.
+struct InstallConfig {
+    std::string target_disk;
+    std::string hostname;
+    std::string timezone;
+    std::string keymap;
+    std::string user_name;
+    std::string user_password;
+    std::string root_password;
+    std::string desktop_env;
+    std::string kernel_type;
+    std::string initramfs;
+    std::string bootloader;
+    std::string boot_fs_type = "fat32";
+    std::string locale_lang = "en_GB.UTF-8";
+    std::vector<std::string> repos;
+    std::vector<std::string> custom_packages;
+    std::string cpu_level = "auto";
+    int compression_level = 3;  // 0: measure and pick a level
+    bool compare_compression = false;   // with a fixed level: still measure and log how it compares
+    int esp_size_mib = 512;
+    int swap_size_mib = 0;      // 0: no swap partition
+    bool fast_install = false;  // zstd:1 during install, recompress on first boot
+    std::vector<SubvolumeSpec> subvolumes = default_subvolume_layout();
+    std::string wipe_mode = "discard";
+    bool install_gaming = false;
+    std::string image;          // install from this golden image (see image.h) instead of pacstrap
+    std::string image_build;    // after installing, export the install as a golden image here
+    std::string offline_repo;   // install from this local repository (see offline.h), no network
+    bool firmware_entry = true; // false: the bootloader leaves the machine's EFI boot entries alone
+};
@@ -0,0 +1,164 @@
+#include "cpu.h"
+#include "log.h"
+
+#include <cpuid.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+static const std::vector<std::string> V2_FLAGS = {"cx16", "lahf_lm", "popcnt", "pni", "sse4_1", "sse4_2", "ssse3"};
+static const std::vector<std::string> V3_FLAGS = {"avx", "avx2", "bmi1", "bmi2", "f16c", "fma", "abm", "movbe", "xsave"};
+static const std::vector<std::string> V4_FLAGS = {"avx512f", "avx512bw", "avx512cd", "avx512dq", "avx512vl"};
+
+static bool has_all(const std::set<std::string>& flags, const std::vector<std::string>& wanted) {
+    for (const std::string& flag : wanted) {
+        if (!flags.count(flag)) return false;
+    }
+    return true;
+}
+
+static unsigned long long read_xcr0() {
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+}
+
+static std::set<std::string> cpuid_flags(CpuInfo& info) {
+    std::set<std::string> flags;
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx)) return flags;
+    unsigned int max_leaf = eax;
+    char vendor[13] = {};
+    std::memcpy(vendor, &ebx, 4);
+    std::memcpy(vendor + 4, &edx, 4);
+    std::memcpy(vendor + 8, &ecx, 4);
+    info.vendor = vendor;
+
+    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    int base_family = (eax >> 8) & 0xf;
+    int base_model = (eax >> 4) & 0xf;
+    info.family = base_family == 0xf ? base_family + ((eax >> 20) & 0xff) : base_family;
+    info.model = (base_family == 0x6 || base_family == 0xf) ? base_model | (((eax >> 16) & 0xf) << 4) : base_model;
+
+    auto bit = [&flags](unsigned int reg, int n, const char* name) {
+        if (reg & (1u << n)) flags.insert(name);
+    };
+    bit(ecx, 0, "pni");
+    bit(ecx, 9, "ssse3");
+    bit(ecx, 12, "fma");
+    bit(ecx, 13, "cx16");
+    bit(ecx, 19, "sse4_1");
+    bit(ecx, 20, "sse4_2");
+    bit(ecx, 22, "movbe");
+    bit(ecx, 23, "popcnt");
+    bit(ecx, 26, "xsave");
+    bit(ecx, 28, "avx");
+    bit(ecx, 29, "f16c");
+
+    // AVX and AVX-512 are only usable if the OS saves their register state
+    bool osxsave = ecx & (1u << 27);
+    unsigned long long xcr0 = osxsave ? read_xcr0() : 0;
+    bool os_avx = (xcr0 & 0x6) == 0x6;
+    bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+    if (!os_avx) {
+        flags.erase("avx");
+        flags.erase("fma");
+        flags.erase("f16c");
+    }
+
+    if (max_leaf >= 7) {
+        __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+        bit(ebx, 3, "bmi1");
+        bit(ebx, 8, "bmi2");
+        if (os_avx) bit(ebx, 5, "avx2");
+        if (os_avx512) {
+            bit(ebx, 16, "avx512f");
+            bit(ebx, 17, "avx512dq");
+            bit(ebx, 28, "avx512cd");
+            bit(ebx, 30, "avx512bw");
+            bit(ebx, 31, "avx512vl");
+        }
+    }
+
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000001) {
+        __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+        bit(ecx, 0, "lahf_lm");
+        bit(ecx, 5, "abm");
+    }
+    return flags;
+}
+
+static std::set<std::string> proc_cpuinfo_flags() {
+    std::set<std::string> flags;
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("flags", 0) != 0) continue;
+        std::istringstream words(line.substr(line.find(':') + 1));
+        std::string flag;
+        while (words >> flag) flags.insert(flag);
+        break;
+    }
+    return flags;
+}
+
+CpuInfo read_cpu_info() {
+    CpuInfo info;
+    std::set<std::string> from_cpuid = cpuid_flags(info);
+    std::set<std::string> from_kernel = proc_cpuinfo_flags();
+    if (from_kernel.empty()) {
+        info.flags = from_cpuid;
+    } else {
+        for (const std::string& flag : from_cpuid) {
+            if (from_kernel.count(flag)) info.flags.insert(flag);
+        }
+    }
+    return info;
+}
+
+CpuLevel detect_cpu_level(const CpuInfo& info) {
+    if (!has_all(info.flags, V2_FLAGS)) return CpuLevel::Generic;
+    if (!has_all(info.flags, V3_FLAGS)) return CpuLevel::V2;
+    if (!has_all(info.flags, V4_FLAGS)) return CpuLevel::V3;
+    // Zen 4 and Zen 5 get their own -march=znver4 builds
+    if (info.vendor == "AuthenticAMD" && info.family >= 0x19) return CpuLevel::Znver4;
+    return CpuLevel::V4;
+}
+
+std::string cpu_level_name(CpuLevel level) {
+    switch (level) {
+        case CpuLevel::V2: return "x86-64-v2";
+        case CpuLevel::V3: return "x86-64-v3";
+        case CpuLevel::V4: return "x86-64-v4";
+        case CpuLevel::Znver4: return "znver4";
+        default: return "x86-64";
+    }
+}
+
+bool parse_cpu_level(const std::string& name, CpuLevel& level) {
+    if (name == "x86-64" || name == "generic") level = CpuLevel::Generic;
+    else if (name == "x86-64-v2" || name == "v2") level = CpuLevel::V2;
+    else if (name == "x86-64-v3" || name == "v3") level = CpuLevel::V3;
+    else if (name == "x86-64-v4" || name == "v4") level = CpuLevel::V4;
+    else if (name == "znver4") level = CpuLevel::Znver4;
+    else return false;
+    return true;
+}
+
+CpuLevel resolve_cpu_level(const std::string& setting) {
+    CpuLevel level = CpuLevel::Generic;
+    if (!setting.empty() && setting != "auto") {
+        if (parse_cpu_level(setting, level)) {
+            core_log("Using CPU level " + cpu_level_name(level) + " from configuration");
+            return level;
+        }
+        core_log("Unknown CPU_LEVEL '" + setting + "', detecting instead");
+    }
+
+    CpuInfo info = read_cpu_info();
+    level = detect_cpu_level(info);
+    core_log("Detected " + info.vendor + " family " + std::to_string(info.family) + " model " +
+             std::to_string(info.model) + ", using " + cpu_level_name(level) + " packages");
+    return level;
+}
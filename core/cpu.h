@@ -0,0 +1,27 @@
+#pragma once
+
+#include <set>
+#include <string>
+
+// x86-64 microarchitecture levels CachyOS builds optimised repos for.
+enum class CpuLevel { Generic, V2, V3, V4, Znver4 };
+
+struct CpuInfo {
+    std::string vendor;
+    int family = 0;
+    int model = 0;
+    // Feature flags by their /proc/cpuinfo names. Only flags reported by both
+    // CPUID and the kernel are kept, so features the kernel disabled (or the
+    // OS does not save state for) never raise the level.
+    std::set<std::string> flags;
+};
+
+CpuInfo read_cpu_info();
+CpuLevel detect_cpu_level(const CpuInfo& info);
+
+std::string cpu_level_name(CpuLevel level);
+// Accepts the names above plus "v2", "v3", "v4"; returns false if unknown.
+bool parse_cpu_level(const std::string& name, CpuLevel& level);
+
+// "auto" (or empty) detects the running CPU, anything else is an override.
+CpuLevel resolve_cpu_level(const std::string& setting);
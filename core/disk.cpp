@@ -0,0 +1,161 @@
+#include "disk.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static uint64_t read_sysfs_number(const fs::path& path, uint64_t fallback = 0) {
+    std::ifstream file(path);
+    uint64_t value;
+    if (file >> value) return value;
+    return fallback;
+}
+
+std::string block_device_name(const std::string& device) {
+    std::error_code ec;
+    fs::path resolved = fs::canonical(device, ec);
+    return (ec ? fs::path(device) : resolved).filename().string();
+}
+
+bool read_disk_geometry(const std::string& device, DiskGeometry& geometry, std::string& error) {
+    struct stat st;
+    if (stat(device.c_str(), &st) != 0) {
+        error = "cannot stat " + device;
+        return false;
+    }
+
+    geometry = DiskGeometry();
+    geometry.name = block_device_name(device);
+    if (S_ISREG(st.st_mode)) {
+        geometry.size_bytes = st.st_size;
+        return true;
+    }
+    if (!S_ISBLK(st.st_mode)) {
+        error = device + " is not a block device";
+        return false;
+    }
+
+    fs::path sys = fs::path("/sys/class/block") / geometry.name;
+    fs::path queue = sys / "queue";
+    // sysfs sizes are always in 512-byte units, whatever the sector size
+    geometry.size_bytes = read_sysfs_number(sys / "size") * 512;
+    geometry.logical_sector = read_sysfs_number(queue / "logical_block_size", 512);
+    geometry.physical_sector = read_sysfs_number(queue / "physical_block_size", geometry.logical_sector);
+    geometry.optimal_io = read_sysfs_number(queue / "optimal_io_size");
+    geometry.alignment_offset = read_sysfs_number(sys / "alignment_offset");
+    geometry.rotational = read_sysfs_number(queue / "rotational") != 0;
+    geometry.discard_granularity = read_sysfs_number(queue / "discard_granularity");
+    geometry.discard_max_bytes = read_sysfs_number(queue / "discard_max_bytes");
+    geometry.nr_requests = read_sysfs_number(queue / "nr_requests");
+    if (geometry.size_bytes == 0) {
+        error = "cannot read the size of " + device + " from " + sys.string();
+        return false;
+    }
+    return true;
+}
+
+std::vector<PartitionNode> partition_nodes(const std::string& device) {
+    std::vector<PartitionNode> nodes;
+    fs::path sys = fs::path("/sys/class/block") / block_device_name(device);
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(sys, ec)) {
+        int number = static_cast<int>(read_sysfs_number(entry.path() / "partition"));
+        if (number > 0) {
+            nodes.push_back({number, "/dev/" + entry.path().filename().string()});
+        }
+    }
+    std::sort(nodes.begin(), nodes.end(), [](const PartitionNode& a, const PartitionNode& b) {
+        return a.number < b.number;
+    });
+    return nodes;
+}
+
+std::string wait_for_partition(const std::string& device, int number, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    do {
+        for (const PartitionNode& node : partition_nodes(device)) {
+            std::error_code ec;
+            if (node.number == number && fs::exists(node.device, ec)) return node.device;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    } while (std::chrono::steady_clock::now() < deadline);
+    return "";
+}
+
+double measure_write_speed(const std::string& device, uint64_t bytes, std::string& error) {
+    const size_t block = 4 * 1024 * 1024;
+    int fd = open(device.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    if (fd < 0) {
+        error = "open " + device + ": " + std::strerror(errno);
+        return 0;
+    }
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, 4096, block) != 0) {
+        close(fd);
+        error = "out of memory";
+        return 0;
+    }
+    // Random bytes so devices that compress or deduplicate do not flatter the result
+    std::mt19937_64 random(42);
+    for (size_t i = 0; i < block / 8; ++i) static_cast<uint64_t*>(buffer)[i] = random();
+
+    auto started = std::chrono::steady_clock::now();
+    uint64_t written = 0;
+    while (written < bytes) {
+        ssize_t n = pwrite(fd, buffer, block, written);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            error = "write " + device + ": " + std::strerror(errno);
+            break;
+        }
+        written += n;
+    }
+    fdatasync(fd);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    free(buffer);
+    close(fd);
+    return written >= bytes && seconds > 0 ? written / seconds : 0;
+}
+
+bool disk_in_use(const std::string& device, std::string& mounted_at) {
+    std::vector<std::string> names = {block_device_name(device)};
+    for (const PartitionNode& node : partition_nodes(device)) {
+        names.push_back(block_device_name(node.device));
+    }
+
+    std::ifstream mounts("/proc/mounts");
+    std::string line;
+    while (std::getline(mounts, line)) {
+        std::istringstream fields(line);
+        std::string source, mount_point;
+        fields >> source >> mount_point;
+        if (source.rfind("/dev/", 0) != 0) continue;
+        if (std::find(names.begin(), names.end(), block_device_name(source)) != names.end()) {
+            mounted_at = mount_point;
+            return true;
+        }
+    }
+
+    std::ifstream swaps("/proc/swaps");
+    std::getline(swaps, line);
+    while (std::getline(swaps, line)) {
+        std::string source = line.substr(0, line.find_first_of(" \t"));
+        if (std::find(names.begin(), names.end(), block_device_name(source)) != names.end()) {
+            mounted_at = "swap";
+            return true;
+        }
+    }
+    return false;
+}
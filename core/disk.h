@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// What the kernel reports about a block device in /sys/class/block/<name>/queue.
+struct DiskGeometry {
+    std::string name;               // nvme0n1, sda, ...
+    uint64_t size_bytes = 0;
+    uint32_t logical_sector = 512;
+    uint32_t physical_sector = 512;
+    uint32_t optimal_io = 0;        // 0 when the device does not report one
+    uint32_t alignment_offset = 0;
+    bool rotational = false;
+    uint64_t discard_granularity = 0;
+    uint64_t discard_max_bytes = 0;   // 0: the device does not support discard
+    uint32_t nr_requests = 0;       // request queue depth, 0 when unknown
+
+    uint64_t sectors() const { return size_bytes / logical_sector; }
+};
+
+// "/dev/nvme0n1" or a /dev/disk/by-* link -> "nvme0n1"
+std::string block_device_name(const std::string& device);
+
+// Reads the geometry from sysfs. Regular files (disk images) get their size
+// from stat and 512-byte sectors. Returns false with error set on failure.
+bool read_disk_geometry(const std::string& device, DiskGeometry& geometry, std::string& error);
+
+struct PartitionNode {
+    int number = 0;
+    std::string device;             // /dev/nvme0n1p2, /dev/sda2, ...
+};
+
+// Partitions the kernel knows for a disk, found through the <disk>/<part>/partition
+// entries in sysfs rather than by guessing the naming scheme.
+std::vector<PartitionNode> partition_nodes(const std::string& device);
+
+// Waits (up to timeout_ms) for partition `number` to appear in sysfs and for
+// udev to create its device node. Returns the node, or "" on timeout.
+std::string wait_for_partition(const std::string& device, int number, int timeout_ms = 5000);
+
+// Sequential O_DIRECT write speed in bytes/s over the first `bytes` of a
+// device that is about to be formatted (its contents are overwritten).
+double measure_write_speed(const std::string& device, uint64_t bytes, std::string& error);
+
+// True if the disk or any of its partitions is mounted or used as swap.
+bool disk_in_use(const std::string& device, std::string& mounted_at);
@@ -0,0 +1,251 @@
+#include "gpt.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <random>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+static const uint64_t MIB = 1024 * 1024;
+static const uint64_t MIN_ROOT_BYTES = 8 * 1024 * MIB;
+static const uint32_t ENTRY_COUNT = 128;
+static const uint32_t ENTRY_SIZE = 128;
+static const uint32_t HEADER_SIZE = 92;
+
+// udev may still be probing the old partitions right after the wipe, and
+// BLKRRPART fails with EBUSY until it lets go
+static const int REREAD_ATTEMPTS = 10;
+static const int REREAD_BACKOFF_MS = 100;
+
+using Guid = std::array<uint8_t, 16>;
+
+// GUIDs are stored with the first three fields little-endian
+static Guid parse_guid(const char* text) {
+    Guid guid{};
+    std::array<uint8_t, 16> raw{};
+    int n = 0;
+    for (const char* p = text; *p && n < 16; ++p) {
+        if (*p == '-') continue;
+        raw[n++] = static_cast<uint8_t>(std::stoi(std::string(p, 2), nullptr, 16));
+        ++p;
+    }
+    static const int ORDER[16] = {3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15};
+    for (int i = 0; i < 16; ++i) guid[i] = raw[ORDER[i]];
+    return guid;
+}
+
+static Guid random_guid() {
+    static std::random_device device;
+    Guid guid;
+    for (uint8_t& byte : guid) byte = static_cast<uint8_t>(device());
+    guid[7] = (guid[7] & 0x0f) | 0x40;  // version 4
+    guid[8] = (guid[8] & 0x3f) | 0x80;  // RFC 4122 variant
+    return guid;
+}
+
+static Guid type_guid(PartitionRole role) {
+    switch (role) {
+        case PartitionRole::Esp: return parse_guid("C12A7328-F81F-11D2-BA4B-00A0C93EC93B");
+        // The x86-64 root type lets systemd-gpt-auto-generator find it
+        case PartitionRole::Root: return parse_guid("4F68BCE3-E8CD-4DB1-96E7-FBCAF984B709");
+        case PartitionRole::Swap: return parse_guid("0657FD6D-A4AB-43C4-84E5-0933C84B4F4F");
+    }
+    return {};
+}
+
+static uint32_t crc32(const uint8_t* data, size_t length) {
+    static const auto TABLE = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return table;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) crc = TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+template <typename T>
+static void put_le(uint8_t* out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint64_t partition_alignment(const DiskGeometry& geometry) {
+    uint64_t alignment = MIB;
+    uint64_t optimal = geometry.optimal_io;
+    // Some USB bridges report nonsense such as 33553920; only trust values
+    // that are a multiple of the physical sector and fit a 1MiB grid
+    if (optimal > MIB && optimal % geometry.physical_sector == 0 && optimal % MIB == 0) {
+        alignment = optimal;
+    }
+    return alignment;
+}
+
+static uint64_t entries_sectors(const DiskGeometry& geometry) {
+    return (ENTRY_COUNT * ENTRY_SIZE + geometry.logical_sector - 1) / geometry.logical_sector;
+}
+
+bool plan_partitions(const DiskGeometry& geometry, const PartitionLayout& layout,
+                     std::vector<PlannedPartition>& partitions, std::string& error) {
+    const uint64_t sector = geometry.logical_sector;
+    const uint64_t align = partition_alignment(geometry) / sector;
+    // alignment_offset is where the first naturally aligned LBA starts
+    const uint64_t offset = (geometry.alignment_offset / sector) % align;
+    auto align_up = [&](uint64_t lba) { return ((lba + align - 1 - offset) / align) * align + offset; };
+    auto align_down = [&](uint64_t lba) { return lba < offset ? 0 : ((lba - offset) / align) * align + offset; };
+
+    const uint64_t first_usable = 2 + entries_sectors(geometry);
+    const uint64_t last_usable = geometry.sectors() - 2 - entries_sectors(geometry);
+    const uint64_t esp_sectors = layout.esp_size_mib * MIB / sector;
+    const uint64_t swap_sectors = layout.swap_size_mib * MIB / sector;
+
+    partitions.clear();
+    uint64_t esp_start = align_up(first_usable);
+    uint64_t root_start = align_up(esp_start + esp_sectors);
+    uint64_t end = align_down(last_usable + 1);   // exclusive end of usable, aligned
+    uint64_t swap_start = swap_sectors ? align_down(end - std::min(end, swap_sectors)) : end;
+    if (layout.esp_size_mib == 0 || swap_start <= root_start || (swap_start - root_start) * sector < MIN_ROOT_BYTES) {
+        error = "disk " + geometry.name + " (" + std::to_string(geometry.size_bytes / MIB) +
+                " MiB) is too small for a " + std::to_string(layout.esp_size_mib) + " MiB ESP" +
+                (swap_sectors ? ", " + std::to_string(layout.swap_size_mib) + " MiB swap" : std::string()) +
+                " and an 8 GiB root partition";
+        return false;
+    }
+
+    partitions.push_back({1, PartitionRole::Esp, "EFI system partition", esp_start, esp_start + esp_sectors - 1, ""});
+    partitions.push_back({2, PartitionRole::Root, "CachyOS root", root_start, swap_start - 1, ""});
+    if (swap_sectors) {
+        partitions.push_back({3, PartitionRole::Swap, "CachyOS swap", swap_start, std::min(end, swap_start + swap_sectors) - 1, ""});
+    }
+    return true;
+}
+
+static std::vector<uint8_t> build_entries(const std::vector<PlannedPartition>& partitions) {
+    std::vector<uint8_t> entries(ENTRY_COUNT * ENTRY_SIZE, 0);
+    for (const PlannedPartition& part : partitions) {
+        uint8_t* entry = entries.data() + (part.number - 1) * ENTRY_SIZE;
+        Guid type = type_guid(part.role);
+        Guid unique = random_guid();
+        std::memcpy(entry, type.data(), 16);
+        std::memcpy(entry + 16, unique.data(), 16);
+        put_le<uint64_t>(entry + 32, part.first_lba);
+        put_le<uint64_t>(entry + 40, part.last_lba);
+        // Name is UTF-16LE, 36 code units; labels are ASCII
+        for (size_t i = 0; i < part.label.size() && i < 36; ++i) {
+            put_le<uint16_t>(entry + 56 + 2 * i, static_cast<uint8_t>(part.label[i]));
+        }
+    }
+    return entries;
+}
+
+static void build_header(uint8_t* header, const DiskGeometry& geometry, const Guid& disk_guid,
+                         uint64_t my_lba, uint64_t alternate_lba, uint64_t entries_lba, uint32_t entries_crc) {
+    std::memcpy(header, "EFI PART", 8);
+    put_le<uint32_t>(header + 8, 0x00010000);
+    put_le<uint32_t>(header + 12, HEADER_SIZE);
+    put_le<uint32_t>(header + 16, 0);
+    put_le<uint64_t>(header + 24, my_lba);
+    put_le<uint64_t>(header + 32, alternate_lba);
+    put_le<uint64_t>(header + 40, 2 + entries_sectors(geometry));
+    put_le<uint64_t>(header + 48, geometry.sectors() - 2 - entries_sectors(geometry));
+    std::memcpy(header + 56, disk_guid.data(), 16);
+    put_le<uint64_t>(header + 72, entries_lba);
+    put_le<uint32_t>(header + 80, ENTRY_COUNT);
+    put_le<uint32_t>(header + 84, ENTRY_SIZE);
+    put_le<uint32_t>(header + 88, entries_crc);
+    put_le<uint32_t>(header + 16, crc32(header, HEADER_SIZE));
+}
+
+static bool write_all(int fd, const std::vector<uint8_t>& data, uint64_t offset) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = pwrite(fd, data.data() + done, data.size() - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+bool write_gpt(const std::string& device, const DiskGeometry& geometry,
+               std::vector<PlannedPartition>& partitions, std::string& error) {
+    const uint64_t sector = geometry.logical_sector;
+    const uint64_t last_lba = geometry.sectors() - 1;
+    const uint64_t table_sectors = entries_sectors(geometry);
+
+    std::vector<uint8_t> entries = build_entries(partitions);
+    entries.resize(table_sectors * sector, 0);
+    uint32_t entries_crc = crc32(entries.data(), ENTRY_COUNT * ENTRY_SIZE);
+    Guid disk_guid = random_guid();
+
+    // LBA 0: protective MBR, LBA 1: header, LBA 2..: entries
+    std::vector<uint8_t> primary((2 + table_sectors) * sector, 0);
+    uint8_t* mbr_entry = primary.data() + 446;
+    mbr_entry[1] = 0x00; mbr_entry[2] = 0x02; mbr_entry[3] = 0x00;   // CHS 0/0/2
+    mbr_entry[4] = 0xEE;
+    mbr_entry[5] = 0xFF; mbr_entry[6] = 0xFF; mbr_entry[7] = 0xFF;
+    put_le<uint32_t>(mbr_entry + 8, 1);
+    put_le<uint32_t>(mbr_entry + 12, static_cast<uint32_t>(std::min<uint64_t>(last_lba, 0xFFFFFFFFu)));
+    primary[510] = 0x55;
+    primary[511] = 0xAA;
+    build_header(primary.data() + sector, geometry, disk_guid, 1, last_lba, 2, entries_crc);
+    std::memcpy(primary.data() + 2 * sector, entries.data(), entries.size());
+
+    // Backup: entries then header in the last sectors of the disk
+    std::vector<uint8_t> backup((table_sectors + 1) * sector, 0);
+    std::memcpy(backup.data(), entries.data(), entries.size());
+    build_header(backup.data() + table_sectors * sector, geometry, disk_guid, last_lba, 1,
+                 last_lba - table_sectors, entries_crc);
+
+    int fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        error = "open " + device + ": " + std::strerror(errno);
+        return false;
+    }
+    if (!write_all(fd, primary, 0) || !write_all(fd, backup, (last_lba - table_sectors) * sector) || fsync(fd) != 0) {
+        error = "write partition table to " + device + ": " + std::strerror(errno);
+        close(fd);
+        return false;
+    }
+
+    struct stat st;
+    bool is_block = fstat(fd, &st) == 0 && S_ISBLK(st.st_mode);
+    int rc = is_block ? ioctl(fd, BLKRRPART) : 0;
+    for (int attempt = 1; rc != 0 && errno == EBUSY && attempt < REREAD_ATTEMPTS; ++attempt) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(REREAD_BACKOFF_MS));
+        rc = ioctl(fd, BLKRRPART);
+    }
+    if (rc != 0) {
+        error = "re-read partition table of " + device + ": " + std::strerror(errno);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    if (!is_block) return true;
+
+    for (PlannedPartition& part : partitions) {
+        part.device = wait_for_partition(device, part.number);
+        if (part.device.empty()) {
+            error = "partition " + std::to_string(part.number) + " of " + device + " did not appear";
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string partition_device(const std::vector<PlannedPartition>& partitions, PartitionRole role) {
+    for (const PlannedPartition& part : partitions) {
+        if (part.role == role) return part.device;
+    }
+    return "";
+}
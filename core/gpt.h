@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "disk.h"
+
+enum class PartitionRole { Esp, Root, Swap };
+
+// Installer-side description of the disk layout. The ESP comes first, the
+// root partition takes whatever is left and an optional swap partition sits
+// at the end of the disk.
+struct PartitionLayout {
+    uint64_t esp_size_mib = 512;
+    uint64_t swap_size_mib = 0;     // 0: no swap partition
+};
+
+struct PlannedPartition {
+    int number = 0;
+    PartitionRole role = PartitionRole::Root;
+    std::string label;
+    uint64_t first_lba = 0;
+    uint64_t last_lba = 0;
+    std::string device;             // filled in once the kernel has re-read the table
+};
+
+// Partition start alignment in bytes: 1MiB, or the device's optimal I/O size
+// when it reports a usable larger one.
+uint64_t partition_alignment(const DiskGeometry& geometry);
+
+// Lays out the partitions on aligned boundaries. Fails if the disk is too
+// small for the ESP, swap and a root partition of at least 8GiB.
+bool plan_partitions(const DiskGeometry& geometry, const PartitionLayout& layout,
+                     std::vector<PlannedPartition>& partitions, std::string& error);
+
+// Writes a protective MBR and the primary GPT in one write, the backup GPT at
+// the end of the disk, then asks the kernel to re-read the table once
+// (BLKRRPART, retried for about a second while udev keeps the disk busy)
+// and resolves each partition's device node through sysfs.
+bool write_gpt(const std::string& device, const DiskGeometry& geometry,
+               std::vector<PlannedPartition>& partitions, std::string& error);
+
+// The device node of the first partition with this role, or "".
+std::string partition_device(const std::vector<PlannedPartition>& partitions, PartitionRole role);
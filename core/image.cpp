@@ -0,0 +1,161 @@
+#include "image.h"
+#include "btrfs.h"
+#include "log.h"
+
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+std::string image_manifest_path(const std::string& image) {
+    return image + ".manifest";
+}
+
+std::string image_snapshot_name(size_t index) {
+    return "image-" + std::to_string(index);
+}
+
+bool write_image_manifest(const std::string& path, const ImageManifest& manifest, std::string& error) {
+    std::ofstream out(path, std::ios::trunc);
+    out << "# Golden image manifest, written by the installer\n";
+    for (const SubvolumeSpec& spec : manifest.subvolumes) {
+        out << "SUBVOLUME=" << format_subvolume_spec(spec) << "\n";
+    }
+    out << "COMPRESSION_LEVEL=" << manifest.compression_level << "\n"
+        << "KERNEL_TYPE=" << manifest.kernel_type << "\n"
+        << "INITRAMFS=" << manifest.initramfs << "\n"
+        << "BOOTLOADER=" << manifest.bootloader << "\n"
+        << "DESKTOP_ENV=" << manifest.desktop_env << "\n"
+        << "LOCALE_LANG=" << manifest.locale_lang << "\n"
+        << "TIMEZONE=" << manifest.timezone << "\n"
+        << "USER_NAME=" << manifest.user_name << "\n";
+    out.close();
+    if (!out) {
+        error = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+bool read_image_manifest(const std::string& path, ImageManifest& manifest, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "Cannot read " + path;
+        return false;
+    }
+    manifest = ImageManifest();
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t equals = line.find('=');
+        if (line.empty() || line[0] == '#' || equals == std::string::npos) continue;
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        if (key == "SUBVOLUME") {
+            SubvolumeSpec spec;
+            if (!parse_subvolume_spec(value, spec, error)) {
+                error = path + ": " + error;
+                return false;
+            }
+            manifest.subvolumes.push_back(spec);
+        }
+        else if (key == "COMPRESSION_LEVEL") {
+            // The level of the zstd default, checked like a subvolume's
+            SubvolumeSpec spec;
+            if (!parse_compression("zstd:" + value, spec, error)) {
+                error = path + ": " + error;
+                return false;
+            }
+            manifest.compression_level = spec.level;
+        }
+        else if (key == "KERNEL_TYPE") manifest.kernel_type = value;
+        else if (key == "INITRAMFS") manifest.initramfs = value;
+        else if (key == "BOOTLOADER") manifest.bootloader = value;
+        else if (key == "DESKTOP_ENV") manifest.desktop_env = value;
+        else if (key == "LOCALE_LANG") manifest.locale_lang = value;
+        else if (key == "TIMEZONE") manifest.timezone = value;
+        else if (key == "USER_NAME") manifest.user_name = value;
+    }
+    if (!validate_subvolume_layout(manifest.subvolumes, error)) {
+        error = path + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+void apply_image_manifest(const ImageManifest& manifest, InstallConfig& config) {
+    config.subvolumes = manifest.subvolumes;
+    config.compression_level = manifest.compression_level;
+    config.fast_install = false;
+    config.kernel_type = manifest.kernel_type;
+    config.initramfs = manifest.initramfs;
+    config.bootloader = manifest.bootloader;
+    config.desktop_env = manifest.desktop_env;
+    config.locale_lang = manifest.locale_lang;
+    if (config.timezone.empty()) config.timezone = manifest.timezone;
+}
+
+void delete_snapshots(const std::vector<std::string>& snapshots, const std::string& dir) {
+    for (const std::string& snapshot : snapshots) {
+        std::string error;
+        if (fs::exists(snapshot) && !delete_subvolume(snapshot, error)) core_log("Warning: " + error);
+    }
+    std::error_code ignored;
+    fs::remove(dir, ignored);
+}
+
+bool snapshot_layout(const std::string& top_level, const std::vector<SubvolumeSpec>& layout, const std::string& dir,
+                     std::vector<std::string>& snapshots, std::string& error) {
+    std::string snapshot_dir = top_level + "/" + dir;
+    std::error_code ec;
+    fs::create_directories(snapshot_dir, ec);
+    if (ec) {
+        error = "mkdir " + snapshot_dir + ": " + ec.message();
+        return false;
+    }
+    snapshots.clear();
+    for (size_t i = 0; i < layout.size(); ++i) {
+        std::string path = snapshot_dir + "/" + image_snapshot_name(i);
+        // Left over from an interrupted export
+        std::string ignored_error;
+        if (fs::exists(path)) delete_subvolume(path, ignored_error);
+        if (!snapshot_subvolume(top_level + "/" + layout[i].name, path, true, error)) {
+            delete_snapshots(snapshots, snapshot_dir);
+            snapshots.clear();
+            return false;
+        }
+        snapshots.push_back(path);
+    }
+    return true;
+}
+
+bool adopt_received_layout(const std::string& top_level, const std::vector<SubvolumeSpec>& layout,
+                           const std::string& dir, std::string& error) {
+    const SubvolumeSpec* root = root_subvolume(layout);
+    std::string received_dir = top_level + "/" + dir;
+    std::vector<std::string> received;
+    for (size_t i = 0; i < layout.size(); ++i) {
+        std::string source = received_dir + "/" + image_snapshot_name(i);
+        std::string path = top_level + "/" + layout[i].name;
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        if (ec) {
+            error = "mkdir " + fs::path(path).parent_path().string() + ": " + ec.message();
+            return false;
+        }
+        // A resumed run may have adopted it already
+        if (!fs::exists(path) && !snapshot_subvolume(source, path, false, error)) return false;
+        received.push_back(source);
+
+        // The stream carries files, not the subvolume's own attributes
+        std::string warning;
+        if (layout[i].nodatacow && !set_nocow(path, warning)) {
+            core_log("Warning: " + warning);
+        }
+        if (root && layout[i].compression != root->compression && !layout[i].nodatacow &&
+            !set_compression_property(path, layout[i].compression, warning)) {
+            core_log("Warning: " + warning);
+        }
+    }
+    delete_snapshots(received, received_dir);
+    return true;
+}
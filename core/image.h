@@ -0,0 +1,57 @@
+#pragma once
+
+#include "config.h"
+#include "subvolumes.h"
+
+#include <string>
+#include <vector>
+
+// A golden image is a reference install kept as a `btrfs send` stream: one
+// read-only snapshot per layout subvolume, all in one file, plus a manifest
+// next to it (<image>.manifest) saying how the install was made. Applying
+// it replaces pacstrap and the chroot script with `btrfs receive`, so
+// identical machines are provisioned at disk speed and only per-host state
+// (hostname, users, fstab UUIDs, bootloader entries, machine-id) is
+// rewritten.
+struct ImageManifest {
+    std::vector<SubvolumeSpec> subvolumes;
+    int compression_level = 3;
+    std::string kernel_type;
+    std::string initramfs;
+    std::string bootloader;
+    std::string desktop_env;
+    std::string locale_lang;
+    std::string timezone;
+    std::string user_name;      // the reference install's user
+};
+
+std::string image_manifest_path(const std::string& image);
+
+// installer.conf style lines: SUBVOLUME=, COMPRESSION_LEVEL=, KERNEL_TYPE=, ...
+bool write_image_manifest(const std::string& path, const ImageManifest& manifest, std::string& error);
+bool read_image_manifest(const std::string& path, ImageManifest& manifest, std::string& error);
+
+// The system half of config, as the image was built with it; the per-host
+// half (disk, hostname, timezone, users, passwords) stays config's own. The
+// image's timezone is only used when config has none.
+void apply_image_manifest(const ImageManifest& manifest, InstallConfig& config);
+
+// Name of the snapshot of layout entry index, inside the stream. Layout
+// names can be nested ("@var/lib/machines"); snapshot names cannot.
+std::string image_snapshot_name(size_t index);
+
+// Takes read-only snapshots of every layout subvolume below top_level (the
+// mounted subvolid=5 root) into top_level/dir, returning their paths in
+// layout order for `btrfs send`. On failure the snapshots made so far are
+// deleted.
+bool snapshot_layout(const std::string& top_level, const std::vector<SubvolumeSpec>& layout, const std::string& dir,
+                     std::vector<std::string>& snapshots, std::string& error);
+
+// After `btrfs receive` into top_level/dir: every received snapshot becomes
+// a writable snapshot at its layout name (sharing all extents, so nothing
+// is copied) and the read-only one is deleted, then dir itself.
+bool adopt_received_layout(const std::string& top_level, const std::vector<SubvolumeSpec>& layout,
+                           const std::string& dir, std::string& error);
+
+// Deletes snapshots and the directory holding them; failures are logged
+void delete_snapshots(const std::vector<std::string>& snapshots, const std::string& dir);
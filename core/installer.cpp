@@ -0,0 +1,818 @@
+#include "installer.h"
+#include "chroot.h"
+#include "compression.h"
+#include "gpt.h"
+#include "image.h"
+#include "log.h"
+#include "offline.h"
+#include "packages.h"
+#include "recompress.h"
+#include "repos.h"
+#include "subvolumes.h"
+#include "wipe.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const size_t STAGE_COUNT = static_cast<size_t>(InstallStage::Finalize) + 1;
+
+static size_t stage_index(InstallStage stage) {
+    return static_cast<size_t>(stage);
+}
+
+Installer::Installer(const InstallConfig& config, const InstallerOptions& options, const InstallerEvents& events)
+    : config(config), options(options), events(events), unfinished(STAGE_COUNT, 0),
+      journal_pending(STAGE_COUNT, 0), prefetcher(options.staging_dir) {}
+
+double Installer::fraction() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return progress.fraction();
+}
+
+std::string Installer::status() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return progress.status();
+}
+
+std::vector<std::pair<std::string, double>> Installer::stage_seconds() const {
+    return trace.stage_seconds();
+}
+
+std::string Installer::target(const std::string& path) const {
+    return target_path(options.target_root, path);
+}
+
+std::string Installer::state(const std::string& name) const {
+    return (options.state_dir.empty() ? options.staging_dir : options.state_dir) + "/" + name;
+}
+
+PackagePrefetcher& Installer::downloads() {
+    return options.shared_prefetch ? *options.shared_prefetch : prefetcher;
+}
+
+std::string Installer::journal_get(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    return journal.get(key);
+}
+
+void Installer::journal_set(const std::string& key, const std::string& value) {
+    std::lock_guard<std::mutex> lock(journal_mutex);
+    journal.set(key, value);
+}
+
+std::string Installer::advance_progress() {
+    size_t first = 0;
+    while (first + 1 < STAGE_COUNT && unfinished[first] == 0) ++first;
+    InstallStage stage = static_cast<InstallStage>(first);
+    if (progress_started && stage <= progress.stage()) return "";
+    progress_started = true;
+    progress.begin(stage);
+    return stage_name(stage);
+}
+
+void Installer::add_step(const std::string& name, InstallStage stage, bool journaled, std::vector<std::string> after,
+                         std::vector<Resource> resources, std::function<bool(std::string& error)> body) {
+    ++unfinished[stage_index(stage)];
+    if (journaled) ++journal_pending[stage_index(stage)];
+
+    Step step;
+    step.name = name;
+    step.after = std::move(after);
+    step.resources = std::move(resources);
+    step.run = [this, name, stage, journaled, body](std::string& error) {
+        set_log_prefix(options.log_prefix);
+        bool skipped = false;
+        {
+            std::lock_guard<std::mutex> lock(journal_mutex);
+            skipped = journaled && journal.done(stage);
+        }
+        int64_t started = monotonic_ns();
+        bool ok = skipped || body(error);
+        if (!skipped) trace.record_step(name, stage_name(stage), started, monotonic_ns(), ok, current_worker());
+        if (!ok) return false;
+
+        if (journaled && !skipped) {
+            std::lock_guard<std::mutex> lock(journal_mutex);
+            if (--journal_pending[stage_index(stage)] == 0) journal.complete(stage);
+        }
+        std::string next_stage;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --unfinished[stage_index(stage)];
+            next_stage = advance_progress();
+        }
+        if (!next_stage.empty()) core_log(next_stage);
+        if (events.progress) events.progress();
+        return true;
+    };
+    graph.add(std::move(step));
+}
+
+// Runs a command without a shell, streaming its output to the frontend.
+// Only output from the stage progress is following feeds the estimate.
+bool Installer::command(InstallStage stage, const std::vector<std::string>& argv, std::string& error,
+                        const std::string& input) {
+    ProcessOptions process_options;
+    process_options.stdin_mode = input.empty() ? StdinMode::Null : StdinMode::Data;
+    process_options.stdin_data = input;
+    process_options.on_line = [this, stage](const std::string& line, bool) {
+        if (trace.feed_line(line, stage_name(stage))) return;
+        if (events.output) events.output(line);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (progress.stage() == stage) progress.feed_line(line);
+        }
+        if (events.progress) events.progress();
+    };
+
+    core_log("[EXEC] " + format_argv(argv));
+    ProcessResult result = run_process(argv, process_options);
+    trace.record(result, stage_name(stage), current_worker());
+    if (events.command_done) events.command_done(result);
+    if (!result.spawned) {
+        error = "Error executing: " + format_argv(result.argv) + " (" + result.spawn_error + ")";
+        return false;
+    }
+    if (result.exit_code != 0) {
+        error = format_argv(result.argv) + " failed with exit code " + std::to_string(result.exit_code);
+        return false;
+    }
+    return true;
+}
+
+// Steps are added in pipeline order, which is also the order ready steps
+// get a worker in
+void Installer::build_steps() {
+    using namespace std::placeholders;
+    bool swap = config.swap_size_mib > 0;
+    bool image = !config.image.empty();
+    bool offline = !config.offline_repo.empty();
+
+    if (!image) {
+        add_step("repos", InstallStage::Wipe, false, {}, {Resource::Network},
+                 std::bind(&Installer::prepare_repos, this, _1));
+    }
+    // The local repository is read in place, there is nothing to fetch
+    if (!image && !offline) {
+        add_step("prefetch", InstallStage::Packages, true, {"repos"}, {Resource::Network},
+                 std::bind(&Installer::prefetch_packages, this, _1));
+    }
+    if (offline && options.offline_server.empty()) {
+        add_step("freshness", InstallStage::Packages, false, {"repos"}, {Resource::Network},
+                 std::bind(&Installer::check_offline_repo, this, _1));
+    }
+    add_step("wipe", InstallStage::Wipe, true, {}, {Resource::Disk},
+             std::bind(&Installer::wipe, this, _1));
+    add_step("probe disk", InstallStage::Partition, false, {}, {},
+             std::bind(&Installer::probe_disk, this, _1));
+    add_step("partition", InstallStage::Partition, true, {"wipe", "probe disk"}, {Resource::Disk},
+             std::bind(&Installer::partition, this, _1));
+    // Measures the root partition's write speed, so the other partitions
+    // are formatted after it rather than during
+    add_step("compression level", InstallStage::Format, false, {"partition"}, {Resource::Disk, Resource::Cpu},
+             std::bind(&Installer::choose_compression, this, _1));
+    add_step("mkfs root", InstallStage::Format, true, {"compression level", "probe disk"}, {Resource::Disk},
+             std::bind(&Installer::format_root, this, _1));
+    add_step("mkfs esp", InstallStage::Format, true, {"compression level"}, {Resource::Disk},
+             std::bind(&Installer::format_esp, this, _1));
+    if (swap) {
+        add_step("mkswap", InstallStage::Format, true, {"compression level"}, {Resource::Disk},
+                 std::bind(&Installer::format_swap, this, _1));
+    }
+    if (image) {
+        add_step("receive image", InstallStage::Subvolumes, true, {"mkfs root"}, {Resource::Disk},
+                 std::bind(&Installer::receive_image, this, _1));
+    } else {
+        add_step("subvolumes", InstallStage::Subvolumes, true, {"mkfs root"}, {Resource::Disk},
+                 std::bind(&Installer::create_subvolumes, this, _1));
+    }
+    add_step("mount", InstallStage::Mount, false, {image ? "receive image" : "subvolumes", "mkfs esp"}, {},
+             std::bind(&Installer::mount_target, this, _1));
+    if (!image) {
+        // With the packages prefetched, pacstrap is extraction and hooks
+        add_step("pacstrap", InstallStage::Packages, true, {"mount", offline ? "repos" : "prefetch"},
+                 {Resource::Disk, Resource::Cpu},
+                 std::bind(&Installer::install_packages, this, _1));
+    }
+    // Written before or while pacstrap runs; the filesystem package's own
+    // fstab then lands as fstab.pacnew. An image's fstab gets the new UUIDs.
+    std::vector<std::string> fstab_after = {"mount"};
+    if (swap) fstab_after.push_back("mkswap");
+    add_step("fstab", InstallStage::Fstab, true, fstab_after, {},
+             std::bind(&Installer::write_fstab, this, _1));
+    if (!image) {
+        add_step("locale", InstallStage::Locale, true, {"mount"}, {},
+                 std::bind(&Installer::write_locale, this, _1));
+    }
+    add_step("users", InstallStage::Users, true, {image ? "mount" : "pacstrap"}, {},
+             std::bind(&Installer::create_users, this, _1));
+    add_step("chroot script", InstallStage::Chroot, false, {"mount"}, {},
+             std::bind(&Installer::write_chroot_script, this, _1));
+    // The Hyprland config is written into the user's home
+    std::vector<std::string> chroot_after = {image ? "mount" : "pacstrap", "chroot script"};
+    if (config.desktop_env == "Hyprland" && !image) chroot_after.push_back("users");
+    add_step("chroot", InstallStage::Chroot, true, chroot_after, {Resource::Cpu},
+             std::bind(&Installer::run_chroot, this, _1));
+
+    // Everything else finishes before these
+    std::vector<std::string> last = {"fstab", "users", "chroot"};
+    if (!image) last.push_back("locale");
+    if (!config.image_build.empty()) {
+        add_step("export image", InstallStage::Finalize, false, last, {Resource::Disk},
+                 std::bind(&Installer::export_image, this, _1));
+        last = {"export image"};
+    }
+    add_step("finalize", InstallStage::Finalize, false, last,
+             {}, std::bind(&Installer::finalize, this, _1));
+}
+
+bool Installer::run(std::string& error) {
+    set_log_prefix(options.log_prefix);
+    std::error_code ignored;
+    fs::create_directories(options.staging_dir, ignored);
+    fs::create_directories(state(""), ignored);
+    progress.load_history(state("stage-times"));
+
+    // Reuse packages that are already on this machine or a provisioning stick
+    if (options.find_caches && config.image.empty()) {
+        caches = find_package_caches({config.target_disk}, options.cache_dirs);
+        for (const PackageCache& cache : caches) {
+            cache_dirs.push_back(cache.path);
+        }
+    } else {
+        cache_dirs = options.cache_dirs;
+    }
+
+    // The image decides the system; this config only the host
+    if (!config.image.empty()) {
+        ImageManifest manifest;
+        if (!read_image_manifest(image_manifest_path(config.image), manifest, error)) {
+            release_package_caches(caches);
+            return false;
+        }
+        apply_image_manifest(manifest, config);
+        image_user = manifest.user_name;
+        core_log("Installing from image " + config.image);
+    }
+
+    // Pick the optimised CachyOS repos this CPU can run
+    cpu_level = resolve_cpu_level(config.cpu_level);
+    config.cpu_level = cpu_level_name(cpu_level);
+    if (events.cpu_level) events.cpu_level(config.cpu_level);
+
+    // Carry on from an earlier failed run on this disk, if there is one
+    journal.open(state(JOURNAL_FILE), config);
+    if (journal.resuming()) {
+        // A failed run leaves its mounts behind
+        std::string umount_error;
+        if (!mounts_below(options.target_root).empty() && !unmount_recursive(options.target_root, umount_error)) {
+            core_log("Warning: " + umount_error);
+        }
+        std::string verify_error;
+        if (journal.verify(verify_error)) {
+            core_log("Resuming the previous installation at: " + stage_name(journal.resume_stage()));
+        } else {
+            core_log("Starting over: " + verify_error);
+            journal.discard();
+        }
+    }
+
+    std::string mounted_at;
+    if (disk_in_use(config.target_disk, mounted_at)) {
+        error = config.target_disk + " is in use (" + mounted_at + ")";
+        release_package_caches(caches);
+        return false;
+    }
+
+    build_steps();
+    std::string first_stage;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        first_stage = advance_progress();
+    }
+    core_log(first_stage);
+    ResourcePool own_pool(options.limits);
+    bool ok = graph.run(options.workers, options.shared_pool ? *options.shared_pool : own_pool, events.cancelled, error);
+
+    std::vector<std::string> critical;
+    for (const StepRecord& record : graph.critical_path()) critical.push_back(record.name);
+    for (const std::string& line : graph.critical_path_report()) core_log(line);
+    trace.set_critical_path(critical);
+    std::string trace_error;
+    if (!trace.write_chrome_trace(options.trace_file, trace_error) ||
+        !trace.write_summary(options.summary_file, trace_error)) {
+        core_log("Warning: " + trace_error);
+    }
+
+    if (!ok) {
+        std::string umount_error;
+        if (!mounts_below(options.target_root).empty() && !unmount_recursive(options.target_root, umount_error)) {
+            core_log("Warning: " + umount_error);
+        }
+        release_package_caches(caches);
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        if (journal.resuming()) {
+            error += "; start again to resume at: " + stage_name(journal.resume_stage());
+        }
+        return false;
+    }
+
+    release_package_caches(caches);
+    {
+        std::lock_guard<std::mutex> lock(journal_mutex);
+        journal.discard();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        progress.finish();
+    }
+    if (events.progress) events.progress();
+    return true;
+}
+
+bool Installer::prepare_repos(std::string& error) {
+    target_pacman_conf = state("pacman.target.conf");
+    if (!write_target_pacman_conf("/etc/pacman.conf", cpu_level, config.repos, target_pacman_conf)) {
+        error = "Could not write " + target_pacman_conf;
+        return false;
+    }
+
+    if (!config.offline_repo.empty()) return prepare_offline_repo(error);
+
+    // Rank the bundled mirrorlists so prefetch and pacstrap start on fast
+    // mirrors, then see how many downloads at once the fastest one takes.
+    // Whoever ranked them sets up the live system's pacman the same way.
+    ranked_mirrors = options.ranked_mirrors.empty()
+                         ? rank_bundled_mirrors(options.mirror_bundle, options.staging_dir + "/mirrors")
+                         : options.ranked_mirrors;
+    int parallel_downloads =
+        options.parallel_downloads == 0 ? tune_parallel_downloads(ranked_mirrors) : options.parallel_downloads;
+    if (options.ranked_mirrors.empty()) install_live_download_settings(ranked_mirrors, parallel_downloads);
+    if (parallel_downloads > 0) {
+        set_pacman_option(target_pacman_conf, "ParallelDownloads", std::to_string(parallel_downloads));
+    }
+    pacman_conf = target_pacman_conf;
+    if (!ranked_mirrors.empty() && write_install_pacman_conf(target_pacman_conf, ranked_mirrors, state("pacman.conf"))) {
+        pacman_conf = state("pacman.conf");
+    }
+    prefetcher.add_cache_dirs(cache_dirs);
+    prefetcher.set_pacman_config(pacman_conf);
+    return true;
+}
+
+// pacstrap installs from the local repository only. The target still gets
+// the bundled mirrorlists, unranked since there may be no network, for
+// updates later on.
+bool Installer::prepare_offline_repo(std::string& error) {
+    if (!fs::exists(config.offline_repo + "/" + OFFLINE_PACKAGE_LIST)) {
+        error = config.offline_repo + " is not a local repository (no " + OFFLINE_PACKAGE_LIST + ")";
+        return false;
+    }
+    pacman_conf = state("pacman.offline.conf");
+    std::string server = options.offline_server.empty() ? offline_repo_url(config.offline_repo) : options.offline_server;
+    if (!write_offline_pacman_conf("/etc/pacman.conf", cpu_level, server, pacman_conf)) {
+        error = "Could not write " + pacman_conf;
+        return false;
+    }
+    ranked_mirrors = extract_bundled_mirrors(options.mirror_bundle, state("mirrors"));
+    core_log("Installing offline from " + server);
+    return true;
+}
+
+// When a mirror answers, packages the local repository has older versions
+// of are logged; the install goes ahead with them anyway. Runs beside
+// pacstrap, and one short connection attempt decides first, so a network
+// that silently drops packets does not have pacman try every mirror.
+bool Installer::check_offline_repo(std::string&) {
+    std::vector<std::string> servers = parse_mirrorlist(ranked_mirrors + "/mirrorlist");
+    if (servers.empty() ||
+        run_quietly({"curl", "-s", "-o", "/dev/null", "--connect-timeout", "2", "--max-time", "5",
+                     expand_server(servers.front(), "core", "x86_64") + "/core.db"}) != 0) {
+        core_log("Skipping the freshness check: " +
+                 (servers.empty() ? "no mirrorlist" : servers.front() + " did not answer"));
+        return true;
+    }
+    std::string mirror_conf = target_pacman_conf;
+    if (!ranked_mirrors.empty() && write_install_pacman_conf(target_pacman_conf, ranked_mirrors, state("pacman.conf"))) {
+        mirror_conf = state("pacman.conf");
+    }
+    std::vector<StalePackage> stale;
+    std::string check_error;
+    if (!check_local_repo_freshness(config.offline_repo, mirror_conf, stale, check_error)) {
+        core_log("Skipping the freshness check: " + check_error);
+    } else if (stale.empty()) {
+        core_log("The local repository is up to date with the mirrors");
+    } else {
+        core_log(std::to_string(stale.size()) + " packages in the local repository have newer versions on the mirrors:");
+        for (const StalePackage& package : stale) {
+            core_log("  " + package.name + " " + package.local_version + " -> " + package.mirror_version);
+        }
+    }
+    return true;
+}
+
+// Downloads while the disk is being prepared. A failed prefetch is not an
+// error: pacstrap fetches whatever is missing.
+bool Installer::prefetch_packages(std::string&) {
+    if (!options.shared_prefetch) prefetcher.start(full_package_set(config));
+    prefetched = downloads().wait();
+    return true;
+}
+
+bool Installer::wipe(std::string& error) {
+    if (!command(InstallStage::Wipe, {"wipefs", "-a", config.target_disk}, error)) return false;
+    WipeMode wipe_mode = WipeMode::Discard;
+    if (!parse_wipe_mode(config.wipe_mode, wipe_mode)) {
+        core_log("Unknown WIPE_MODE " + config.wipe_mode + ", using discard");
+    }
+    return wipe_disk(config.target_disk, wipe_mode, [this](uint64_t done, uint64_t total) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (progress.stage() == InstallStage::Wipe) progress.set_stage_fraction(static_cast<double>(done) / total);
+        }
+        if (events.progress) events.progress();
+    }, error);
+}
+
+bool Installer::probe_disk(std::string& error) {
+    if (!read_disk_geometry(config.target_disk, geometry, error)) return false;
+    tuning = choose_btrfs_tuning(geometry, mkfs_btrfs_features());
+    core_log("Btrfs tuning: " + describe_btrfs_tuning(tuning));
+    return true;
+}
+
+// One GPT write and one re-read, nodes looked up in sysfs
+bool Installer::partition(std::string& error) {
+    PartitionLayout layout;
+    layout.esp_size_mib = config.esp_size_mib;
+    layout.swap_size_mib = config.swap_size_mib;
+    std::vector<PlannedPartition> partitions;
+    if (!plan_partitions(geometry, layout, partitions, error) ||
+        !write_gpt(config.target_disk, geometry, partitions, error)) {
+        return false;
+    }
+    core_log("Partitions aligned to " + std::to_string(partition_alignment(geometry) / 1024) + " KiB (" +
+             std::to_string(geometry.logical_sector) + "/" + std::to_string(geometry.physical_sector) + " byte sectors)");
+    journal_set("boot_part", partition_device(partitions, PartitionRole::Esp));
+    journal_set("root_part", partition_device(partitions, PartitionRole::Root));
+    journal_set("swap_part", partition_device(partitions, PartitionRole::Swap));
+    return true;
+}
+
+// Measures zstd on this CPU against this disk when the level is left to
+// the installer (or compared on request); a resumed run keeps the level
+// the data was written with
+bool Installer::choose_compression(std::string&) {
+    const SubvolumeSpec* root = root_subvolume(config.subvolumes);
+    bool zstd_root = root->compression == "zstd";
+    // A level on the / entry is the filesystem's level; other algorithms
+    // have nothing to tune
+    compression_level = root->level > 0 ? root->level : config.compression_level;
+    std::string saved = journal_get("compression_level");
+    if (!saved.empty()) {
+        compression_level = std::stoi(saved);
+    } else if (zstd_root && config.image.empty()) {
+        std::vector<std::string> sample_dirs = cache_dirs;
+        sample_dirs.push_back(config.offline_repo.empty() ? downloads().cache_dir() : config.offline_repo);
+        compression_level = select_compression_level(compression_level, config.compare_compression,
+                                                     journal_get("root_part"), sample_dirs);
+    }
+    journal_set("compression_level", std::to_string(compression_level));
+
+    // Fast install writes at zstd:1 now; fstab still gets the chosen level
+    // and the first-boot service rewrites the data at it
+    mount_level = (config.fast_install && zstd_root && compression_level > FAST_INSTALL_LEVEL) ? FAST_INSTALL_LEVEL
+                                                                                                : compression_level;
+    return true;
+}
+
+bool Installer::format_esp(std::string& error) {
+    std::string boot_part = journal_get("boot_part");
+    if (config.boot_fs_type == "fat32") {
+        return command(InstallStage::Format, {"mkfs.vfat", "-F32", boot_part}, error);
+    }
+    return command(InstallStage::Format, {"mkfs.ext4", boot_part}, error);
+}
+
+bool Installer::format_root(std::string& error) {
+    std::string root_part = journal_get("root_part");
+    if (!command(InstallStage::Format, mkfs_btrfs_args(tuning, root_part), error)) return false;
+    journal_set("root_uuid", capture_process({"blkid", "-s", "UUID", "-o", "value", root_part}, true));
+    return true;
+}
+
+bool Installer::format_swap(std::string& error) {
+    return command(InstallStage::Format, {"mkswap", journal_get("swap_part")}, error);
+}
+
+// With mount(2) and the subvolume ioctl, on the top level of the new filesystem
+bool Installer::create_subvolumes(std::string& error) {
+    MountTree top_level;
+    if (!top_level.mount(journal_get("root_part"), options.target_root, "btrfs")) {
+        error = top_level.error();
+        return false;
+    }
+    if (!create_subvolume_layout(options.target_root, config.subvolumes, error)) {
+        top_level.rollback();
+        return false;
+    }
+    if (!top_level.unmount(options.target_root)) {
+        error = top_level.error();
+        top_level.rollback();
+        return false;
+    }
+    return true;
+}
+
+// Remounts every subvolume with compression, then the ESP
+bool Installer::mount_target(std::string& error) {
+    int64_t started = monotonic_ns();
+    std::string root_part = journal_get("root_part");
+    std::string fs_options = filesystem_options(config.subvolumes, mount_level, tuning.mount_options);
+    for (const SubvolumeSpec& spec : mount_order(config.subvolumes)) {
+        if (!mounts.mount(root_part, target(spec.mount_point), "btrfs", subvolume_mount_options(spec, fs_options))) {
+            error = mounts.error();
+            mounts.rollback();
+            return false;
+        }
+    }
+    if (!mounts.mount(journal_get("boot_part"), target("/boot/efi"), config.boot_fs_type == "fat32" ? "vfat" : "ext4")) {
+        error = mounts.error();
+        mounts.rollback();
+        return false;
+    }
+    core_log("Btrfs subvolumes mounted in " + std::to_string((monotonic_ns() - started) / 1000000) + "ms");
+    return true;
+}
+
+// Base system, desktop, apps and gaming meta in one transaction, so
+// dependencies are resolved, downloaded and hooked only once. After a
+// failure pacstrap --needed only fetches and installs what is still
+// missing. No -i: other steps share the terminal, nothing can answer a
+// prompt.
+//
+// pacman downloads into the first cache directory. A shared prefetch cache
+// is only read from: whatever it lacks goes into the target's own cache, so
+// installs running side by side never download into the same directory.
+bool Installer::install_packages(std::string& error) {
+    std::vector<std::string> dirs = cache_dirs;
+    if (prefetched || fs::exists(downloads().cache_dir())) {
+        dirs.insert(dirs.begin(), downloads().cache_dir());
+    }
+    if (options.shared_prefetch) {
+        std::error_code ignored;
+        fs::create_directories(target(HOST_PACKAGE_CACHE), ignored);
+        dirs.insert(dirs.begin(), target(HOST_PACKAGE_CACHE));
+    }
+    // As a cache directory too, so packages are read where they are rather
+    // than copied into a cache first
+    if (!config.offline_repo.empty() && options.offline_server.empty()) dirs.insert(dirs.begin(), config.offline_repo);
+    std::vector<std::string> pacstrap = {"pacstrap", "-C", pacman_conf, options.target_root};
+    std::vector<std::string> packages = full_package_set(config);
+    pacstrap.insert(pacstrap.end(), packages.begin(), packages.end());
+    pacstrap.push_back("--needed");
+    pacstrap.push_back("--disable-download-timeout");
+    for (const std::string& arg : cachedir_args(dirs)) {
+        pacstrap.push_back(arg);
+    }
+    // Named explicitly so the masks below apply whatever HookDir the
+    // install pacman.conf has
+    pacstrap.push_back("--hookdir");
+    pacstrap.push_back(target(PACMAN_HOOK_DIR));
+
+    if (config.offline_repo.empty()) {
+        seed_sync_databases(fs::exists(downloads().sync_dir()) ? downloads().sync_dir() : HOST_SYNC_DIR,
+                            target("/var/lib/pacman/sync"));
+    }
+    // In place before pacstrap so the pacman package's default lands as .pacnew
+    std::error_code copy_error;
+    fs::create_directories(target("/etc"), copy_error);
+    fs::copy_file(target_pacman_conf, target("/etc/pacman.conf"), fs::copy_options::overwrite_existing, copy_error);
+    if (copy_error) {
+        error = "Could not copy " + target_pacman_conf + ": " + copy_error.message();
+        return false;
+    }
+    // The kernel, every generator and firmware update would each rebuild
+    // the initramfs; the chroot script builds it once instead
+    std::error_code mask_error;
+    fs::create_directories(target(PACMAN_HOOK_DIR), mask_error);
+    for (const std::string& hook : regeneration_hooks()) {
+        std::string path = target(PACMAN_HOOK_DIR) + "/" + hook;
+        fs::remove(path, mask_error);
+        fs::create_symlink("/dev/null", path, mask_error);
+        if (mask_error) {
+            error = "Could not mask " + path + ": " + mask_error.message();
+            return false;
+        }
+    }
+    if (!command(InstallStage::Packages, pacstrap, error)) return false;
+    install_ranked_mirrorlists(ranked_mirrors, target("/etc/pacman.d"));
+    return true;
+}
+
+bool Installer::write_fstab(std::string& error) {
+    std::string path = target("/etc/fstab");
+    std::error_code ignored;
+    fs::create_directories(target("/etc"), ignored);
+
+    // Replace whatever an interrupted run appended
+    std::stringstream existing;
+    existing << std::ifstream(path).rdbuf();
+    std::string fstab_text = existing.str();
+    size_t ours = fstab_text.find("\n# Btrfs subvolumes\n");
+    if (ours != std::string::npos) fstab_text.erase(ours);
+
+    std::ofstream fstab(path, std::ios::trunc);
+    fstab << fstab_text << "\n# Btrfs subvolumes\n"
+          << fstab_entries(config.subvolumes, journal_get("root_uuid"),
+                           filesystem_options(config.subvolumes, compression_level, tuning.mount_options));
+    std::string swap_part = journal_get("swap_part");
+    if (!swap_part.empty()) {
+        fstab << "UUID=" << capture_process({"blkid", "-s", "UUID", "-o", "value", swap_part}, true)
+              << " none swap defaults 0 0\n";
+    }
+    fstab.close();
+    if (!fstab) {
+        error = "Could not write " + path;
+        return false;
+    }
+
+    if (mount_level != compression_level) {
+        std::string service_error;
+        if (install_recompress_service(options.target_root, compression_level, zstd_mount_points(config.subvolumes),
+                                       service_error)) {
+            core_log("Enabled " + std::string(RECOMPRESS_SERVICE) + " to recompress at zstd:" +
+                     std::to_string(compression_level) + " after first boot");
+        } else {
+            core_log("Warning: " + service_error + "; data stays at zstd:" + std::to_string(mount_level));
+        }
+    }
+    return true;
+}
+
+bool Installer::write_locale(std::string& error) {
+    std::string path = target("/etc/locale.conf");
+    std::error_code ignored;
+    fs::create_directories(target("/etc"), ignored);
+    std::ofstream locale_conf(path);
+    const std::string& locale = config.locale_lang;
+    locale_conf << "LANG=" << locale << "\n"
+                << "LC_ADDRESS=" << locale << "\n"
+                << "LC_IDENTIFICATION=" << locale << "\n"
+                << "LC_MEASUREMENT=" << locale << "\n"
+                << "LC_MONETARY=" << locale << "\n"
+                << "LC_NAME=" << locale << "\n"
+                << "LC_NUMERIC=" << locale << "\n"
+                << "LC_PAPER=" << locale << "\n"
+                << "LC_TELEPHONE=" << locale << "\n"
+                << "LC_TIME=" << locale << "\n";
+    locale_conf.close();
+    if (!locale_conf) {
+        error = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+// Hostname and users are set up with argv calls, so names and passwords
+// never pass through a shell. useradd and chpasswd work on the target with
+// -R instead of arch-chroot, so this can run beside the chroot script.
+bool Installer::create_users(std::string& error) {
+    std::ofstream hostname_file(target("/etc/hostname"));
+    hostname_file << config.hostname << "\n";
+    hostname_file.close();
+
+    auto has_user = [this](const std::string& name) {
+        std::ifstream passwd(target("/etc/passwd"));
+        std::string line;
+        while (std::getline(passwd, line)) {
+            if (line.rfind(name + ":", 0) == 0) return true;
+        }
+        return false;
+    };
+    // An image's own user makes way for this host's
+    if (!image_user.empty() && image_user != config.user_name && has_user(image_user) &&
+        !command(InstallStage::Users, {"userdel", "-R", options.target_root, "-r", image_user}, error)) {
+        return false;
+    }
+    bool exists = has_user(config.user_name);
+    if (!exists && !command(InstallStage::Users, {"useradd", "-R", options.target_root, "-m", "-G",
+                                                  "wheel,audio,video,storage,optical", "-s", "/bin/bash",
+                                                  config.user_name}, error)) {
+        return false;
+    }
+    return command(InstallStage::Users, {"chpasswd", "-R", options.target_root}, error,
+                   "root:" + config.root_password + "\n" + config.user_name + ":" + config.user_password + "\n");
+}
+
+// Always rewritten: it removes itself after a successful run
+bool Installer::write_chroot_script(std::string& error) {
+    std::string path = target(CHROOT_SCRIPT);
+    std::ofstream script(path);
+    std::string root_uuid = journal_get("root_uuid");
+    script << (config.image.empty() ? chroot_script(config, root_uuid) : image_chroot_script(config, root_uuid));
+    script.close();
+    std::error_code permissions_error;
+    fs::permissions(path, fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec,
+                    fs::perm_options::add, permissions_error);
+    if (!script || permissions_error) {
+        error = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+bool Installer::run_chroot(std::string& error) {
+    return command(InstallStage::Chroot, {"arch-chroot", options.target_root, CHROOT_SCRIPT}, error);
+}
+
+// btrfs receive into the top level of the new filesystem, mounted with the
+// image's compression so the data is written the way fstab mounts it
+bool Installer::receive_image(std::string& error) {
+    const std::string received = ".image-receive";
+    MountTree top_level;
+    if (!top_level.mount(journal_get("root_part"), options.target_root, "btrfs",
+                         filesystem_options(config.subvolumes, mount_level, tuning.mount_options))) {
+        error = top_level.error();
+        return false;
+    }
+    // A stream interrupted half way leaves subvolumes receive will not overwrite
+    std::vector<std::string> partial;
+    for (size_t i = 0; i < config.subvolumes.size(); ++i) {
+        partial.push_back(options.target_root + "/" + received + "/" + image_snapshot_name(i));
+    }
+    delete_snapshots(partial, options.target_root + "/" + received);
+
+    std::error_code ignored;
+    fs::create_directories(options.target_root + "/" + received, ignored);
+    if (!command(InstallStage::Subvolumes, {"btrfs", "receive", "-f", config.image, options.target_root + "/" + received},
+                 error) ||
+        !adopt_received_layout(options.target_root, config.subvolumes, received, error)) {
+        top_level.rollback();
+        return false;
+    }
+    if (!top_level.unmount(options.target_root)) {
+        error = top_level.error();
+        top_level.rollback();
+        return false;
+    }
+    return true;
+}
+
+// Read-only snapshots of the finished install, sent into one stream file
+// with the manifest beside it. machine-id is emptied first so every
+// machine made from the image gets its own.
+bool Installer::export_image(std::string& error) {
+    const std::string exported = ".image-export";
+    std::ofstream(target("/etc/machine-id"), std::ios::trunc).close();
+
+    std::string top = state("image-top");
+    MountTree top_level;
+    if (!top_level.mount(journal_get("root_part"), top, "btrfs")) {
+        error = top_level.error();
+        return false;
+    }
+    std::vector<std::string> snapshots;
+    bool ok = snapshot_layout(top, config.subvolumes, exported, snapshots, error);
+    if (ok) {
+        std::vector<std::string> send = {"btrfs", "send", "-f", config.image_build + ".part"};
+        send.insert(send.end(), snapshots.begin(), snapshots.end());
+        ok = command(InstallStage::Finalize, send, error);
+    }
+    if (ok) {
+        std::error_code rename_error;
+        fs::rename(config.image_build + ".part", config.image_build, rename_error);
+        if (rename_error) {
+            error = "Could not write " + config.image_build + ": " + rename_error.message();
+            ok = false;
+        }
+    }
+    if (ok) {
+        ImageManifest manifest;
+        manifest.subvolumes = config.subvolumes;
+        manifest.compression_level = compression_level;
+        manifest.kernel_type = config.kernel_type;
+        manifest.initramfs = config.initramfs;
+        manifest.bootloader = config.bootloader;
+        manifest.desktop_env = config.desktop_env;
+        manifest.locale_lang = config.locale_lang;
+        manifest.timezone = config.timezone;
+        manifest.user_name = config.user_name;
+        ok = write_image_manifest(image_manifest_path(config.image_build), manifest, error);
+    }
+    delete_snapshots(snapshots, top + "/" + exported);
+    top_level.rollback();
+    if (ok) core_log("Golden image written to " + config.image_build);
+    return ok;
+}
+
+bool Installer::finalize(std::string&) {
+    std::string umount_error;
+    if (!unmount_recursive(options.target_root, umount_error)) {
+        core_log("Warning: " + umount_error);
+    }
+    return true;
+}
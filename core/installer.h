@@ -0,0 +1,153 @@
+#pragma once
+
+#include "cache.h"
+#include "config.h"
+#include "cpu.h"
+#include "disk.h"
+#include "journal.h"
+#include "mirrors.h"
+#include "mount.h"
+#include "prefetch.h"
+#include "process.h"
+#include "progress.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "tuning.h"
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct InstallerOptions {
+    std::string staging_dir = DEFAULT_PREFETCH_DIR;   // prefetch cache, ranked mirrors
+    std::string state_dir;                            // journal, stage times, pacman.conf; empty: staging_dir
+    std::string mirror_bundle = DEFAULT_MIRROR_BUNDLE;
+    std::vector<std::string> cache_dirs;              // CACHE_DIRS from installer.conf
+    bool find_caches = true;                          // false: cache_dirs is the complete list
+    std::string target_root = "/mnt";
+    int workers = 4;
+    ResourceLimits limits;
+    std::string trace_file = TRACE_FILE;
+    std::string summary_file = TRACE_SUMMARY_FILE;
+    std::string log_prefix;                           // put before every message this install logs
+
+    // Set when several disks are installed at once (see batch.h). Not owned.
+    ResourcePool* shared_pool = nullptr;              // slots shared with the other installs, not limits
+    PackagePrefetcher* shared_prefetch = nullptr;     // started by the caller; waited on, not started
+    std::string ranked_mirrors;                       // already ranked, not ranked again
+    int parallel_downloads = 0;                       // pacman's ParallelDownloads; 0: measure, -1: keep
+
+    // Where pacstrap downloads config.offline_repo from instead of reading it
+    // in place, e.g. a benchmark's throttled stand-in (see bench.h). No
+    // mirror is contacted.
+    std::string offline_server;
+};
+
+// How the installer reaches its frontend. Everything except cancelled()
+// is called from the installer's worker threads; all members are optional.
+struct InstallerEvents {
+    std::function<void(const std::string& line)> output;            // one line of command output
+    std::function<void(const ProcessResult& result)> command_done;
+    std::function<void()> progress;                                   // fraction() or status() moved
+    std::function<void(const std::string& level)> cpu_level;          // the resolved CPU level
+    std::function<bool()> cancelled;                                  // polled between steps
+};
+
+// The installation both frontends run: the pipeline is a graph of steps
+// (wipe, partition, mkfs per partition, subvolumes, mounts, prefetch,
+// pacstrap, fstab, locale, users, chroot, ...) with their dependencies and
+// the resources they use, run on a small worker pool so independent work
+// overlaps: downloads with the disk preparation, the ESP and swap mkfs with
+// mkfs.btrfs, fstab, locale.conf and the chroot script with pacstrap.
+//
+// With config.image set, pacstrap and the chroot script are replaced by
+// receiving the golden image into the new filesystem and rewriting the
+// per-host state; with config.image_build set, the finished install is
+// exported as one.
+//
+// Steps of a stage are skipped when the journal has that stage done, and a
+// stage is recorded as done once all of its steps have finished. Progress
+// follows the earliest stage with unfinished steps. After the run, the
+// critical path is logged and the trace files are written.
+class Installer {
+public:
+    Installer(const InstallConfig& config, const InstallerOptions& options, const InstallerEvents& events);
+
+    // Blocks until the installation finishes, fails or is cancelled. On
+    // failure the target is unmounted and error says what went wrong.
+    bool run(std::string& error);
+
+    double fraction() const;
+    std::string status() const;
+    // Wall time of each stage of the last run(), in the order they started
+    std::vector<std::pair<std::string, double>> stage_seconds() const;
+
+private:
+    void build_steps();
+    void add_step(const std::string& name, InstallStage stage, bool journaled, std::vector<std::string> after,
+                  std::vector<Resource> resources, std::function<bool(std::string& error)> body);
+    std::string advance_progress();     // caller holds mutex; returns a stage to log
+    bool command(InstallStage stage, const std::vector<std::string>& argv, std::string& error,
+                 const std::string& input = "");
+    std::string journal_get(const std::string& key) const;
+    void journal_set(const std::string& key, const std::string& value);
+    std::string target(const std::string& path) const;
+    std::string state(const std::string& name) const;
+    PackagePrefetcher& downloads();
+
+    bool prepare_repos(std::string& error);
+    bool prepare_offline_repo(std::string& error);
+    bool check_offline_repo(std::string& error);
+    bool prefetch_packages(std::string& error);
+    bool wipe(std::string& error);
+    bool probe_disk(std::string& error);
+    bool partition(std::string& error);
+    bool choose_compression(std::string& error);
+    bool format_esp(std::string& error);
+    bool format_root(std::string& error);
+    bool format_swap(std::string& error);
+    bool create_subvolumes(std::string& error);
+    bool mount_target(std::string& error);
+    bool install_packages(std::string& error);
+    bool write_fstab(std::string& error);
+    bool write_locale(std::string& error);
+    bool create_users(std::string& error);
+    bool write_chroot_script(std::string& error);
+    bool run_chroot(std::string& error);
+    bool receive_image(std::string& error);
+    bool export_image(std::string& error);
+    bool finalize(std::string& error);
+
+    InstallConfig config;
+    InstallerOptions options;
+    InstallerEvents events;
+    StepGraph graph;
+
+    // Steps run concurrently. Nothing logs or calls an event while holding
+    // mutex: frontends take their own lock before asking for status().
+    mutable std::mutex mutex;               // progress and unfinished
+    InstallProgress progress;
+    bool progress_started = false;
+    std::vector<int> unfinished;            // steps per stage, for progress
+    mutable std::mutex journal_mutex;       // journal and journal_pending
+    InstallJournal journal;
+    std::vector<int> journal_pending;       // journaled steps per stage
+    InstallTrace trace;
+
+    // Written by one step and read by the steps that run after it
+    std::vector<PackageCache> caches;
+    std::vector<std::string> cache_dirs;
+    PackagePrefetcher prefetcher;
+    CpuLevel cpu_level = CpuLevel::Generic;
+    std::string target_pacman_conf;
+    std::string pacman_conf;
+    std::string ranked_mirrors;
+    bool prefetched = false;
+    DiskGeometry geometry;
+    BtrfsTuning tuning;
+    int compression_level = 0;
+    int mount_level = 0;
+    MountTree mounts;
+    std::string image_user;                 // the user a received image came with
+};
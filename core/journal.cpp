@@ -0,0 +1,173 @@
+#include "journal.h"
+#include "log.h"
+#include "process.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+// Stages that only touch the disk layout; the rest depend on system inputs
+static const InstallStage FIRST_SYSTEM_STAGE = InstallStage::Packages;
+
+static std::string fingerprint(const std::vector<std::string>& fields) {
+    std::string joined;
+    for (const std::string& field : fields) {
+        joined += field;
+        joined += '\x1f';
+    }
+    char buffer[24];
+    std::snprintf(buffer, sizeof(buffer), "%016zx", std::hash<std::string>{}(joined));
+    return buffer;
+}
+
+// Passwords are left out on purpose: the journal is a plain file
+static std::string disk_fingerprint(const InstallConfig& config) {
+    std::vector<std::string> fields = {config.target_disk, config.boot_fs_type,
+                                       std::to_string(config.esp_size_mib), std::to_string(config.swap_size_mib),
+                                       std::to_string(config.compression_level), config.fast_install ? "fast" : "",
+                                       config.image};
+    for (const SubvolumeSpec& spec : config.subvolumes) {
+        fields.push_back(format_subvolume_spec(spec));
+    }
+    return fingerprint(fields);
+}
+
+static std::string system_fingerprint(const InstallConfig& config) {
+    std::vector<std::string> fields = {config.hostname, config.timezone, config.keymap, config.user_name,
+                                       config.desktop_env, config.kernel_type, config.initramfs, config.bootloader,
+                                       config.locale_lang, config.cpu_level, config.install_gaming ? "gaming" : ""};
+    fields.insert(fields.end(), config.repos.begin(), config.repos.end());
+    fields.push_back("");
+    fields.insert(fields.end(), config.custom_packages.begin(), config.custom_packages.end());
+    return fingerprint(fields);
+}
+
+void InstallJournal::open(const std::string& journal_path, const InstallConfig& config) {
+    path = journal_path;
+    disk_inputs = disk_fingerprint(config);
+    system_inputs = system_fingerprint(config);
+    completed.clear();
+    values.clear();
+
+    std::ifstream file(path);
+    if (!file) return;
+    std::string saved_disk, saved_system;
+    std::set<std::string> saved_completed;
+    std::map<std::string, std::string> saved_values;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t equals = line.find('=');
+        if (line.empty() || line[0] == '#' || equals == std::string::npos) continue;
+        std::string key = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        if (key == "disk_inputs") saved_disk = value;
+        else if (key == "system_inputs") saved_system = value;
+        else if (key == "done") saved_completed.insert(value);
+        else saved_values[key] = value;
+    }
+
+    if (saved_disk != disk_inputs) {
+        core_log("Ignoring " + path + ": it was written for a different disk layout");
+        return;
+    }
+    completed = saved_completed;
+    values = saved_values;
+    if (saved_system != system_inputs) {
+        core_log("System settings changed since the last run; keeping the disk, redoing the rest");
+        for (int stage = static_cast<int>(FIRST_SYSTEM_STAGE); stage <= static_cast<int>(InstallStage::Finalize); ++stage) {
+            completed.erase(stage_name(static_cast<InstallStage>(stage)));
+        }
+    }
+}
+
+bool InstallJournal::done(InstallStage stage) const {
+    return stage != InstallStage::Mount && completed.count(stage_name(stage)) > 0;
+}
+
+void InstallJournal::complete(InstallStage stage) {
+    completed.insert(stage_name(stage));
+    if (!save()) core_log("Warning: could not write " + path);
+}
+
+void InstallJournal::set(const std::string& key, const std::string& value) {
+    values[key] = value;
+}
+
+std::string InstallJournal::get(const std::string& key) const {
+    auto it = values.find(key);
+    return it == values.end() ? "" : it->second;
+}
+
+InstallStage InstallJournal::resume_stage() const {
+    int stage = 0;
+    while (stage < static_cast<int>(InstallStage::Finalize) &&
+           completed.count(stage_name(static_cast<InstallStage>(stage)))) {
+        ++stage;
+    }
+    return static_cast<InstallStage>(stage);
+}
+
+static bool is_block_device(const std::string& device) {
+    struct stat info {};
+    return !device.empty() && stat(device.c_str(), &info) == 0 && S_ISBLK(info.st_mode);
+}
+
+bool InstallJournal::verify(std::string& error) const {
+    if (done(InstallStage::Partition)) {
+        for (const char* key : {"boot_part", "root_part", "swap_part"}) {
+            std::string device = get(key);
+            if (key == std::string("swap_part") && device.empty()) continue;
+            if (!is_block_device(device)) {
+                error = std::string(key) + " " + device + " is missing";
+                return false;
+            }
+        }
+    }
+    if (done(InstallStage::Format)) {
+        std::string root = get("root_part");
+        std::string type = capture_process({"blkid", "-s", "TYPE", "-o", "value", root});
+        std::string uuid = capture_process({"blkid", "-s", "UUID", "-o", "value", root});
+        if (type != "btrfs" || uuid != get("root_uuid")) {
+            error = root + " no longer holds the Btrfs filesystem " + get("root_uuid");
+            return false;
+        }
+        if (capture_process({"blkid", "-s", "TYPE", "-o", "value", get("boot_part")}).empty()) {
+            error = get("boot_part") + " has no filesystem";
+            return false;
+        }
+    }
+    return true;
+}
+
+void InstallJournal::discard() {
+    completed.clear();
+    values.clear();
+    std::error_code ignored;
+    fs::remove(path, ignored);
+}
+
+bool InstallJournal::save() const {
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream file(temp);
+        file << "# Written by the installer; delete to start from scratch\n"
+             << "disk_inputs=" << disk_inputs << "\n"
+             << "system_inputs=" << system_inputs << "\n";
+        for (const auto& [key, value] : values) {
+            file << key << "=" << value << "\n";
+        }
+        for (int stage = 0; stage <= static_cast<int>(InstallStage::Finalize); ++stage) {
+            std::string name = stage_name(static_cast<InstallStage>(stage));
+            if (completed.count(name)) file << "done=" << name << "\n";
+        }
+        file.flush();
+        if (!file) return false;
+    }
+    std::error_code error;
+    fs::rename(temp, path, error);
+    return !error;
+}
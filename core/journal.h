@@ -0,0 +1,51 @@
+#pragma once
+
+#include "config.h"
+#include "progress.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+// Records which install stages finished and the values later stages need
+// (partition nodes, filesystem UUID, chosen compression level), so a re-run
+// after a failure, typically a mirror dropping out during pacstrap or the
+// chroot's pacman, carries on from the first unfinished stage instead of
+// wiping the disk again.
+//
+// The journal is tied to the inputs that shaped the disk (disk, partition
+// sizes, subvolume layout, compression); if those changed it is ignored.
+// When only the system inputs changed (packages, desktop, bootloader, ...)
+// the disk work is kept and everything from package installation on is
+// redone. Mounting is never skipped: mounts do not survive a failed run.
+class InstallJournal {
+public:
+    void open(const std::string& path, const InstallConfig& config);
+
+    bool done(InstallStage stage) const;
+    // Saves at once, so a crash in the next stage still finds it
+    void complete(InstallStage stage);
+    void set(const std::string& key, const std::string& value);
+    std::string get(const std::string& key) const;
+
+    bool resuming() const { return !completed.empty(); }
+    InstallStage resume_stage() const;          // first stage not done
+
+    // Checks that the recorded partitions still exist and the root
+    // filesystem is the one this journal formatted
+    bool verify(std::string& error) const;
+
+    // Forgets everything; called once an installation completes
+    void discard();
+
+private:
+    bool save() const;
+
+    std::string path;
+    std::string disk_inputs;
+    std::string system_inputs;
+    std::set<std::string> completed;            // stage names
+    std::map<std::string, std::string> values;
+};
+
+inline constexpr const char* JOURNAL_FILE = "install-journal";
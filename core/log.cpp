@@ -0,0 +1,26 @@
+#include "log.h"
+
+#include <iostream>
+#include <mutex>
+
+static std::mutex log_mutex;
+static std::function<void(const std::string&)> log_sink;
+static thread_local std::string log_prefix;
+
+void set_log_sink(std::function<void(const std::string&)> sink) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log_sink = std::move(sink);
+}
+
+void set_log_prefix(const std::string& prefix) {
+    log_prefix = prefix;
+}
+
+void core_log(const std::string& message) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    if (log_sink) {
+        log_sink(log_prefix + message);
+    } else {
+        std::cerr << log_prefix << message << std::endl;
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+// Core code never prints directly; each frontend routes these messages into
+// its own log (terminal + installation_log.txt, or the Qt output console).
+void set_log_sink(std::function<void(const std::string&)> sink);
+void core_log(const std::string& message);
+
+// Messages logged from the calling thread start with prefix, so the lines of
+// several installs running at once can be told apart ("sdb: ..."). Empty
+// clears it.
+void set_log_prefix(const std::string& prefix);
@@ -0,0 +1,337 @@
+#include "mirrors.h"
+#include "log.h"
+#include "process.h"
+#include "repos.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// Size of a typical package, used to weigh latency against throughput
+static const double REFERENCE_PACKAGE_BYTES = 2.0 * 1024 * 1024;
+
+// How long each number of simultaneous downloads is measured
+static const double TUNE_SECONDS = 3.0;
+
+// Packages of this size range are fetched to measure simultaneous downloads
+static const uint64_t TUNE_MIN_PACKAGE_BYTES = 64 * 1024;
+static const uint64_t TUNE_MAX_PACKAGE_BYTES = 8 * 1024 * 1024;
+
+std::vector<MirrorList> bundled_mirrorlists() {
+    return {
+        {"mirrorlist", "core", "x86_64"},
+        {"cachyos-mirrorlist", "cachyos", "x86_64"},
+        {"cachyos-v3-mirrorlist", "cachyos-v3", "x86_64"},
+        {"cachyos-v4-mirrorlist", "cachyos-v4", "x86_64"},
+        {"chaotic-mirrorlist", "chaotic-aur", "x86_64"},
+    };
+}
+
+double MirrorProbe::score() const {
+    if (!ok || bytes_per_s <= 0) return 1e9;
+    return first_byte_s + REFERENCE_PACKAGE_BYTES / bytes_per_s;
+}
+
+static std::string trim(const std::string& value) {
+    size_t start = value.find_first_not_of(" \t");
+    size_t end = value.find_last_not_of(" \t\r");
+    return start == std::string::npos ? "" : value.substr(start, end - start + 1);
+}
+
+std::vector<std::string> parse_mirrorlist(const std::string& path) {
+    std::vector<std::string> servers;
+    std::vector<std::string> commented;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string text = trim(line);
+        bool is_comment = !text.empty() && text[0] == '#';
+        if (is_comment) text = trim(text.substr(1));
+        if (text.rfind("Server", 0) != 0) continue;
+        size_t eq = text.find('=');
+        if (eq == std::string::npos) continue;
+        std::string server = trim(text.substr(eq + 1));
+        std::vector<std::string>& list = is_comment ? commented : servers;
+        if (!server.empty() && std::find(list.begin(), list.end(), server) == list.end()) {
+            list.push_back(server);
+        }
+    }
+    // Stock mirrorlists ship with every server commented out
+    return servers.empty() ? commented : servers;
+}
+
+std::string expand_server(std::string server, const std::string& repo, const std::string& arch) {
+    // $arch_v3 before $arch, which is a prefix of it
+    for (const auto& [var, value] : {std::pair<std::string, std::string>{"$repo", repo},
+                                     {"$arch_v3", arch + "_v3"},
+                                     {"$arch_v4", arch + "_v4"},
+                                     {"$arch", arch}}) {
+        size_t pos;
+        while ((pos = server.find(var)) != std::string::npos) {
+            server.replace(pos, var.size(), value);
+        }
+    }
+    while (!server.empty() && server.back() == '/') server.pop_back();
+    return server;
+}
+
+static MirrorProbe probe_one(const std::string& server, const ProbeOptions& options) {
+    MirrorProbe probe;
+    probe.server = server;
+    std::string url = expand_server(server, options.repo, options.arch) + "/" + options.repo + ".db";
+    std::vector<std::string> cmd = {
+        "curl", "-s", "-L", "-o", "/dev/null",
+        "--connect-timeout", std::to_string(options.connect_timeout_s),
+        "--max-time", std::to_string(options.max_time_s),
+        "-w", "%{http_code} %{time_connect} %{time_starttransfer} %{size_download} %{speed_download}",
+        url,
+    };
+
+    std::istringstream result(capture_process(cmd));
+    double size = 0;
+    result >> probe.http_code >> probe.connect_s >> probe.first_byte_s >> size >> probe.bytes_per_s;
+    probe.ok = probe.http_code == 200 && size > 0;
+    return probe;
+}
+
+std::vector<MirrorProbe> probe_mirrors(const std::vector<std::string>& servers, const ProbeOptions& options) {
+    std::vector<MirrorProbe> results(servers.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < servers.size(); i = next++) {
+            results[i] = probe_one(servers[i], options);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    size_t workers = std::min<size_t>(std::max(1, options.concurrency), servers.size());
+    for (size_t i = 0; i < workers; ++i) pool.emplace_back(worker);
+    for (std::thread& t : pool) t.join();
+
+    std::stable_sort(results.begin(), results.end(), [](const MirrorProbe& a, const MirrorProbe& b) {
+        return a.score() < b.score();
+    });
+    return results;
+}
+
+bool write_ranked_mirrorlist(const std::string& path, const std::vector<MirrorProbe>& ranked) {
+    std::ofstream file(path);
+    if (!file.is_open()) return false;
+    file << "# Ranked by the CachyOS Btrfs Installer\n"
+         << "# score = time to first byte + time for a 2MiB package at the measured rate\n\n";
+    file << std::fixed << std::setprecision(3);
+    for (const MirrorProbe& probe : ranked) {
+        if (probe.ok) {
+            file << "# score " << probe.score() << "s, connect " << probe.connect_s << "s, first byte "
+                 << probe.first_byte_s << "s, " << static_cast<long>(probe.bytes_per_s / 1024) << " KiB/s\n"
+                 << "Server = " << probe.server << "\n";
+        }
+    }
+    for (const MirrorProbe& probe : ranked) {
+        if (!probe.ok) {
+            file << "# unreachable (HTTP " << probe.http_code << ")\n"
+                 << "#Server = " << probe.server << "\n";
+        }
+    }
+    return true;
+}
+
+std::string extract_bundled_mirrors(const std::string& bundle, const std::string& work_dir) {
+    std::error_code ec;
+    if (!fs::exists(bundle, ec)) {
+        core_log("Mirror bundle " + bundle + " not found, keeping the live system's mirror order");
+        return "";
+    }
+    if (run_quietly({"mkdir", "-p", work_dir}) != 0 ||
+        run_quietly({"tar", "xzf", bundle, "-C", work_dir, "pacman.d"}) != 0) {
+        core_log("Could not extract " + bundle + ", keeping the live system's mirror order");
+        return "";
+    }
+    return work_dir + "/pacman.d";
+}
+
+std::string rank_bundled_mirrors(const std::string& bundle, const std::string& work_dir) {
+    std::string ranked_dir = work_dir + "/ranked";
+    if (extract_bundled_mirrors(bundle, work_dir).empty() || run_quietly({"mkdir", "-p", ranked_dir}) != 0) {
+        return "";
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<MirrorList> lists = bundled_mirrorlists();
+    std::vector<std::vector<MirrorProbe>> rankings(lists.size());
+    std::vector<std::thread> rankers;
+    for (size_t i = 0; i < lists.size(); ++i) {
+        rankers.emplace_back([&, i]() {
+            std::vector<std::string> servers = parse_mirrorlist(work_dir + "/pacman.d/" + lists[i].file);
+            ProbeOptions options;
+            options.repo = lists[i].repo;
+            options.arch = lists[i].arch;
+            rankings[i] = probe_mirrors(servers, options);
+        });
+    }
+    for (std::thread& t : rankers) t.join();
+
+    for (size_t i = 0; i < lists.size(); ++i) {
+        if (rankings[i].empty() || !rankings[i].front().ok) {
+            core_log("No reachable mirrors in " + lists[i].file + ", leaving it unranked");
+            run_quietly({"cp", work_dir + "/pacman.d/" + lists[i].file, ranked_dir + "/"});
+            continue;
+        }
+        write_ranked_mirrorlist(ranked_dir + "/" + lists[i].file, rankings[i]);
+        std::ostringstream best;
+        best << std::fixed << std::setprecision(2) << rankings[i].front().score();
+        core_log("Fastest mirror for " + lists[i].repo + ": " + rankings[i].front().server + " (" + best.str() + "s)");
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    core_log("Mirror ranking took " + std::to_string(elapsed.count()) + "ms");
+    return ranked_dir;
+}
+
+bool write_install_pacman_conf(const std::string& host_conf, const std::string& ranked_dir, const std::string& out_path) {
+    std::ifstream in(host_conf);
+    std::ofstream out(out_path);
+    if (!in.is_open() || !out.is_open()) return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string text = trim(line);
+        if (text.rfind("Include", 0) == 0 && text.find('=') != std::string::npos) {
+            std::string included = trim(text.substr(text.find('=') + 1));
+            std::string ranked = ranked_dir + "/" + fs::path(included).filename().string();
+            std::error_code ec;
+            if (included.rfind("/etc/pacman.d/", 0) == 0 && fs::exists(ranked, ec)) {
+                out << "Include = " << ranked << "\n";
+                continue;
+            }
+        }
+        out << line << "\n";
+    }
+    return true;
+}
+
+void install_ranked_mirrorlists(const std::string& ranked_dir, const std::string& target_pacman_d) {
+    std::error_code ec;
+    if (ranked_dir.empty() || !fs::is_directory(ranked_dir, ec)) return;
+    std::vector<std::string> cmd = {"cp"};
+    for (const auto& entry : fs::directory_iterator(ranked_dir, ec)) cmd.push_back(entry.path().string());
+    if (cmd.size() == 1) return;
+    cmd.push_back(target_pacman_d + "/");
+    if (run_quietly({"mkdir", "-p", target_pacman_d}) == 0) run_quietly(cmd);
+}
+
+// Package file names in a sync database, from the %FILENAME% and %CSIZE%
+// entries of every desc file, limited to typical package sizes
+static std::vector<std::string> package_files(const std::string& db) {
+    ProcessOptions options;
+    options.stdin_mode = StdinMode::Null;
+    options.capture = true;
+    options.elevate = false;
+    std::istringstream descs(run_process({"tar", "-xOf", db, "--wildcards", "*/desc"}, options).stdout_text);
+    std::vector<std::string> files;
+    std::string line, section, filename;
+    while (std::getline(descs, line)) {
+        if (line.size() > 2 && line.front() == '%' && line.back() == '%') {
+            section = line;
+        } else if (section == "%FILENAME%" && !line.empty()) {
+            filename = line;
+        } else if (section == "%CSIZE%" && !line.empty()) {
+            uint64_t size = std::strtoull(line.c_str(), nullptr, 10);
+            if (!filename.empty() && size >= TUNE_MIN_PACKAGE_BYTES && size <= TUNE_MAX_PACKAGE_BYTES) {
+                files.push_back(filename);
+            }
+            filename.clear();
+        }
+    }
+    return files;
+}
+
+// Bytes per second while `transfers` workers fetch files one after the
+// other for TUNE_SECONDS, each file its own request as pacman makes them.
+// next_file carries on between calls, so each round asks for new files.
+static double download_rate(const std::string& base_url, const std::vector<std::string>& files, int transfers,
+                            std::atomic<size_t>& next_file) {
+    std::atomic<uint64_t> total{0};
+    int64_t started = monotonic_ns();
+    int64_t deadline = started + static_cast<int64_t>(TUNE_SECONDS * 1e9);
+    std::vector<std::thread> running;
+    for (int i = 0; i < transfers; ++i) {
+        running.emplace_back([&]() {
+            ProcessOptions options;
+            options.stdin_mode = StdinMode::Null;
+            options.capture = true;
+            options.elevate = false;
+            for (int64_t now = monotonic_ns(); now < deadline; now = monotonic_ns()) {
+                std::string url = base_url + "/" + files[next_file++ % files.size()];
+                // A transfer cut off by --max-time still reports what it got
+                std::string max_time = std::to_string(std::max(0.1, (deadline - now) / 1e9));
+                std::vector<std::string> cmd = {"curl", "-s", "-L", "-o", "/dev/null", "--connect-timeout", "2",
+                                                "--max-time", max_time, "-w", "%{size_download}", url};
+                total += static_cast<uint64_t>(std::atof(run_process(cmd, options).stdout_text.c_str()));
+            }
+        });
+    }
+    for (std::thread& t : running) t.join();
+    double seconds = (monotonic_ns() - started) / 1e9;
+    return seconds > 0 ? total / seconds : 0;
+}
+
+int tune_parallel_downloads(const std::string& ranked_dir) {
+    if (ranked_dir.empty()) return 0;
+    std::vector<std::string> servers = parse_mirrorlist(ranked_dir + "/mirrorlist");
+    if (servers.empty()) return 0;
+    std::string base_url = expand_server(servers.front(), "core", "x86_64");
+
+    // The file list comes from core's database on the same mirror. Kept
+    // beside the ranked directory, whose contents go to /etc/pacman.d.
+    std::string db = (fs::path(ranked_dir).parent_path() / "core.db").string();
+    std::vector<std::string> files;
+    if (run_quietly({"curl", "-s", "-f", "-L", "--connect-timeout", "2", "--max-time", "10", "-o", db,
+                     base_url + "/core.db"}) == 0) {
+        files = package_files(db);
+    }
+    if (files.empty()) {
+        core_log("Could not list packages on " + servers.front() + ", keeping ParallelDownloads");
+        return 0;
+    }
+
+    // Fewer than pacman's default, or than the live system already uses,
+    // is never an improvement worth writing
+    int floor = PACMAN_DEFAULT_PARALLEL_DOWNLOADS;
+    int configured = std::atoi(pacman_option("/etc/pacman.conf", "ParallelDownloads").c_str());
+    floor = std::clamp(std::max(floor, configured), 1, MAX_PARALLEL_DOWNLOADS);
+
+    core_log("Measuring simultaneous downloads of " + std::to_string(files.size()) + " packages from " +
+             servers.front());
+    std::atomic<size_t> next_file{0};
+    int best = 0;
+    double best_rate = 0;
+    for (int transfers = floor;; transfers = std::min(transfers * 2, MAX_PARALLEL_DOWNLOADS)) {
+        double rate = download_rate(base_url, files, transfers, next_file);
+        core_log("  " + std::to_string(transfers) + " at once: " + std::to_string(static_cast<long>(rate / 1024)) +
+                 " KiB/s");
+        if (best > 0 && rate <= best_rate * 1.1) break;
+        best = transfers;
+        best_rate = rate;
+        if (transfers == MAX_PARALLEL_DOWNLOADS) break;
+    }
+    if (best_rate == 0) return 0;
+    core_log("ParallelDownloads = " + std::to_string(best));
+    return best;
+}
+
+void install_live_download_settings(const std::string& ranked_dir, int parallel_downloads) {
+    if (parallel_downloads > 0 &&
+        !set_pacman_option("/etc/pacman.conf", "ParallelDownloads", std::to_string(parallel_downloads))) {
+        core_log("Warning: could not set ParallelDownloads in /etc/pacman.conf");
+    }
+    install_ranked_mirrorlists(ranked_dir, "/etc/pacman.d");
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+inline constexpr const char* DEFAULT_MIRROR_BUNDLE = "pacman-16-07-2025.tar.gz";
+
+// One mirrorlist from the bundled pacman.d, and the repo/arch used to fill in
+// $repo and $arch (and $arch_v3/$arch_v4, as <arch>_v3/<arch>_v4) when
+// probing its servers.
+struct MirrorList {
+    std::string file;
+    std::string repo;
+    std::string arch;
+};
+
+std::vector<MirrorList> bundled_mirrorlists();
+
+struct MirrorProbe {
+    std::string server;          // the Server = line as written, with $repo/$arch
+    bool ok = false;
+    int http_code = 0;
+    double connect_s = 0;
+    double first_byte_s = 0;
+    double bytes_per_s = 0;
+
+    // Estimated seconds to fetch a typical package from this mirror
+    double score() const;
+};
+
+struct ProbeOptions {
+    std::string repo;
+    std::string arch;
+    int concurrency = 16;
+    double connect_timeout_s = 2.0;
+    double max_time_s = 6.0;
+};
+
+std::vector<std::string> parse_mirrorlist(const std::string& path);
+
+// server with $repo, $arch_v3, $arch_v4 and $arch filled in, no trailing slash
+std::string expand_server(std::string server, const std::string& repo, const std::string& arch);
+
+// Fetches <server>/<repo>.db from every server, `concurrency` at a time, and
+// returns the results fastest first with failed mirrors at the end. Works
+// against any http(s) URL, including local stand-in servers.
+std::vector<MirrorProbe> probe_mirrors(const std::vector<std::string>& servers, const ProbeOptions& options);
+
+bool write_ranked_mirrorlist(const std::string& path, const std::vector<MirrorProbe>& ranked);
+
+// Extracts the bundled pacman.d into work_dir without probing anything.
+// Returns work_dir/pacman.d, or an empty string if the bundle is missing.
+std::string extract_bundled_mirrors(const std::string& bundle, const std::string& work_dir);
+
+// Extracts the bundled pacman.d into work_dir, ranks each mirrorlist and
+// writes the ranked copies to work_dir/ranked. Returns that directory, or an
+// empty string if the bundle is missing.
+std::string rank_bundled_mirrors(const std::string& bundle, const std::string& work_dir);
+
+// Writes a copy of host_conf whose Include lines point at the ranked lists,
+// for use with pacman --config / pacstrap -C.
+bool write_install_pacman_conf(const std::string& host_conf, const std::string& ranked_dir, const std::string& out_path);
+
+// Copies the ranked lists into the target's /etc/pacman.d.
+void install_ranked_mirrorlists(const std::string& ranked_dir, const std::string& target_pacman_d);
+
+inline constexpr int MAX_PARALLEL_DOWNLOADS = 32;
+inline constexpr int PACMAN_DEFAULT_PARALLEL_DOWNLOADS = 5;
+
+// A value for pacman's ParallelDownloads, measured: package-sized files
+// listed in core's database are fetched from the fastest mirror of
+// ranked_dir's Arch mirrorlist (the one pacman would download from), one
+// request per file, by n, 2n, 4n, ... transfers at once for a few seconds
+// each, for as long as the aggregate rate improves by at least 10%. n is
+// pacman's default of 5, or the live pacman.conf's value if that is higher;
+// nothing below it is returned. Returns 0 if the mirror does not answer.
+int tune_parallel_downloads(const std::string& ranked_dir);
+
+// The live system's pacman gets what the install uses: ParallelDownloads
+// (unless 0) in /etc/pacman.conf and the ranked lists in /etc/pacman.d.
+void install_live_download_settings(const std::string& ranked_dir, int parallel_downloads);
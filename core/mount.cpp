@@ -0,0 +1,120 @@
+#include "mount.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <sys/mount.h>
+
+namespace fs = std::filesystem;
+
+static void split_mount_options(const std::string& options, unsigned long& flags, std::string& data) {
+    static const std::pair<const char*, unsigned long> FLAG_OPTIONS[] = {
+        {"ro", MS_RDONLY},        {"noatime", MS_NOATIME},  {"nodiratime", MS_NODIRATIME},
+        {"relatime", MS_RELATIME}, {"strictatime", MS_STRICTATIME}, {"lazytime", MS_LAZYTIME},
+        {"nosuid", MS_NOSUID},    {"nodev", MS_NODEV},      {"noexec", MS_NOEXEC},
+        {"sync", MS_SYNCHRONOUS}, {"dirsync", MS_DIRSYNC},
+    };
+
+    flags = 0;
+    data.clear();
+    std::istringstream stream(options);
+    std::string option;
+    while (std::getline(stream, option, ',')) {
+        if (option.empty() || option == "rw" || option == "defaults") continue;
+        auto flag = std::find_if(std::begin(FLAG_OPTIONS), std::end(FLAG_OPTIONS),
+                                 [&](const auto& entry) { return option == entry.first; });
+        if (flag != std::end(FLAG_OPTIONS)) {
+            flags |= flag->second;
+        } else {
+            if (!data.empty()) data += ",";
+            data += option;
+        }
+    }
+}
+
+bool MountTree::mount(const std::string& source, const std::string& target,
+                      const std::string& fstype, const std::string& options) {
+    std::error_code ec;
+    fs::create_directories(target, ec);
+    if (ec) {
+        last_error = "mkdir " + target + ": " + ec.message();
+        return false;
+    }
+
+    unsigned long flags;
+    std::string data;
+    split_mount_options(options, flags, data);
+    if (::mount(source.c_str(), target.c_str(), fstype.c_str(), flags, data.empty() ? nullptr : data.c_str()) != 0) {
+        last_error = "mount " + source + " on " + target + (options.empty() ? "" : " (" + options + ")") +
+                     ": " + std::strerror(errno);
+        return false;
+    }
+    mounted.push_back(target);
+    return true;
+}
+
+bool MountTree::unmount(const std::string& target) {
+    if (umount2(target.c_str(), 0) != 0) {
+        last_error = "umount " + target + ": " + std::strerror(errno);
+        return false;
+    }
+    mounted.erase(std::remove(mounted.begin(), mounted.end(), target), mounted.end());
+    return true;
+}
+
+void MountTree::rollback() {
+    while (!mounted.empty()) {
+        std::string target = mounted.back();
+        mounted.pop_back();
+        if (umount2(target.c_str(), 0) != 0) {
+            core_log("Rollback: umount " + target + ": " + std::strerror(errno));
+        }
+    }
+}
+
+// mountinfo escapes space, tab, newline and backslash as \ooo
+static std::string unescape_mountinfo(const std::string& field) {
+    std::string out;
+    for (size_t i = 0; i < field.size(); ++i) {
+        if (field[i] == '\\' && i + 3 < field.size()) {
+            out += static_cast<char>(std::stoi(field.substr(i + 1, 3), nullptr, 8));
+            i += 3;
+        } else {
+            out += field[i];
+        }
+    }
+    return out;
+}
+
+std::vector<std::string> mounts_below(const std::string& root) {
+    std::vector<std::string> mounts;
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        std::istringstream fields(line);
+        std::string id, parent, dev, fs_root, mount_point;
+        fields >> id >> parent >> dev >> fs_root >> mount_point;
+        mount_point = unescape_mountinfo(mount_point);
+        if (mount_point == root || mount_point.rfind(root + "/", 0) == 0) {
+            mounts.push_back(mount_point);
+        }
+    }
+    return mounts;
+}
+
+bool unmount_recursive(const std::string& root, std::string& error) {
+    std::vector<std::string> mounts = mounts_below(root);
+    bool ok = true;
+    // Reverse mount order unmounts children before the filesystems they sit on
+    for (auto it = mounts.rbegin(); it != mounts.rend(); ++it) {
+        if (umount2(it->c_str(), 0) != 0 && errno != EINVAL) {
+            if (ok) error = "umount " + *it + ": " + std::strerror(errno);
+            ok = false;
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Mounts with mount(2) instead of spawning mount(8). Every mount made through
+// a MountTree is remembered, so a failed setup can be unwound newest-first
+// and no half-mounted tree is left under the target.
+class MountTree {
+public:
+    // Creates target (and parents) if needed. options is an fstab-style
+    // list: generic flags (ro, noatime, nodev, ...) become MS_* flags, the
+    // rest is passed to the filesystem (subvol=@, compress=zstd:3, ...).
+    bool mount(const std::string& source, const std::string& target,
+               const std::string& fstype, const std::string& options = "");
+
+    // Unmounts one target mounted by this tree.
+    bool unmount(const std::string& target);
+
+    // Unmounts everything this tree mounted, in reverse order. Failures are
+    // logged and the remaining mounts are still attempted.
+    void rollback();
+
+    const std::string& error() const { return last_error; }
+
+private:
+    std::vector<std::string> mounted;
+    std::string last_error;
+};
+
+// Mount points at or below root from /proc/self/mountinfo, in mount order.
+std::vector<std::string> mounts_below(const std::string& root);
+
+// umount -R: unmounts root and everything below it, deepest first.
+bool unmount_recursive(const std::string& root, std::string& error);
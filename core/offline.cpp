@@ -0,0 +1,245 @@
+#include "offline.h"
+#include "cache.h"
+#include "log.h"
+#include "mirrors.h"
+#include "packages.h"
+#include "process.h"
+#include "repos.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static bool is_package_file(const std::string& name) {
+    return name.find(".pkg.tar.") != std::string::npos && name.size() > 4 && name.substr(name.size() - 4) != ".sig";
+}
+
+// Runs a pacman or repo-add call with its output appended to log
+static bool run_logged(const std::vector<std::string>& argv, std::ofstream& log, std::string& error,
+                       std::string* output = nullptr) {
+    ProcessOptions options;
+    options.stdin_mode = StdinMode::Null;
+    options.on_line = [&log, output](const std::string& line, bool is_stderr) {
+        log << line << "\n";
+        if (output && !is_stderr) *output += line + "\n";
+    };
+    log << "$ " << format_argv(argv) << "\n";
+    ProcessResult result = run_process(argv, options);
+    if (!result.spawned) {
+        error = "Error executing: " + format_argv(result.argv) + " (" + result.spawn_error + ")";
+        return false;
+    }
+    if (result.exit_code != 0) {
+        error = format_argv(result.argv) + " failed with exit code " + std::to_string(result.exit_code);
+        return false;
+    }
+    return true;
+}
+
+bool build_local_repo(const std::vector<std::string>& packages, const std::string& pacman_conf,
+                      const std::vector<std::string>& cache_dirs, const std::string& repo_dir, std::string& error) {
+    std::string work = repo_dir + "/.build";
+    std::error_code ec;
+    fs::remove_all(work, ec);
+    fs::create_directories(work + "/db", ec);
+    if (ec) {
+        error = "mkdir " + work + ": " + ec.message();
+        return false;
+    }
+    std::ofstream log(repo_dir + "/build.log", std::ios::trunc);
+    std::vector<std::string> pacman = {"pacman", "--noconfirm", "--config", pacman_conf, "--dbpath", work + "/db"};
+
+    // The closure against an empty database, as pacstrap would install it
+    core_log("Resolving " + std::to_string(packages.size()) + " packages for " + repo_dir);
+    seed_sync_databases(HOST_SYNC_DIR, work + "/db/sync");
+    std::vector<std::string> sync = pacman;
+    sync.push_back("-Sy");
+    std::vector<std::string> resolve = pacman;
+    resolve.insert(resolve.end(), {"-Sp", "--print-format", "%f"});
+    resolve.insert(resolve.end(), packages.begin(), packages.end());
+    std::string listed;
+    if (!run_logged(sync, log, error) || !run_logged(resolve, log, error, &listed)) return false;
+    std::vector<std::string> files;
+    std::istringstream lines(listed);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (is_package_file(line)) files.push_back(line);
+    }
+    std::sort(files.begin(), files.end());
+    if (files.empty()) {
+        error = "pacman resolved no packages for " + repo_dir;
+        return false;
+    }
+
+    // Downloads land in the repo (the first cache directory); what the
+    // other caches already have is copied in below
+    std::vector<std::string> download = pacman;
+    download.push_back("-Sw");
+    for (const std::string& arg : cachedir_args({repo_dir})) download.push_back(arg);
+    for (const std::string& arg : cachedir_args(cache_dirs)) download.push_back(arg);
+    download.insert(download.end(), packages.begin(), packages.end());
+    core_log("Fetching " + std::to_string(files.size()) + " package files (output in " + repo_dir + "/build.log)");
+    if (!run_logged(download, log, error)) return false;
+    for (const std::string& file : files) {
+        if (fs::exists(repo_dir + "/" + file)) continue;
+        bool copied = false;
+        for (const std::string& dir : cache_dirs) {
+            if (!fs::exists(dir + "/" + file)) continue;
+            fs::copy_file(dir + "/" + file, repo_dir + "/" + file, fs::copy_options::overwrite_existing, ec);
+            if (!ec && fs::exists(dir + "/" + file + ".sig")) {
+                fs::copy_file(dir + "/" + file + ".sig", repo_dir + "/" + file + ".sig",
+                              fs::copy_options::overwrite_existing, ec);
+            }
+            copied = !ec;
+            break;
+        }
+        if (!copied) {
+            error = file + " is in neither " + repo_dir + " nor the package caches";
+            return false;
+        }
+    }
+
+    // Exactly the listed files: no leftovers from an earlier build, a fresh database
+    std::set<std::string> wanted(files.begin(), files.end());
+    for (const auto& entry : fs::directory_iterator(repo_dir, ec)) {
+        std::string name = entry.path().filename().string();
+        std::string package = name.size() > 4 && name.substr(name.size() - 4) == ".sig" ? name.substr(0, name.size() - 4)
+                                                                                         : name;
+        bool old_package = is_package_file(package) && !wanted.count(package);
+        bool old_database = name.rfind(std::string(OFFLINE_REPO_NAME) + ".", 0) == 0;
+        if (old_package || old_database) fs::remove(entry.path(), ec);
+    }
+    std::vector<std::string> repo_add = {"repo-add", "-q", "--include-sigs",
+                                         repo_dir + "/" + OFFLINE_REPO_NAME + ".db.tar.zst"};
+    for (const std::string& file : files) repo_add.push_back(repo_dir + "/" + file);
+    if (!run_logged(repo_add, log, error)) return false;
+
+    std::ofstream list(repo_dir + "/" + OFFLINE_PACKAGE_LIST, std::ios::trunc);
+    for (const std::string& file : files) list << file << "\n";
+    list.close();
+    fs::remove_all(work, ec);
+    if (!list) {
+        error = "Could not write " + repo_dir + "/" + OFFLINE_PACKAGE_LIST;
+        return false;
+    }
+    core_log("Local repository " + repo_dir + " holds " + std::to_string(files.size()) + " packages");
+    return true;
+}
+
+bool build_install_repo(const InstallConfig& config, const std::string& staging_dir, const std::string& mirror_bundle,
+                        const std::vector<std::string>& cache_dirs, const std::string& repo_dir, std::string& error) {
+    std::string work = staging_dir + "/offline";
+    std::error_code ec;
+    fs::create_directories(work, ec);
+    fs::create_directories(repo_dir, ec);
+    if (ec) {
+        error = "mkdir " + repo_dir + ": " + ec.message();
+        return false;
+    }
+    InstallConfig resolved = config;
+    CpuLevel level = resolve_cpu_level(config.cpu_level);
+    resolved.cpu_level = cpu_level_name(level);
+
+    std::string pacman_conf = work + "/pacman.target.conf";
+    if (!write_target_pacman_conf("/etc/pacman.conf", level, config.repos, pacman_conf)) {
+        error = "Could not write " + pacman_conf;
+        return false;
+    }
+    std::string ranked = rank_bundled_mirrors(mirror_bundle, work + "/mirrors");
+    if (!ranked.empty() && write_install_pacman_conf(pacman_conf, ranked, work + "/pacman.conf")) {
+        pacman_conf = work + "/pacman.conf";
+    }
+
+    std::vector<PackageCache> caches = find_package_caches({}, cache_dirs);
+    std::vector<std::string> cache_paths;
+    for (const PackageCache& cache : caches) {
+        // The repository itself is the download directory
+        if (fs::weakly_canonical(cache.path, ec) != fs::weakly_canonical(repo_dir, ec)) cache_paths.push_back(cache.path);
+    }
+    bool ok = build_local_repo(full_package_set(resolved), pacman_conf, cache_paths, repo_dir, error);
+    release_package_caches(caches);
+    return ok;
+}
+
+std::string offline_repo_url(const std::string& repo_dir) {
+    return "file://" + fs::absolute(repo_dir).string();
+}
+
+bool write_offline_pacman_conf(const std::string& options_source, CpuLevel level, const std::string& server,
+                               const std::string& out_path) {
+    std::string options = pacman_options_section(options_source, level);
+    std::ofstream out(out_path);
+    if (options.empty() || !out.is_open()) return false;
+    out << options << "\n# Local repository, no mirrors needed\n"
+        << "[" << OFFLINE_REPO_NAME << "]\n"
+        << "SigLevel = Optional TrustedOnly\n"
+        << "Server = " << server << "\n";
+    out.close();
+    return static_cast<bool>(out);
+}
+
+// name-1:2.3-4-x86_64.pkg.tar.zst -> name, 1:2.3-4
+static bool split_package_file(const std::string& file, std::string& name, std::string& version) {
+    std::string base = file.substr(0, file.find(".pkg.tar."));
+    size_t arch = base.rfind('-');
+    if (arch == std::string::npos) return false;
+    size_t rel = base.rfind('-', arch - 1);
+    if (rel == std::string::npos || rel == 0) return false;
+    size_t ver = base.rfind('-', rel - 1);
+    if (ver == std::string::npos) return false;
+    name = base.substr(0, ver);
+    version = base.substr(ver + 1, arch - ver - 1);
+    return true;
+}
+
+bool check_local_repo_freshness(const std::string& repo_dir, const std::string& pacman_conf,
+                                std::vector<StalePackage>& stale, std::string& error) {
+    stale.clear();
+    std::ifstream list(repo_dir + "/" + OFFLINE_PACKAGE_LIST);
+    if (!list) {
+        error = "Cannot read " + repo_dir + "/" + OFFLINE_PACKAGE_LIST;
+        return false;
+    }
+    std::map<std::string, std::string> local;
+    std::string line;
+    while (std::getline(list, line)) {
+        std::string name, version;
+        if (split_package_file(line, name, version)) local[name] = version;
+    }
+
+    std::string db = repo_dir + "/.freshness";
+    std::error_code ec;
+    fs::remove_all(db, ec);
+    fs::create_directories(db, ec);
+    std::ofstream log(repo_dir + "/freshness.log", std::ios::trunc);
+    std::string listed;
+    bool reachable = run_logged({"pacman", "--config", pacman_conf, "--dbpath", db, "-Sy"}, log, error) &&
+                     run_logged({"pacman", "--config", pacman_conf, "--dbpath", db, "-Sl"}, log, error, &listed);
+    fs::remove_all(db, ec);
+    if (!reachable) {
+        error = "no mirror reachable (" + error + ")";
+        return false;
+    }
+
+    // The first repo listing a package is the one pacman would use
+    std::map<std::string, std::string> mirror;
+    std::istringstream lines(listed);
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string repo, name, version;
+        if (fields >> repo >> name >> version) mirror.emplace(name, version);
+    }
+    for (const auto& [name, version] : local) {
+        auto it = mirror.find(name);
+        if (it == mirror.end() || it->second == version) continue;
+        if (capture_process({"vercmp", version, it->second}).rfind("-", 0) == 0) {
+            stale.push_back({name, version, it->second});
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "config.h"
+#include "cpu.h"
+
+#include <string>
+#include <vector>
+
+inline constexpr const char* OFFLINE_REPO_NAME = "offline";
+inline constexpr const char* OFFLINE_PACKAGE_LIST = "packages.list";
+
+// A self-contained pacman repository for air-gapped installs: the package
+// files of one install's full dependency closure plus an `offline` database
+// made with repo-add, in one directory that can sit on the install medium or
+// a second partition. packages.list names the exact files, so every install
+// from the same repo gets the same versions.
+//
+// Resolves packages against the repos of pacman_conf with a private, empty
+// database, downloads what cache_dirs do not already have and copies the
+// rest in. Files of earlier builds that are no longer needed are removed.
+// pacman's output goes to <repo_dir>/build.log.
+bool build_local_repo(const std::vector<std::string>& packages, const std::string& pacman_conf,
+                      const std::vector<std::string>& cache_dirs, const std::string& repo_dir, std::string& error);
+
+// build_local_repo() for the full package set of config, resolved against
+// the repos it selects for its CPU level ("auto": this machine's) through
+// the ranked bundled mirrorlists. Caches on the live system and media are
+// used, as for an install. Work files go to staging_dir/offline.
+bool build_install_repo(const InstallConfig& config, const std::string& staging_dir, const std::string& mirror_bundle,
+                        const std::vector<std::string>& cache_dirs, const std::string& repo_dir, std::string& error);
+
+// file:// URL of repo_dir, for write_offline_pacman_conf()
+std::string offline_repo_url(const std::string& repo_dir);
+
+// The pacman.conf pacstrap installs with: the [options] of options_source
+// (Architecture adjusted for level) and only the [offline] repo at server,
+// normally offline_repo_url(), so nothing is fetched from the mirrors. The
+// target keeps its normal pacman.conf and mirrorlists for later updates.
+bool write_offline_pacman_conf(const std::string& options_source, CpuLevel level, const std::string& server,
+                               const std::string& out_path);
+
+struct StalePackage {
+    std::string name;
+    std::string local_version;
+    std::string mirror_version;
+};
+
+// Compares the versions in packages.list with the repos of pacman_conf.
+// Returns false with error set when the repo list cannot be read or no
+// mirror is reachable; stale is then empty.
+bool check_local_repo_freshness(const std::string& repo_dir, const std::string& pacman_conf,
+                                std::vector<StalePackage>& stale, std::string& error);
@@ -0,0 +1,129 @@
+#include "packages.h"
+#include "repos.h"
+
+#include <algorithm>
+
+std::string kernel_package(const std::string& kernel_type) {
+    if (kernel_type == "Bore") return "linux-cachyos-bore";
+    if (kernel_type == "Bore-Extra") return "linux-cachyos-bore-extra";
+    if (kernel_type == "CachyOS") return "linux-cachyos";
+    if (kernel_type == "CachyOS-Extra") return "linux-cachyos-extra";
+    if (kernel_type == "LTS") return "linux-lts";
+    if (kernel_type == "Zen") return "linux-zen";
+    return "";
+}
+
+std::vector<std::string> base_packages(const InstallConfig& config) {
+    std::vector<std::string> packages = {"base"};
+    std::string kernel = kernel_package(config.kernel_type);
+    if (!kernel.empty()) packages.push_back(kernel);
+    packages.insert(packages.end(), {"linux-firmware", "sudo", "dosfstools", "arch-install-scripts", "btrfs-progs", "nano"});
+
+    CpuLevel level;
+    if (parse_cpu_level(config.cpu_level, level)) {
+        std::vector<std::string> mirrorlists = mirrorlist_packages(level);
+        packages.insert(packages.end(), mirrorlists.begin(), mirrorlists.end());
+    }
+
+    packages.insert(packages.end(), config.custom_packages.begin(), config.custom_packages.end());
+
+    if (config.bootloader == "GRUB") {
+        packages.insert(packages.end(), {"grub", "efibootmgr", "cachyos-grub-theme"});
+    } else if (config.bootloader == "systemd-boot") {
+        packages.push_back("efibootmgr");
+    } else if (config.bootloader == "rEFInd") {
+        packages.push_back("refind");
+    }
+
+    if (config.initramfs == "mkinitcpio" || config.initramfs == "dracut" ||
+        config.initramfs == "booster" || config.initramfs == "mkinitcpio-pico") {
+        packages.push_back(config.initramfs);
+    }
+
+    if (config.desktop_env == "None") {
+        packages.push_back("networkmanager");
+    }
+    return packages;
+}
+
+DesktopPackages desktop_packages(const std::string& desktop_env) {
+    if (desktop_env == "KDE Plasma") {
+        return {{"plasma-desktop", "qt6-base", "qt6-wayland", "wayland", "kde-applications-meta", "sddm", "cachyos-kde-settings", "ntfs-3g", "gtk3"},
+                {"firefox", "kate", "ksystemlog", "partitionmanager", "dolphin", "konsole", "pulseaudio", "pavucontrol"},
+                "sddm"};
+    }
+    if (desktop_env == "GNOME") {
+        return {{"gnome", "gnome-extra", "gdm"},
+                {"firefox", "gnome-terminal", "pulseaudio", "pavucontrol"},
+                "gdm"};
+    }
+    if (desktop_env == "XFCE") {
+        return {{"xfce4", "xfce4-goodies", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "mousepad", "xfce4-terminal", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "MATE") {
+        return {{"mate", "mate-extra", "mate-media", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "pluma", "mate-terminal", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "LXQt") {
+        return {{"lxqt", "breeze-icons", "sddm"},
+                {"firefox", "qterminal", "pulseaudio", "pavucontrol"},
+                "sddm"};
+    }
+    if (desktop_env == "Cinnamon") {
+        return {{"cinnamon", "cinnamon-translations", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "xed", "gnome-terminal", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "Budgie") {
+        return {{"budgie-desktop", "budgie-extras", "gnome-control-center", "gnome-terminal", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "gnome-text-editor", "gnome-terminal", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "Deepin") {
+        return {{"deepin", "deepin-extra", "lightdm"},
+                {"firefox", "deepin-terminal", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "i3") {
+        return {{"i3-wm", "i3status", "i3lock", "dmenu", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "alacritty", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "Sway") {
+        return {{"sway", "swaylock", "swayidle", "waybar", "wofi", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "foot", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    if (desktop_env == "Hyprland") {
+        return {{"hyprland", "waybar", "rofi", "wofi", "kitty", "swaybg", "swaylock-effects", "wl-clipboard", "lightdm", "lightdm-gtk-greeter"},
+                {"firefox", "kitty", "pulseaudio", "pavucontrol"},
+                "lightdm"};
+    }
+    return {};
+}
+
+std::vector<std::string> gaming_packages() {
+    return {"cachyos-gaming-meta"};
+}
+
+std::vector<std::string> full_package_set(const InstallConfig& config) {
+    std::vector<std::string> all = base_packages(config);
+    DesktopPackages desktop = desktop_packages(config.desktop_env);
+    all.insert(all.end(), desktop.desktop.begin(), desktop.desktop.end());
+    all.insert(all.end(), desktop.apps.begin(), desktop.apps.end());
+    if (config.install_gaming && config.desktop_env != "None") {
+        std::vector<std::string> gaming = gaming_packages();
+        all.insert(all.end(), gaming.begin(), gaming.end());
+    }
+
+    std::vector<std::string> unique;
+    for (const std::string& pkg : all) {
+        if (std::find(unique.begin(), unique.end(), pkg) == unique.end()) {
+            unique.push_back(pkg);
+        }
+    }
+    return unique;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+// Package lists for one desktop choice. `desktop` is the DE itself plus its
+// display manager, `apps` the default applications installed alongside it.
+struct DesktopPackages {
+    std::vector<std::string> desktop;
+    std::vector<std::string> apps;
+    std::string display_manager;
+};
+
+std::string kernel_package(const std::string& kernel_type);
+
+// Packages handed to pacstrap: base, kernel, the CachyOS keyring and
+// mirrorlists for the resolved CPU level, bootloader, initramfs generator and
+// anything listed in packages.txt.
+std::vector<std::string> base_packages(const InstallConfig& config);
+
+DesktopPackages desktop_packages(const std::string& desktop_env);
+std::vector<std::string> gaming_packages();
+
+// Everything the installation will pull in, in install order and without
+// duplicates. This is what the prefetch stage downloads and what pacstrap
+// installs, in a single transaction.
+std::vector<std::string> full_package_set(const InstallConfig& config);
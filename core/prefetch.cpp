@@ -0,0 +1,68 @@
+#include "prefetch.h"
+#include "cache.h"
+#include "log.h"
+#include "packages.h"
+#include "process.h"
+
+#include <fstream>
+
+PackagePrefetcher::PackagePrefetcher(const std::string& staging_dir) : staging_dir(staging_dir) {}
+
+PackagePrefetcher::~PackagePrefetcher() {
+    if (worker.joinable()) worker.join();
+}
+
+void PackagePrefetcher::add_cache_dirs(const std::vector<std::string>& dirs) {
+    extra_cache_dirs.insert(extra_cache_dirs.end(), dirs.begin(), dirs.end());
+}
+
+void PackagePrefetcher::start(const std::vector<std::string>& packages) {
+    if (packages.empty() || worker.joinable()) return;
+    started = std::chrono::steady_clock::now();
+    core_log("Prefetching " + std::to_string(packages.size()) + " packages into " + cache_dir() +
+             " (output in " + log_path() + ")");
+    worker = std::thread(&PackagePrefetcher::run, this, packages);
+}
+
+void PackagePrefetcher::run(std::vector<std::string> packages) {
+    std::string db_dir = staging_dir + "/db";
+    run_quietly({"mkdir", "-p", cache_dir(), db_dir});
+    seed_sync_databases(HOST_SYNC_DIR, sync_dir());
+
+    // The staging directory comes first so it is where pacman downloads to
+    std::vector<std::string> cache_dirs = {cache_dir()};
+    cache_dirs.insert(cache_dirs.end(), extra_cache_dirs.begin(), extra_cache_dirs.end());
+
+    std::vector<std::string> cmd = {"pacman", "-Syw", "--noconfirm", "--disable-download-timeout", "--dbpath", db_dir};
+    if (!pacman_config.empty()) {
+        cmd.push_back("--config");
+        cmd.push_back(pacman_config);
+    }
+    for (const std::string& arg : cachedir_args(cache_dirs)) cmd.push_back(arg);
+    cmd.insert(cmd.end(), packages.begin(), packages.end());
+
+    std::ofstream log(log_path());
+    ProcessOptions options;
+    options.stdin_mode = StdinMode::Null;
+    options.on_line = [&log](const std::string& line, bool) { log << line << "\n"; };
+    succeeded = run_process(cmd, options).ok();
+    done = true;
+}
+
+bool PackagePrefetcher::wait() {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    if (!worker.joinable()) return succeeded;
+    if (!done) {
+        core_log("Waiting for package prefetch to finish");
+    }
+    worker.join();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started);
+    if (succeeded) {
+        core_log("Package prefetch finished in " + std::to_string(elapsed.count()) + "s");
+    } else {
+        core_log("Package prefetch failed after " + std::to_string(elapsed.count()) +
+                 "s, pacstrap will download the remaining packages (see " + log_path() + ")");
+    }
+    return succeeded;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+inline constexpr const char* DEFAULT_PREFETCH_DIR = "/var/cache/cachyos-installer";
+
+// Downloads the resolved package set into a staging cache on the live system
+// while the target disk is wiped, partitioned and formatted. pacman resolves
+// dependencies against an empty private database so the full closure is
+// fetched, not just what the live ISO is missing. The staging cache is then
+// passed to pacstrap and the chroot pacman calls as an extra --cachedir.
+class PackagePrefetcher {
+public:
+    explicit PackagePrefetcher(const std::string& staging_dir);
+    ~PackagePrefetcher();
+
+    // Packages already present in one of these directories are not
+    // downloaded again. Call before start().
+    void add_cache_dirs(const std::vector<std::string>& dirs);
+
+    // pacman.conf to resolve and download with (e.g. one using the ranked
+    // mirrorlists). Empty means the live system's /etc/pacman.conf.
+    void set_pacman_config(const std::string& path) { pacman_config = path; }
+
+    void start(const std::vector<std::string>& packages);
+
+    // Blocks until the download finishes. A failed prefetch is not fatal:
+    // pacstrap simply downloads whatever is missing from the cache. Several
+    // installs sharing one prefetch may all wait on it.
+    bool wait();
+
+    std::string cache_dir() const { return staging_dir + "/pkg"; }
+    std::string log_path() const { return staging_dir + "/prefetch.log"; }
+    std::string sync_dir() const { return staging_dir + "/db/sync"; }
+
+private:
+    void run(std::vector<std::string> packages);
+
+    std::string staging_dir;
+    std::vector<std::string> extra_cache_dirs;
+    std::string pacman_config;
+    std::thread worker;
+    std::mutex wait_mutex;
+    std::atomic<bool> done{false};
+    bool succeeded = false;
+    std::chrono::steady_clock::time_point started;
+};
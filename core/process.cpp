@@ -0,0 +1,255 @@
+#include "process.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// How long a partial line may sit in the buffer before it is passed on
+static const int PARTIAL_LINE_FLUSH_MS = 200;
+
+// write() to a pipe whose reader has exited raises SIGPIPE, which would
+// kill the installer. Blocked for this thread around the write, the
+// signal stays pending instead and is taken back here; the write fails
+// with EPIPE, which the caller treats as the child no longer reading.
+static ssize_t write_without_sigpipe(int fd, const char* data, size_t size) {
+    sigset_t sigpipe, pending, old_mask;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+
+    ssize_t n = write(fd, data, size);
+    int saved_errno = errno;
+    if (n < 0 && errno == EPIPE && !was_pending) {
+        timespec no_wait{0, 0};
+        while (sigtimedwait(&sigpipe, nullptr, &no_wait) < 0 && errno == EINTR) {}
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    errno = saved_errno;
+    return n;
+}
+
+int64_t monotonic_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+std::string shell_quote(const std::string& value) {
+    if (!value.empty() && value.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789@%+=:,./-_") == std::string::npos) {
+        return value;
+    }
+    std::string quoted = "'";
+    for (char c : value) {
+        if (c == '\'') quoted += "'\\''";
+        else quoted += c;
+    }
+    return quoted + "'";
+}
+
+std::string format_argv(const std::vector<std::string>& argv) {
+    std::string formatted;
+    for (const std::string& arg : argv) {
+        if (!formatted.empty()) formatted += " ";
+        formatted += shell_quote(arg);
+    }
+    return formatted;
+}
+
+namespace {
+
+// One piped output stream of the child, split into lines
+struct OutputStream {
+    int fd = -1;
+    bool is_stderr = false;
+    std::string pending;
+    int64_t last_data_ns = 0;
+
+    void emit_lines(const ProcessOptions& options, bool flush_partial) {
+        size_t start = 0;
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (pending[i] == '\n' || pending[i] == '\r') {
+                if (i > start && options.on_line) options.on_line(pending.substr(start, i - start), is_stderr);
+                start = i + 1;
+            }
+        }
+        pending.erase(0, start);
+        if (flush_partial && !pending.empty()) {
+            if (options.on_line) options.on_line(pending, is_stderr);
+            pending.clear();
+        }
+    }
+};
+
+void close_fd(int& fd) {
+    if (fd >= 0) close(fd);
+    fd = -1;
+}
+
+}  // namespace
+
+ProcessResult run_process(const std::vector<std::string>& argv, const ProcessOptions& options) {
+    ProcessResult result;
+    result.argv = argv;
+    if (options.elevate && geteuid() != 0) {
+        result.argv.insert(result.argv.begin(), "sudo");
+    }
+    result.started_ns = monotonic_ns();
+    if (result.argv.empty()) {
+        result.spawn_error = "empty command";
+        result.finished_ns = monotonic_ns();
+        return result;
+    }
+
+    int out_pipe[2] = {-1, -1};
+    int err_pipe[2] = {-1, -1};
+    int in_pipe[2] = {-1, -1};
+    if ((options.pipe_stdout && pipe2(out_pipe, O_CLOEXEC) != 0) ||
+        (options.pipe_stderr && pipe2(err_pipe, O_CLOEXEC) != 0) ||
+        (options.stdin_mode == StdinMode::Data && pipe2(in_pipe, O_CLOEXEC) != 0)) {
+        result.spawn_error = std::strerror(errno);
+        for (int* fds : {out_pipe, err_pipe, in_pipe}) {
+            close_fd(fds[0]);
+            close_fd(fds[1]);
+        }
+        result.finished_ns = monotonic_ns();
+        return result;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (options.pipe_stdout) posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    if (options.pipe_stderr) posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO);
+    if (options.stdin_mode == StdinMode::Data) {
+        posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+    } else if (options.stdin_mode == StdinMode::Null) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    if (!options.working_dir.empty()) {
+        posix_spawn_file_actions_addchdir_np(&actions, options.working_dir.c_str());
+    }
+
+    std::vector<char*> c_argv;
+    for (std::string& arg : result.argv) c_argv.push_back(arg.data());
+    c_argv.push_back(nullptr);
+
+    pid_t pid = -1;
+    int rc = posix_spawnp(&pid, c_argv[0], &actions, nullptr, c_argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close_fd(out_pipe[1]);
+    close_fd(err_pipe[1]);
+    close_fd(in_pipe[0]);
+
+    if (rc != 0) {
+        result.spawn_error = std::strerror(rc);
+        result.exit_code = 127;
+        close_fd(out_pipe[0]);
+        close_fd(err_pipe[0]);
+        close_fd(in_pipe[1]);
+        result.finished_ns = monotonic_ns();
+        return result;
+    }
+    result.spawned = true;
+
+    OutputStream streams[2];
+    streams[0].fd = out_pipe[0];
+    streams[1].fd = err_pipe[0];
+    streams[1].is_stderr = true;
+
+    int stdin_fd = in_pipe[1];
+    size_t stdin_written = 0;
+    if (stdin_fd >= 0) {
+        fcntl(stdin_fd, F_SETFL, O_NONBLOCK);
+        if (options.stdin_data.empty()) close_fd(stdin_fd);
+    }
+
+    char buffer[65536];
+    while (streams[0].fd >= 0 || streams[1].fd >= 0 || stdin_fd >= 0) {
+        pollfd fds[3];
+        int count = 0;
+        for (OutputStream& stream : streams) {
+            if (stream.fd >= 0) fds[count++] = {stream.fd, POLLIN, 0};
+        }
+        if (stdin_fd >= 0) fds[count++] = {stdin_fd, POLLOUT, 0};
+
+        int ready = poll(fds, count, PARTIAL_LINE_FLUSH_MS);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        int64_t now = monotonic_ns();
+        for (int i = 0; i < count; ++i) {
+            if (fds[i].fd == stdin_fd) {
+                if (fds[i].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                    ssize_t n = write_without_sigpipe(stdin_fd, options.stdin_data.data() + stdin_written,
+                                                      options.stdin_data.size() - stdin_written);
+                    if (n > 0) stdin_written += n;
+                    // EPIPE included: the child stopped reading, the rest is dropped
+                    if (n < 0 && errno != EAGAIN && errno != EINTR) stdin_written = options.stdin_data.size();
+                    if (stdin_written >= options.stdin_data.size()) close_fd(stdin_fd);
+                }
+                continue;
+            }
+            OutputStream& stream = fds[i].fd == streams[0].fd ? streams[0] : streams[1];
+            if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) continue;
+            ssize_t n = read(stream.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                (stream.is_stderr ? result.stderr_bytes : result.stdout_bytes) += n;
+                if (options.capture) (stream.is_stderr ? result.stderr_text : result.stdout_text).append(buffer, n);
+                stream.pending.append(buffer, n);
+                stream.last_data_ns = now;
+                stream.emit_lines(options, false);
+            } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+                stream.emit_lines(options, true);
+                close_fd(stream.fd);
+            }
+        }
+
+        for (OutputStream& stream : streams) {
+            if (!stream.pending.empty() && now - stream.last_data_ns >= PARTIAL_LINE_FLUSH_MS * 1000000LL) {
+                stream.emit_lines(options, true);
+            }
+        }
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    result.finished_ns = monotonic_ns();
+    if (WIFEXITED(status)) {
+        result.exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        result.term_signal = WTERMSIG(status);
+        result.exit_code = 128 + result.term_signal;
+    }
+    return result;
+}
+
+std::string capture_process(const std::vector<std::string>& argv, bool elevate) {
+    ProcessOptions options;
+    options.elevate = elevate;
+    options.stdin_mode = StdinMode::Null;
+    options.capture = true;
+    ProcessResult result = run_process(argv, options);
+    if (!result.ok()) return "";
+    std::string output = result.stdout_text;
+    while (!output.empty() && (output.back() == '\n' || output.back() == '\r')) output.pop_back();
+    return output;
+}
+
+int run_quietly(const std::vector<std::string>& argv) {
+    ProcessOptions options;
+    options.stdin_mode = StdinMode::Null;
+    return run_process(argv, options).exit_code;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Runs programs directly from an argv vector with posix_spawn: no /bin/sh in
+// between, so hostnames, passwords and paths are passed through verbatim.
+// sudo is only added when the installer is not already running as root.
+
+enum class StdinMode {
+    Inherit,    // the child reads the installer's own stdin (interactive tools)
+    Null,       // /dev/null
+    Data,       // ProcessOptions::stdin_data, then EOF
+};
+
+struct ProcessOptions {
+    StdinMode stdin_mode = StdinMode::Inherit;
+    std::string stdin_data;
+    bool pipe_stdout = true;     // false: the child writes straight to our stdout
+    bool pipe_stderr = true;
+    bool capture = false;        // keep piped output in ProcessResult
+    bool elevate = true;         // prefix sudo when not root
+    std::string working_dir;
+    // Called for every line of piped output as it arrives. A partial line
+    // (a prompt without a newline) is flushed after a short idle period.
+    std::function<void(const std::string& line, bool is_stderr)> on_line;
+};
+
+struct ProcessResult {
+    std::vector<std::string> argv;   // as executed, including sudo if added
+    bool spawned = false;
+    int exit_code = -1;              // exit status, or 128 + signal number
+    int term_signal = 0;
+    std::string spawn_error;
+    int64_t started_ns = 0;          // CLOCK_MONOTONIC
+    int64_t finished_ns = 0;
+    uint64_t stdout_bytes = 0;
+    uint64_t stderr_bytes = 0;
+    std::string stdout_text;         // only with ProcessOptions::capture
+    std::string stderr_text;
+
+    bool ok() const { return spawned && exit_code == 0; }
+    double seconds() const { return (finished_ns - started_ns) / 1e9; }
+};
+
+ProcessResult run_process(const std::vector<std::string>& argv, const ProcessOptions& options = {});
+
+// Runs argv without sudo (unless asked) and returns its stdout with the
+// trailing newline removed, or an empty string if it failed.
+std::string capture_process(const std::vector<std::string>& argv, bool elevate = false);
+
+// Runs argv with sudo when needed, stdin from /dev/null and its output
+// discarded. Returns the exit status (0 on success).
+int run_quietly(const std::vector<std::string>& argv);
+
+int64_t monotonic_ns();
+
+// Quoting for logs and for generated shell scripts.
+std::string shell_quote(const std::string& value);
+std::string format_argv(const std::vector<std::string>& argv);
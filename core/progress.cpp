@@ -0,0 +1,315 @@
+#include "progress.h"
+#include "process.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+struct StageInfo {
+    const char* name;
+    double typical_seconds;     // weight when there is no history
+};
+
+static const StageInfo STAGES[] = {
+    {"Wiping disk", 5},
+    {"Partitioning disk", 8},
+    {"Formatting partitions", 3},
+    {"Setting up Btrfs subvolumes", 1},
+    {"Mounting with compression", 1},
+    {"Installing system packages", 600},
+    {"Generating fstab", 1},
+    {"Configuring locale", 1},
+    {"Creating users", 3},
+    {"Running chroot configuration", 180},
+    {"Finalizing installation", 2},
+};
+static const size_t STAGE_COUNT = sizeof(STAGES) / sizeof(STAGES[0]);
+
+// Share of a pacman transaction's time per phase, roughly what a desktop
+// install spends: downloads and unpacking dominate, hooks include initramfs
+static const double SYNC_WEIGHT = 0.02;
+static const double DOWNLOAD_WEIGHT = 0.35;
+static const double CHECK_WEIGHT = 0.08;
+static const double INSTALL_WEIGHT = 0.45;
+static const double HOOKS_WEIGHT = 0.10;
+static const int CHECK_STEPS = 5;   // keyring, integrity, load, conflicts, disk space
+
+std::string stage_name(InstallStage stage) {
+    return STAGES[static_cast<size_t>(stage)].name;
+}
+
+static bool starts_with(const std::string& text, const char* prefix) {
+    return text.rfind(prefix, 0) == 0;
+}
+
+static bool ends_with(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// "1234.56 MiB" -> bytes
+static uint64_t parse_size(const std::string& text) {
+    std::istringstream stream(text);
+    double value = 0;
+    std::string unit;
+    stream >> value >> unit;
+    double scale = unit == "KiB" ? 1024.0 : unit == "MiB" ? 1048576.0 : unit == "GiB" ? 1073741824.0 : 1.0;
+    return static_cast<uint64_t>(value * scale);
+}
+
+static std::string format_duration(double seconds) {
+    int total = static_cast<int>(seconds + 0.5);
+    if (total >= 3600) return std::to_string(total / 3600) + "h" + std::to_string(total % 3600 / 60) + "m";
+    if (total >= 60) return std::to_string(total / 60) + "m" + std::to_string(total % 60) + "s";
+    return std::to_string(total) + "s";
+}
+
+void InstallProgress::load_history(const std::string& path) {
+    history_path = path;
+    history.assign(STAGE_COUNT, 0);
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) continue;
+        std::string name = line.substr(tab + 1);
+        for (size_t i = 0; i < STAGE_COUNT; ++i) {
+            if (name == STAGES[i].name) {
+                history[i] = std::max(0.0, std::atof(line.substr(0, tab).c_str()));
+            }
+        }
+    }
+}
+
+void InstallProgress::begin(InstallStage stage) {
+    int64_t now = monotonic_ns();
+    durations.resize(STAGE_COUNT, 0);
+    if (started) durations[static_cast<size_t>(current)] += elapsed_in_stage();
+    started = true;
+    current = stage;
+    stage_started_ns = now;
+    last_line_ns = now;
+    explicit_fraction = -1;
+
+    phase = PacmanPhase::None;
+    packages_total = downloaded = checks_done = installed = hooks_done = hooks_total = 0;
+    download_total_bytes = 0;
+    download_started_ns = download_finished_ns = 0;
+}
+
+void InstallProgress::set_stage_fraction(double fraction) {
+    explicit_fraction = std::clamp(fraction, 0.0, 1.0);
+}
+
+void InstallProgress::feed_line(const std::string& line) {
+    int64_t now = monotonic_ns();
+    last_line_ns = now;
+
+    size_t first = line.find_first_not_of(" \t");
+    if (first == std::string::npos) return;
+    std::string text = line.substr(first, line.find_last_not_of(" \t") - first + 1);
+    auto end_download = [&]() {
+        if (download_started_ns && !download_finished_ns) download_finished_ns = now;
+    };
+
+    // A new transaction (pacstrap, or pacman -S in the chroot)
+    if (starts_with(text, ":: Synchronizing package databases") || text == "resolving dependencies...") {
+        packages_total = downloaded = checks_done = installed = hooks_done = hooks_total = 0;
+        download_total_bytes = 0;
+        download_started_ns = download_finished_ns = 0;
+        phase = PacmanPhase::Sync;
+        return;
+    }
+    if (starts_with(text, "Packages (")) {
+        packages_total = std::atoi(text.c_str() + 10);
+        return;
+    }
+    if (starts_with(text, "Total Download Size:")) {
+        download_total_bytes = parse_size(text.substr(20));
+        return;
+    }
+    if (starts_with(text, ":: Retrieving packages")) {
+        phase = PacmanPhase::Download;
+        download_started_ns = now;
+        return;
+    }
+    if (starts_with(text, ":: Processing package changes")) {
+        end_download();
+        phase = PacmanPhase::Install;
+        return;
+    }
+    if (starts_with(text, ":: Running post-transaction hooks")) {
+        end_download();
+        phase = PacmanPhase::Hooks;
+        return;
+    }
+    if (text == "there is nothing to do") {
+        phase = PacmanPhase::Done;
+        return;
+    }
+
+    // "(n/N) installing foo" with progress bars, "(n/N) Arming ..." for hooks
+    int n = 0, total = 0, consumed = 0;
+    if (std::sscanf(text.c_str(), "(%d/%d) %n", &n, &total, &consumed) == 2 && consumed > 0) {
+        std::string rest = text.substr(consumed);
+        if (phase == PacmanPhase::Hooks) {
+            hooks_done = n;
+            hooks_total = total;
+        } else if (starts_with(rest, "installing ") || starts_with(rest, "upgrading ") ||
+                   starts_with(rest, "reinstalling ") || starts_with(rest, "downgrading ")) {
+            phase = PacmanPhase::Install;
+            installed = n;
+            packages_total = std::max(packages_total, total);
+        } else if (starts_with(rest, "checking ") || starts_with(rest, "loading ")) {
+            end_download();
+            phase = PacmanPhase::Check;
+        }
+        return;
+    }
+
+    // Without a terminal pacman prints one line per event instead of bars
+    if (phase == PacmanPhase::Download && ends_with(text, " downloading...")) {
+        ++downloaded;
+    } else if (text == "checking keyring..." || text == "checking package integrity..." ||
+               text == "loading package files..." || text == "checking for file conflicts..." ||
+               text == "checking available disk space...") {
+        end_download();
+        phase = PacmanPhase::Check;
+        ++checks_done;
+    } else if ((starts_with(text, "installing ") || starts_with(text, "upgrading ") ||
+                starts_with(text, "reinstalling ")) && ends_with(text, "...")) {
+        phase = PacmanPhase::Install;
+        ++installed;
+    }
+}
+
+void InstallProgress::finish() {
+    durations.resize(STAGE_COUNT, 0);
+    if (started && !finished) durations[static_cast<size_t>(current)] += elapsed_in_stage();
+    finished = true;
+
+    if (history_path.empty()) return;
+    std::ofstream file(history_path);
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        if (durations[i] > 0) file << durations[i] << "\t" << STAGES[i].name << "\n";
+    }
+}
+
+double InstallProgress::expected_seconds(InstallStage stage) const {
+    size_t index = static_cast<size_t>(stage);
+    if (index < history.size() && history[index] > 0) return history[index];
+    return STAGES[index].typical_seconds;
+}
+
+double InstallProgress::elapsed_in_stage() const {
+    return started ? (monotonic_ns() - stage_started_ns) / 1e9 : 0;
+}
+
+double InstallProgress::pacman_fraction() const {
+    double download_weight = download_total_bytes > 0 ? DOWNLOAD_WEIGHT : 0;
+    double total = SYNC_WEIGHT + download_weight + CHECK_WEIGHT + INSTALL_WEIGHT + HOOKS_WEIGHT;
+    double packages = std::max(1, packages_total);
+    double done = 0;
+    switch (phase) {
+        case PacmanPhase::None:
+        case PacmanPhase::Sync:
+            break;
+        case PacmanPhase::Download:
+            done = SYNC_WEIGHT + download_weight * std::min(0.99, downloaded / packages);
+            break;
+        case PacmanPhase::Check:
+            done = SYNC_WEIGHT + download_weight + CHECK_WEIGHT * std::min(1.0, checks_done / double(CHECK_STEPS));
+            break;
+        case PacmanPhase::Install:
+            done = SYNC_WEIGHT + download_weight + CHECK_WEIGHT + INSTALL_WEIGHT * std::min(1.0, installed / packages);
+            break;
+        case PacmanPhase::Hooks:
+            done = SYNC_WEIGHT + download_weight + CHECK_WEIGHT + INSTALL_WEIGHT +
+                   (hooks_total > 0 ? HOOKS_WEIGHT * hooks_done / hooks_total : 0);
+            break;
+        case PacmanPhase::Done:
+            done = total;
+            break;
+    }
+    return done / total;
+}
+
+double InstallProgress::stage_fraction() const {
+    if (finished) return 1;
+    if (explicit_fraction >= 0) return explicit_fraction;
+    if (phase != PacmanPhase::None) return pacman_fraction();
+    return std::min(0.95, elapsed_in_stage() / expected_seconds(current));
+}
+
+double InstallProgress::fraction() const {
+    if (finished) return 1;
+    if (!started) return 0;
+    double total = 0, done = 0;
+    for (size_t i = 0; i < STAGE_COUNT; ++i) {
+        double weight = expected_seconds(static_cast<InstallStage>(i));
+        total += weight;
+        if (i < static_cast<size_t>(current)) done += weight;
+    }
+    done += expected_seconds(current) * stage_fraction();
+    return done / total;
+}
+
+double InstallProgress::eta_seconds() const {
+    if (finished) return 0;
+    if (!started) return -1;
+    double fraction = stage_fraction();
+    double elapsed = elapsed_in_stage();
+    double remaining;
+    bool measured = explicit_fraction >= 0 || phase != PacmanPhase::None;
+    if (measured && fraction > 0.02 && elapsed > 5) {
+        remaining = elapsed * (1 - fraction) / fraction;
+    } else {
+        remaining = std::max(0.0, expected_seconds(current) - elapsed);
+    }
+    for (size_t i = static_cast<size_t>(current) + 1; i < STAGE_COUNT; ++i) {
+        remaining += expected_seconds(static_cast<InstallStage>(i));
+    }
+    return remaining;
+}
+
+double InstallProgress::download_bytes_per_s() const {
+    if (!download_started_ns || download_total_bytes == 0) return 0;
+    int64_t end = download_finished_ns ? download_finished_ns : monotonic_ns();
+    double seconds = (end - download_started_ns) / 1e9;
+    double bytes = download_finished_ns ? download_total_bytes
+                                        : download_total_bytes * std::min(1.0, downloaded / double(std::max(1, packages_total)));
+    return seconds > 0.5 ? bytes / seconds : 0;
+}
+
+double InstallProgress::idle_seconds() const {
+    return started ? (monotonic_ns() - last_line_ns) / 1e9 : 0;
+}
+
+std::string InstallProgress::status() const {
+    if (!started) return "";
+    std::string status = stage_name(current);
+    switch (phase) {
+        case PacmanPhase::Sync: status += ": synchronizing databases"; break;
+        case PacmanPhase::Download: status += ": downloaded " + std::to_string(downloaded) + " packages"; break;
+        case PacmanPhase::Check: status += ": checking packages"; break;
+        case PacmanPhase::Install:
+            status += ": installing " + std::to_string(installed) + "/" + std::to_string(packages_total);
+            break;
+        case PacmanPhase::Hooks:
+            status += ": running hooks";
+            if (hooks_total > 0) status += " " + std::to_string(hooks_done) + "/" + std::to_string(hooks_total);
+            break;
+        default: break;
+    }
+
+    double rate = download_bytes_per_s();
+    if (rate > 0 && phase == PacmanPhase::Download) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.1f MiB/s", rate / 1048576.0);
+        status += std::string(" | ") + buffer;
+    }
+    double eta = eta_seconds();
+    if (eta >= 0 && !finished) status += " | ETA " + format_duration(eta);
+    if (idle_seconds() > PROGRESS_STALL_SECONDS) status += " | no output for " + format_duration(idle_seconds());
+    return status;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The install pipeline as both frontends run it, in order
+enum class InstallStage {
+    Wipe,
+    Partition,
+    Format,
+    Subvolumes,
+    Mount,
+    Packages,
+    Fstab,
+    Locale,
+    Users,
+    Chroot,
+    Finalize,
+};
+
+std::string stage_name(InstallStage stage);   // "Wiping disk", ...
+
+// Silence after which a frontend reports "no output for Ns"
+const int PROGRESS_STALL_SECONDS = 60;
+
+// Overall progress, ETA and download rate for one installation.
+//
+// Each stage is weighted by how long it took last time (the history file,
+// rewritten by finish()) or by a typical duration when there is no
+// history. Inside a stage, progress comes from, in order of preference:
+// - set_stage_fraction(), for work the installer measures itself;
+// - pacman/pacstrap output passed to feed_line(): the package count,
+//   total download size, each download, the install of each package and
+//   each hook;
+// - elapsed time against the expected duration, capped below 100%.
+// Not thread safe; the thread running the install owns it.
+class InstallProgress {
+public:
+    void load_history(const std::string& path);
+
+    void begin(InstallStage stage);
+    void set_stage_fraction(double fraction);
+    void feed_line(const std::string& line);
+    // Marks everything done and records the stage durations
+    void finish();
+
+    InstallStage stage() const { return current; }
+    double fraction() const;                 // 0..1 over the whole install
+    double eta_seconds() const;              // < 0 while unknown
+    double download_bytes_per_s() const;     // 0 until pacman downloads
+    double idle_seconds() const;             // since the last line of output
+    // "Installing system packages: installing 412/950 | 18.2 MiB/s | ETA 6m10s"
+    std::string status() const;
+
+private:
+    enum class PacmanPhase { None, Sync, Download, Check, Install, Hooks, Done };
+
+    double stage_fraction() const;
+    double pacman_fraction() const;
+    double expected_seconds(InstallStage stage) const;
+    double elapsed_in_stage() const;
+
+    InstallStage current = InstallStage::Wipe;
+    bool started = false;
+    bool finished = false;
+    int64_t stage_started_ns = 0;
+    int64_t last_line_ns = 0;
+    double explicit_fraction = -1;
+    std::vector<double> history;             // seconds per stage, 0 = none
+    std::vector<double> durations;           // this run
+    std::string history_path;
+
+    PacmanPhase phase = PacmanPhase::None;
+    int packages_total = 0;
+    int downloaded = 0;
+    int checks_done = 0;
+    int installed = 0;
+    int hooks_done = 0;
+    int hooks_total = 0;
+    uint64_t download_total_bytes = 0;
+    int64_t download_started_ns = 0;
+    int64_t download_finished_ns = 0;
+};
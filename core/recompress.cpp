@@ -0,0 +1,155 @@
+#include "recompress.h"
+#include "process.h"
+
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static const char* SCRIPT_PATH = "/usr/local/lib/cachyos-installer/btrfs-recompress";
+
+std::string recompress_script(int level, const std::vector<std::string>& mount_points) {
+    std::string mounts;
+    for (const std::string& mount : mount_points) mounts += " " + shell_quote(mount);
+
+    return R"SCRIPT(#!/bin/bash
+# Installed by the CachyOS Btrfs Installer. Rewrites files written at the
+# fast install level with zstd:)SCRIPT" + std::to_string(level) + R"SCRIPT(, then disables itself.
+set -u
+LEVEL=)SCRIPT" + std::to_string(level) + R"SCRIPT(
+MOUNTS=()SCRIPT" + mounts + R"SCRIPT( )
+STATE=/var/lib/btrfs-recompress
+BATCH=100
+mkdir -p "$STATE"
+
+LEVEL_ARGS=(-L "$LEVEL")
+if ! btrfs filesystem defragment --help 2>&1 | grep -q -- '--level'; then
+    echo "btrfs-progs has no defragment --level, recompressing at the kernel's default zstd level"
+    LEVEL_ARGS=()
+fi
+
+# Defragments the given files. When the batch fails, each file is tried on
+# its own: files deleted since the list was made are skipped, the ones that
+# still fail are logged and kept in $retry for the next start.
+recompress() {
+    btrfs filesystem defragment -czstd "${LEVEL_ARGS[@]}" -- "$@" 2>/dev/null && return
+    local file output
+    for file in "$@"; do
+        [ -f "$file" ] || continue
+        output=$(btrfs filesystem defragment -czstd "${LEVEL_ARGS[@]}" -- "$file" 2>&1) && continue
+        printf '%s\0' "$file" >> "$retry"
+        failed=$((failed + 1))
+        [ "$failed" -le 10 ] && echo "Recompressing $file failed: $output"
+    done
+}
+
+status=0
+for mount in "${MOUNTS[@]}"; do
+    id=$(echo "$mount" | tr / _)
+    list="$STATE/files$id"
+    checkpoint="$STATE/checkpoint$id"
+    retry="$STATE/retry$id"
+    failed=0
+    [ -f "$STATE/done$id" ] && continue
+    rm -f "$retry"
+
+    # The file list is built once and kept, so the checkpoint index stays valid
+    if [ ! -f "$list" ]; then
+        find "$mount" -xdev -type f -size +4k -print0 | sort -z > "$list.tmp" && mv "$list.tmp" "$list"
+    fi
+    total=$(tr -cd '\0' < "$list" | wc -c)
+    start=0
+    [ -f "$checkpoint" ] && start=$(cat "$checkpoint")
+    echo "Recompressing $mount: resuming at $start of $total files"
+
+    index=0
+    batch=()
+    while IFS= read -r -d '' file; do
+        index=$((index + 1))
+        [ "$index" -le "$start" ] && continue
+        batch+=("$file")
+        if [ "${#batch[@]}" -ge "$BATCH" ] || [ "$index" -eq "$total" ]; then
+            recompress "${batch[@]}"
+            batch=()
+            echo "$index" > "$checkpoint"
+            echo "$mount $index/$total" > "$STATE/progress"
+            if [ $((index % (BATCH * 50))) -lt "$BATCH" ]; then
+                echo "Recompressing $mount: $index/$total ($((index * 100 / total))%)"
+            fi
+        fi
+    done < "$list"
+    if [ "${#batch[@]}" -gt 0 ]; then
+        recompress "${batch[@]}"
+    fi
+
+    # Only the failed files are left for the next start; the service stays enabled
+    if [ "$failed" -gt 0 ]; then
+        echo "Recompressing $mount: $failed files failed, retrying them at the next start"
+        mv "$retry" "$list"
+        rm -f "$checkpoint"
+        status=1
+        continue
+    fi
+    touch "$STATE/done$id"
+    rm -f "$list" "$checkpoint"
+    echo "Recompressing $mount: done"
+done
+
+[ "$status" -eq 0 ] || exit 1
+touch "$STATE/done"
+systemctl disable )SCRIPT" + RECOMPRESS_SERVICE + R"SCRIPT(
+)SCRIPT";
+}
+
+std::string recompress_unit(int level) {
+    return "[Unit]\n"
+           "Description=Recompress the installed system at zstd:" + std::to_string(level) + "\n"
+           "ConditionPathExists=!/var/lib/btrfs-recompress/done\n"
+           "After=local-fs.target\n"
+           "\n"
+           "[Service]\n"
+           "Type=simple\n"
+           "ExecStart=" + std::string(SCRIPT_PATH) + "\n"
+           "Nice=19\n"
+           "CPUSchedulingPolicy=idle\n"
+           "IOSchedulingClass=idle\n"
+           "\n"
+           "[Install]\n"
+           "WantedBy=multi-user.target\n";
+}
+
+static bool write_file(const fs::path& path, const std::string& content, std::string& error) {
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    std::ofstream file(path);
+    if (!file.is_open() || !(file << content)) {
+        error = "cannot write " + path.string();
+        return false;
+    }
+    return true;
+}
+
+bool install_recompress_service(const std::string& target_root, int level,
+                                const std::vector<std::string>& mount_points, std::string& error) {
+    fs::path root(target_root);
+    fs::path script = root / fs::path(SCRIPT_PATH).relative_path();
+    fs::path unit = root / "etc/systemd/system" / RECOMPRESS_SERVICE;
+    if (!write_file(script, recompress_script(level, mount_points), error) ||
+        !write_file(unit, recompress_unit(level), error)) {
+        return false;
+    }
+
+    std::error_code ec;
+    fs::permissions(script, fs::perms::owner_all | fs::perms::group_read | fs::perms::group_exec |
+                    fs::perms::others_read | fs::perms::others_exec, ec);
+    // What systemctl enable would do, without needing the chroot
+    fs::path wants = root / "etc/systemd/system/multi-user.target.wants";
+    fs::create_directories(wants, ec);
+    fs::remove(wants / RECOMPRESS_SERVICE, ec);
+    fs::create_symlink(fs::path("/etc/systemd/system") / RECOMPRESS_SERVICE, wants / RECOMPRESS_SERVICE, ec);
+    if (ec) {
+        error = "cannot enable " + std::string(RECOMPRESS_SERVICE) + ": " + ec.message();
+        return false;
+    }
+    return true;
+}
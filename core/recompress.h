@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Fast-install mode: the target is mounted with zstd:1 during pacstrap and
+// the chroot stage, fstab gets the requested level, and a first-boot service
+// rewrites the existing extents at that level with idle CPU and I/O
+// priority. Progress is checkpointed under /var/lib/btrfs-recompress so a
+// reboot resumes where it stopped. Files that fail are logged and retried
+// at the next start; the service disables itself once every file was done.
+inline constexpr int FAST_INSTALL_LEVEL = 1;
+inline constexpr const char* RECOMPRESS_SERVICE = "btrfs-recompress.service";
+
+std::string recompress_script(int level, const std::vector<std::string>& mount_points);
+std::string recompress_unit(int level);
+
+// Writes the script and unit into the target root and enables the unit.
+bool install_recompress_service(const std::string& target_root, int level,
+                                const std::vector<std::string>& mount_points, std::string& error);
@@ -0,0 +1,165 @@
+#include "repos.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::vector<RepoSection> cachyos_repo_sections(CpuLevel level) {
+    std::vector<RepoSection> sections;
+    if (level == CpuLevel::V3) {
+        sections = {{"cachyos-v3", "cachyos-v3-mirrorlist"},
+                    {"cachyos-core-v3", "cachyos-v3-mirrorlist"},
+                    {"cachyos-extra-v3", "cachyos-v3-mirrorlist"}};
+    } else if (level == CpuLevel::V4) {
+        sections = {{"cachyos-v4", "cachyos-v4-mirrorlist"},
+                    {"cachyos-core-v4", "cachyos-v4-mirrorlist"},
+                    {"cachyos-extra-v4", "cachyos-v4-mirrorlist"}};
+    } else if (level == CpuLevel::Znver4) {
+        sections = {{"cachyos-znver4", "cachyos-v4-mirrorlist"},
+                    {"cachyos-core-znver4", "cachyos-v4-mirrorlist"},
+                    {"cachyos-extra-znver4", "cachyos-v4-mirrorlist"}};
+    }
+    sections.push_back({"cachyos", "cachyos-mirrorlist"});
+    return sections;
+}
+
+static RepoSection extra_repo_section(const std::string& name) {
+    if (name.rfind("cachyos", 0) == 0) return {name, "cachyos-mirrorlist"};
+    if (name == "chaotic-aur") return {name, "chaotic-mirrorlist"};
+    return {name, "mirrorlist"};
+}
+
+std::vector<RepoSection> target_repo_sections(CpuLevel level, const std::vector<std::string>& extra_repos) {
+    std::vector<RepoSection> sections;
+    // Testing repos must come before the repos they override
+    for (const std::string& repo : extra_repos) {
+        if (repo == "testing") {
+            sections.push_back({"core-testing", "mirrorlist"});
+            sections.push_back({"extra-testing", "mirrorlist"});
+        } else if (repo.find("testing") != std::string::npos) {
+            sections.push_back(extra_repo_section(repo));
+        }
+    }
+
+    std::vector<RepoSection> cachyos = cachyos_repo_sections(level);
+    sections.insert(sections.end(), cachyos.begin(), cachyos.end());
+    sections.push_back({"core", "mirrorlist"});
+    sections.push_back({"extra", "mirrorlist"});
+
+    for (const std::string& repo : extra_repos) {
+        if (repo.find("testing") == std::string::npos && repo.rfind("cachyos", 0) != 0) {
+            sections.push_back(extra_repo_section(repo));
+        }
+    }
+    return sections;
+}
+
+std::vector<std::string> mirrorlist_packages(CpuLevel level) {
+    std::vector<std::string> packages = {"cachyos-keyring", "cachyos-mirrorlist"};
+    if (level == CpuLevel::V3) packages.push_back("cachyos-v3-mirrorlist");
+    else if (level == CpuLevel::V4 || level == CpuLevel::Znver4) packages.push_back("cachyos-v4-mirrorlist");
+    return packages;
+}
+
+static std::string architecture_line(CpuLevel level) {
+    if (level == CpuLevel::V3) return "Architecture = x86_64 x86_64_v3";
+    if (level == CpuLevel::V4 || level == CpuLevel::Znver4) return "Architecture = x86_64 x86_64_v4";
+    return "Architecture = x86_64";
+}
+
+std::string pacman_options_section(const std::string& options_source, CpuLevel level) {
+    std::ifstream in(options_source);
+    if (!in.is_open()) return "";
+
+    // Copy [options] from the source, up to its first repo section
+    std::ostringstream out;
+    bool wrote_architecture = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        std::string text = start == std::string::npos ? "" : line.substr(start);
+        if (!text.empty() && text[0] == '[' && text != "[options]") break;
+        if (text.rfind("Architecture", 0) == 0) {
+            out << architecture_line(level) << "\n";
+            wrote_architecture = true;
+            continue;
+        }
+        out << line << "\n";
+    }
+    if (!wrote_architecture) {
+        out << architecture_line(level) << "\n";
+    }
+    return out.str();
+}
+
+std::string pacman_option(const std::string& conf, const std::string& key) {
+    std::ifstream in(conf);
+    bool in_options = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        std::string text = start == std::string::npos ? "" : line.substr(start);
+        if (!text.empty() && text[0] == '[') {
+            in_options = text.rfind("[options]", 0) == 0;
+        } else if (in_options && text.rfind(key, 0) == 0 &&
+                   (text.size() == key.size() || text[key.size()] == ' ' || text[key.size()] == '=')) {
+            size_t equals = text.find('=');
+            if (equals == std::string::npos) return "";
+            std::string value = text.substr(equals + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t") + 1);
+            return value;
+        }
+    }
+    return "";
+}
+
+bool set_pacman_option(const std::string& conf, const std::string& key, const std::string& value) {
+    std::ifstream in(conf);
+    if (!in.is_open()) return false;
+    std::vector<std::string> lines;
+    size_t options_line = std::string::npos;
+    size_t key_line = std::string::npos;
+    bool in_options = false;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t start = line.find_first_not_of(" \t#");
+        std::string text = start == std::string::npos ? "" : line.substr(start);
+        if (!text.empty() && text[0] == '[' && line.find('#') == std::string::npos) {
+            in_options = text.rfind("[options]", 0) == 0;
+            if (in_options) options_line = lines.size();
+        } else if (in_options && key_line == std::string::npos && text.rfind(key, 0) == 0 &&
+                   (text.size() == key.size() || text[key.size()] == ' ' || text[key.size()] == '=')) {
+            key_line = lines.size();
+        }
+        lines.push_back(line);
+    }
+    in.close();
+    if (options_line == std::string::npos) return false;
+    std::string setting = key + " = " + value;
+    if (key_line != std::string::npos) {
+        lines[key_line] = setting;
+    } else {
+        lines.insert(lines.begin() + static_cast<long>(options_line) + 1, setting);
+    }
+
+    std::ofstream out(conf, std::ios::trunc);
+    for (const std::string& kept : lines) out << kept << "\n";
+    out.close();
+    return static_cast<bool>(out);
+}
+
+bool write_target_pacman_conf(const std::string& options_source, CpuLevel level,
+                              const std::vector<std::string>& extra_repos, const std::string& out_path) {
+    std::string options = pacman_options_section(options_source, level);
+    std::ofstream out(out_path);
+    if (options.empty() || !out.is_open()) return false;
+
+    out << options << "\n# Repositories selected by the CachyOS Btrfs Installer for " << cpu_level_name(level) << "\n";
+    for (const RepoSection& section : target_repo_sections(level, extra_repos)) {
+        out << "\n[" << section.name << "]\n"
+            << "Include = /etc/pacman.d/" << section.mirrorlist << "\n";
+    }
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "cpu.h"
+
+#include <string>
+#include <vector>
+
+// A [repo] section of pacman.conf and the mirrorlist it includes.
+struct RepoSection {
+    std::string name;
+    std::string mirrorlist;
+};
+
+// The CachyOS repos for a CPU level, in pacman.conf order: the optimised
+// repos first, then the generic [cachyos] repo they fall back to.
+std::vector<RepoSection> cachyos_repo_sections(CpuLevel level);
+
+// All repo sections for a target: testing repos, CachyOS repos for the CPU
+// level, Arch core/extra, then extra repos such as multilib (REPOS in
+// installer.conf).
+std::vector<RepoSection> target_repo_sections(CpuLevel level, const std::vector<std::string>& extra_repos);
+
+// The mirrorlist packages the target needs to keep its repos up to date.
+std::vector<std::string> mirrorlist_packages(CpuLevel level);
+
+// The [options] section of options_source, up to its first repo section,
+// with the Architecture line for the level. Empty if it cannot be read.
+std::string pacman_options_section(const std::string& options_source, CpuLevel level);
+
+// Sets key = value in the [options] section of conf: on the line that
+// already has key, even commented out, or else right after [options].
+bool set_pacman_option(const std::string& conf, const std::string& key, const std::string& value);
+// The value of key in the [options] section of conf, "" if it is not set
+// (commented out lines do not count)
+std::string pacman_option(const std::string& conf, const std::string& key);
+
+// Writes a pacman.conf with the [options] section of options_source (the
+// Architecture line adjusted for the level) followed by target_repo_sections().
+bool write_target_pacman_conf(const std::string& options_source, CpuLevel level,
+                              const std::vector<std::string>& extra_repos, const std::string& out_path);
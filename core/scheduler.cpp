@@ -0,0 +1,263 @@
+#include "scheduler.h"
+#include "process.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+
+static thread_local int worker_index = -1;
+
+// Cancel requests come from outside and are not signalled, so idle workers
+// look at them this often
+static const std::chrono::milliseconds CANCEL_POLL(200);
+
+int current_worker() {
+    return worker_index;
+}
+
+std::string resource_name(Resource resource) {
+    switch (resource) {
+        case Resource::Disk: return "disk";
+        case Resource::Network: return "network";
+        case Resource::Cpu: return "cpu";
+    }
+    return "";
+}
+
+static int slots(const ResourceLimits& limits, Resource resource) {
+    switch (resource) {
+        case Resource::Disk: return limits.disk;
+        case Resource::Network: return limits.network;
+        case Resource::Cpu: return limits.cpu;
+    }
+    return 0;
+}
+
+static std::string seconds_text(int64_t ns) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.1fs", ns / 1e9);
+    return buffer;
+}
+
+ResourcePool::ResourcePool(const ResourceLimits& limits)
+    : configured(limits),
+      free({{Resource::Disk, limits.disk}, {Resource::Network, limits.network}, {Resource::Cpu, limits.cpu}}) {}
+
+bool ResourcePool::try_acquire(const std::vector<Resource>& resources) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<Resource, int> needed;
+    for (Resource resource : resources) {
+        if (++needed[resource] > free[resource]) return false;
+    }
+    for (Resource resource : resources) --free[resource];
+    return true;
+}
+
+void ResourcePool::release(const std::vector<Resource>& resources) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Resource resource : resources) ++free[resource];
+}
+
+void StepGraph::add(Step step) {
+    steps.push_back(std::move(step));
+}
+
+bool StepGraph::validate(const ResourceLimits& limits, std::string& error) const {
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        if (!index.emplace(steps[i].name, i).second) {
+            error = "Duplicate step " + steps[i].name;
+            return false;
+        }
+    }
+    std::vector<int> waiting_on(steps.size(), 0);
+    std::vector<std::vector<size_t>> dependents(steps.size());
+    for (size_t i = 0; i < steps.size(); ++i) {
+        for (const std::string& name : steps[i].after) {
+            auto it = index.find(name);
+            if (it == index.end()) {
+                error = "Step " + steps[i].name + " runs after unknown step " + name;
+                return false;
+            }
+            ++waiting_on[i];
+            dependents[it->second].push_back(i);
+        }
+        for (Resource resource : {Resource::Disk, Resource::Network, Resource::Cpu}) {
+            if (std::count(steps[i].resources.begin(), steps[i].resources.end(), resource) > slots(limits, resource)) {
+                error = "Step " + steps[i].name + " needs more " + resource_name(resource) + " slots than there are";
+                return false;
+            }
+        }
+    }
+
+    // Kahn's algorithm: whatever is never released sits on a cycle
+    std::vector<size_t> queue;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        if (!waiting_on[i]) queue.push_back(i);
+    }
+    for (size_t next = 0; next < queue.size(); ++next) {
+        for (size_t dependent : dependents[queue[next]]) {
+            if (--waiting_on[dependent] == 0) queue.push_back(dependent);
+        }
+    }
+    if (queue.size() != steps.size()) {
+        for (size_t i = 0; i < steps.size(); ++i) {
+            if (waiting_on[i]) {
+                error = "Step " + steps[i].name + " is part of a dependency cycle";
+                break;
+            }
+        }
+        return false;
+    }
+    return true;
+}
+
+bool StepGraph::run(int workers, ResourcePool& pool, const std::function<bool()>& cancelled,
+                    std::string& error) {
+    if (!validate(pool.limits(), error)) return false;
+
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < steps.size(); ++i) index[steps[i].name] = i;
+    std::vector<std::vector<size_t>> dependencies(steps.size());
+    timings.assign(steps.size(), StepRecord());
+    for (size_t i = 0; i < steps.size(); ++i) {
+        for (const std::string& name : steps[i].after) dependencies[i].push_back(index[name]);
+        timings[i].name = steps[i].name;
+        timings[i].after = steps[i].after;
+    }
+
+    enum class State { Waiting, Running, Done };
+    std::vector<State> state(steps.size(), State::Waiting);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t finished = 0;
+    bool stopping = false;
+    std::string first_error;
+
+    // Takes the step's slots when it can start
+    auto startable = [&](size_t i) {
+        if (state[i] != State::Waiting) return false;
+        for (size_t dependency : dependencies[i]) {
+            if (state[dependency] != State::Done) return false;
+        }
+        return pool.try_acquire(steps[i].resources);
+    };
+
+    auto work = [&](int id) {
+        worker_index = id;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping && finished < steps.size()) {
+            if (cancelled && cancelled()) {
+                stopping = true;
+                first_error = "Installation cancelled";
+                changed.notify_all();
+                break;
+            }
+            size_t pick = 0;
+            while (pick < steps.size() && !startable(pick)) ++pick;
+            if (pick == steps.size()) {
+                changed.wait_for(lock, CANCEL_POLL);
+                continue;
+            }
+
+            state[pick] = State::Running;
+            StepRecord& record = timings[pick];
+            record.ran = true;
+            record.worker = id;
+            record.started_ns = monotonic_ns();
+            lock.unlock();
+
+            std::string step_error;
+            bool ok = steps[pick].run(step_error);
+
+            lock.lock();
+            record.finished_ns = monotonic_ns();
+            record.ok = ok;
+            state[pick] = State::Done;
+            pool.release(steps[pick].resources);
+            ++finished;
+            if (!ok && !stopping) {
+                stopping = true;
+                first_error = step_error.empty() ? "Step " + steps[pick].name + " failed" : step_error;
+            }
+            changed.notify_all();
+        }
+        worker_index = -1;
+    };
+
+    worker_count = std::max(1, workers);
+    run_started_ns = monotonic_ns();
+    std::vector<std::thread> threads;
+    for (int id = 0; id < worker_count; ++id) threads.emplace_back(work, id);
+    for (std::thread& thread : threads) thread.join();
+    run_finished_ns = monotonic_ns();
+
+    for (size_t i = 0; i < steps.size(); ++i) {
+        timings[i].ready_ns = run_started_ns;
+        for (size_t dependency : dependencies[i]) {
+            timings[i].ready_ns = std::max(timings[i].ready_ns, timings[dependency].finished_ns);
+        }
+    }
+
+    if (!first_error.empty()) {
+        error = first_error;
+        return false;
+    }
+    return true;
+}
+
+std::vector<StepRecord> StepGraph::critical_path() const {
+    std::map<std::string, const StepRecord*> by_name;
+    const StepRecord* last = nullptr;
+    for (const StepRecord& record : timings) {
+        if (!record.ran) continue;
+        by_name[record.name] = &record;
+        if (!last || record.finished_ns > last->finished_ns) last = &record;
+    }
+
+    std::vector<StepRecord> path;
+    while (last) {
+        path.push_back(*last);
+        const StepRecord* previous = nullptr;
+        for (const std::string& name : last->after) {
+            auto it = by_name.find(name);
+            if (it != by_name.end() && (!previous || it->second->finished_ns > previous->finished_ns)) {
+                previous = it->second;
+            }
+        }
+        last = previous;
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+std::vector<std::string> StepGraph::critical_path_report() const {
+    std::vector<StepRecord> path = critical_path();
+    if (path.empty()) return {};
+
+    int64_t step_total = 0;
+    for (const StepRecord& record : timings) {
+        if (record.ran) step_total += record.finished_ns - record.started_ns;
+    }
+    int64_t path_total = 0;
+    for (const StepRecord& record : path) path_total += record.finished_ns - record.ready_ns;
+
+    std::vector<std::string> lines;
+    lines.push_back("Critical path: " + seconds_text(path_total) + " of " + seconds_text(run_finished_ns - run_started_ns) +
+                    " wall time; steps took " + seconds_text(step_total) + " in total on " +
+                    std::to_string(worker_count) + " workers");
+    for (const StepRecord& record : path) {
+        std::string line = "  " + record.name + " " + seconds_text(record.finished_ns - record.started_ns);
+        // Ready but held back by busy resources or workers
+        if (record.started_ns - record.ready_ns >= 100000000) {
+            line += " (waited " + seconds_text(record.started_ns - record.ready_ns) + " for a free slot)";
+        }
+        if (!record.ok) line += " FAILED";
+        lines.push_back(line);
+    }
+    return lines;
+}
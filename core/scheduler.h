@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// What a step keeps busy while it runs. Steps needing the same resource
+// share its slots, so two disk-heavy steps do not fight over one device
+// while a download and a CPU-bound step run beside them.
+enum class Resource { Disk, Network, Cpu };
+
+std::string resource_name(Resource resource);   // "disk", "network", "cpu"
+
+// Slots per resource. A step listing a resource twice takes two slots.
+struct ResourceLimits {
+    int disk = 2;       // mkfs.vfat next to mkfs.btrfs is fine, a third writer is not
+    int network = 1;
+    int cpu = 1;
+};
+
+// The free slots of each resource. One pool can be shared by several graphs
+// running at once (a batch of disks), which then throttle each other.
+class ResourcePool {
+public:
+    explicit ResourcePool(const ResourceLimits& limits);
+
+    const ResourceLimits& limits() const { return configured; }
+    // All of resources or none of them
+    bool try_acquire(const std::vector<Resource>& resources);
+    void release(const std::vector<Resource>& resources);
+
+private:
+    ResourceLimits configured;
+    std::mutex mutex;
+    std::map<Resource, int> free;
+};
+
+struct Step {
+    std::string name;
+    std::vector<std::string> after;         // steps that must finish first
+    std::vector<Resource> resources;
+    std::function<bool(std::string& error)> run;
+};
+
+// When and where one step ran, filled in by StepGraph::run()
+struct StepRecord {
+    std::string name;
+    std::vector<std::string> after;
+    bool ran = false;           // false if the run stopped before it started
+    bool ok = false;
+    int worker = -1;
+    int64_t ready_ns = 0;       // CLOCK_MONOTONIC; its last dependency finished
+    int64_t started_ns = 0;
+    int64_t finished_ns = 0;
+};
+
+// A dependency graph of steps run by a fixed pool of worker threads. A step
+// starts once every step in its `after` list has finished and its resources
+// have free slots; among ready steps the one added first goes first. After
+// a failure or a cancel no new step starts, the running ones are waited
+// for and run() returns the first error.
+class StepGraph {
+public:
+    void add(Step step);
+    // Known dependency names, no cycles, no step needing more slots than exist
+    bool validate(const ResourceLimits& limits, std::string& error) const;
+    // cancelled may be empty; it is polled between steps. Slots freed by
+    // another graph on the same pool are noticed within the poll interval.
+    bool run(int workers, ResourcePool& pool, const std::function<bool()>& cancelled, std::string& error);
+
+    const std::vector<StepRecord>& records() const { return timings; }
+    // The chain of steps that decided the wall time: from the last step to
+    // finish back through whichever of its dependencies finished last
+    std::vector<StepRecord> critical_path() const;
+    // Log lines: wall time against the total step time, then each step on
+    // the critical path with its run time and any wait for a free slot
+    std::vector<std::string> critical_path_report() const;
+
+private:
+    std::vector<Step> steps;
+    std::vector<StepRecord> timings;
+    int worker_count = 0;
+    int64_t run_started_ns = 0;
+    int64_t run_finished_ns = 0;
+};
+
+// Index of the worker thread running the calling step, -1 outside a step
+int current_worker();
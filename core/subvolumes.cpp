@@ -0,0 +1,201 @@
+#include "subvolumes.h"
+#include "btrfs.h"
+#include "log.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <set>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+std::vector<SubvolumeSpec> default_subvolume_layout() {
+    // Package cache and temporary files are already compressed or short
+    // lived; machines holds VM and container images that rewrite in place
+    return {
+        {"@", "/", "zstd", 0, false, ""},
+        {"@home", "/home", "zstd", 0, false, ""},
+        {"@root", "/root", "zstd", 0, false, ""},
+        {"@srv", "/srv", "zstd", 0, false, ""},
+        {"@cache", "/var/cache", "none", 0, false, ""},
+        {"@tmp", "/var/tmp", "none", 0, false, ""},
+        {"@log", "/var/log", "zstd", 0, false, ""},
+        {"@var/lib/portables", "/var/lib/portables", "zstd", 0, false, ""},
+        {"@var/lib/machines", "/var/lib/machines", "none", 0, true, ""},
+    };
+}
+
+std::string format_compression(const SubvolumeSpec& spec) {
+    if (spec.level > 0) return spec.compression + ":" + std::to_string(spec.level);
+    return spec.compression;
+}
+
+bool parse_compression(const std::string& text, SubvolumeSpec& spec, std::string& error) {
+    std::string algorithm = text.substr(0, text.find(':'));
+    int level = 0;
+    if (text.find(':') != std::string::npos) {
+        try {
+            level = std::stoi(text.substr(text.find(':') + 1));
+        } catch (...) {
+            level = -1;
+        }
+    }
+
+    int max_level = algorithm == "zstd" ? 15 : algorithm == "zlib" ? 9 : 0;
+    if (algorithm != "zstd" && algorithm != "zlib" && algorithm != "lzo" && algorithm != "none") {
+        error = "unknown compression '" + text + "' (zstd[:level], zlib[:level], lzo or none)";
+        return false;
+    }
+    if (level < 0 || level > max_level) {
+        error = "bad compression level in '" + text + "'";
+        return false;
+    }
+    spec.compression = algorithm;
+    spec.level = level;
+    return true;
+}
+
+bool parse_subvolume_spec(const std::string& text, SubvolumeSpec& spec, std::string& error) {
+    std::istringstream stream(text);
+    std::string compression, cow;
+    SubvolumeSpec parsed;
+    if (!(stream >> parsed.name >> parsed.mount_point >> compression >> cow)) {
+        error = "subvolume entry '" + text + "' needs: name mount-point compression cow|nodatacow [options]";
+        return false;
+    }
+    stream >> parsed.options;
+    if (!parse_compression(compression, parsed, error)) return false;
+    if (cow != "cow" && cow != "nodatacow") {
+        error = "subvolume entry '" + text + "': expected cow or nodatacow, got '" + cow + "'";
+        return false;
+    }
+    parsed.nodatacow = cow == "nodatacow";
+    spec = parsed;
+    return true;
+}
+
+std::string format_subvolume_spec(const SubvolumeSpec& spec) {
+    std::string text = spec.name + " " + spec.mount_point + " " + format_compression(spec) + " " +
+                       (spec.nodatacow ? "nodatacow" : "cow");
+    if (!spec.options.empty()) text += " " + spec.options;
+    return text;
+}
+
+const SubvolumeSpec* root_subvolume(const std::vector<SubvolumeSpec>& layout) {
+    auto root = std::find_if(layout.begin(), layout.end(), [](const SubvolumeSpec& spec) { return spec.mount_point == "/"; });
+    return root == layout.end() ? nullptr : &*root;
+}
+
+bool validate_subvolume_layout(const std::vector<SubvolumeSpec>& layout, std::string& error) {
+    if (!root_subvolume(layout)) {
+        error = "the subvolume layout has no entry for /";
+        return false;
+    }
+
+    std::set<std::string> names, mount_points;
+    for (const SubvolumeSpec& spec : layout) {
+        if (spec.name.empty() || spec.name[0] != '@' || spec.name.find("..") != std::string::npos ||
+            spec.name.back() == '/') {
+            error = "bad subvolume name '" + spec.name + "'";
+            return false;
+        }
+        if (spec.mount_point.empty() || spec.mount_point[0] != '/') {
+            error = "mount point for " + spec.name + " must be absolute";
+            return false;
+        }
+        if (spec.options.find("subvol") != std::string::npos) {
+            error = "extra options for " + spec.name + " must not set subvol";
+            return false;
+        }
+        if (!names.insert(spec.name).second || !mount_points.insert(spec.mount_point).second) {
+            error = "duplicate subvolume " + spec.name + " or mount point " + spec.mount_point;
+            return false;
+        }
+        if (spec.mount_point != "/" && spec.level > 0) {
+            core_log("Warning: compression level on " + spec.name +
+                     " is ignored, btrfs uses the level of / for the whole filesystem");
+        }
+        if (spec.nodatacow && spec.compression != "none") {
+            core_log("Warning: " + spec.name + " is nodatacow, its data will not be compressed");
+        }
+    }
+    return true;
+}
+
+std::string filesystem_options(const std::vector<SubvolumeSpec>& layout, int level,
+                               const std::vector<std::string>& device_options) {
+    const SubvolumeSpec* root = root_subvolume(layout);
+    std::string options = "noatime";
+    if (root && root->compression != "none") {
+        int root_level = root->level > 0 ? root->level : level;
+        options += ",compress=" + root->compression;
+        if (root->compression != "lzo" && root_level > 0) options += ":" + std::to_string(root_level);
+    }
+    for (const std::string& option : device_options) {
+        options += "," + option;
+    }
+    return options;
+}
+
+std::string subvolume_mount_options(const SubvolumeSpec& spec, const std::string& fs_options) {
+    std::string options = "subvol=" + spec.name + "," + fs_options;
+    if (!spec.options.empty()) options += "," + spec.options;
+    return options;
+}
+
+std::string target_path(const std::string& target_root, const std::string& mount_point) {
+    return mount_point == "/" ? target_root : target_root + mount_point;
+}
+
+static size_t path_depth(const std::string& path) {
+    if (path == "/") return 0;
+    return std::count(path.begin(), path.end(), '/');
+}
+
+std::vector<SubvolumeSpec> mount_order(const std::vector<SubvolumeSpec>& layout) {
+    std::vector<SubvolumeSpec> ordered = layout;
+    std::stable_sort(ordered.begin(), ordered.end(), [](const SubvolumeSpec& a, const SubvolumeSpec& b) {
+        return path_depth(a.mount_point) < path_depth(b.mount_point);
+    });
+    return ordered;
+}
+
+bool create_subvolume_layout(const std::string& top_level, const std::vector<SubvolumeSpec>& layout, std::string& error) {
+    const SubvolumeSpec* root = root_subvolume(layout);
+    for (const SubvolumeSpec& spec : layout) {
+        std::string path = top_level + "/" + spec.name;
+        std::error_code ec;
+        fs::create_directories(fs::path(path).parent_path(), ec);
+        if (ec) {
+            error = "mkdir " + fs::path(path).parent_path().string() + ": " + ec.message();
+            return false;
+        }
+        if (!fs::exists(path) && !create_subvolume(path, error)) return false;
+
+        std::string warning;
+        if (spec.nodatacow && !set_nocow(path, warning)) {
+            core_log("Warning: " + warning);
+        }
+        if (root && spec.compression != root->compression && !spec.nodatacow &&
+            !set_compression_property(path, spec.compression, warning)) {
+            core_log("Warning: " + warning);
+        }
+    }
+    return true;
+}
+
+std::string fstab_entries(const std::vector<SubvolumeSpec>& layout, const std::string& uuid, const std::string& fs_options) {
+    std::string entries;
+    for (const SubvolumeSpec& spec : mount_order(layout)) {
+        entries += "UUID=" + uuid + " " + spec.mount_point + " btrfs rw," + subvolume_mount_options(spec, fs_options) + " 0 0\n";
+    }
+    return entries;
+}
+
+std::vector<std::string> zstd_mount_points(const std::vector<SubvolumeSpec>& layout) {
+    std::vector<std::string> mount_points;
+    for (const SubvolumeSpec& spec : layout) {
+        if (spec.compression == "zstd" && !spec.nodatacow) mount_points.push_back(spec.mount_point);
+    }
+    return mount_points;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// One row of the subvolume layout. Subvolume creation, the install-time
+// mounts and fstab are all generated from the layout table.
+//
+// btrfs applies mount options such as compress= to the whole filesystem,
+// from whichever subvolume is mounted first, so the "/" entry's compression
+// is the filesystem default and goes on every fstab line. Entries that
+// differ get the btrfs.compression property (and nodatacow the NOCOW
+// attribute) on their empty subvolume, which everything written there
+// inherits. Compression levels are per filesystem: a level on any entry
+// other than "/" is ignored with a warning.
+struct SubvolumeSpec {
+    std::string name;                   // "@home"; nested names like "@var/lib/machines" work
+    std::string mount_point;            // absolute, inside the target
+    std::string compression = "zstd";   // zstd, zlib, lzo or none
+    int level = 0;                      // 0: the installer's chosen level
+    bool nodatacow = false;
+    std::string options;                // extra mount options, comma separated
+};
+
+std::vector<SubvolumeSpec> default_subvolume_layout();
+
+// The installer.conf form, one SUBVOLUME= line per entry:
+//   <name> <mount point> <zstd[:level]|zlib[:level]|lzo|none> <cow|nodatacow> [extra,options]
+bool parse_subvolume_spec(const std::string& text, SubvolumeSpec& spec, std::string& error);
+std::string format_subvolume_spec(const SubvolumeSpec& spec);
+// "zstd:3", "lzo", "none"; parse_compression accepts the same forms
+std::string format_compression(const SubvolumeSpec& spec);
+bool parse_compression(const std::string& text, SubvolumeSpec& spec, std::string& error);
+
+// Needs a "/" entry, unique names and mount points, names starting with @
+// and absolute mount points. Ignored per-entry levels are logged.
+bool validate_subvolume_layout(const std::vector<SubvolumeSpec>& layout, std::string& error);
+const SubvolumeSpec* root_subvolume(const std::vector<SubvolumeSpec>& layout);
+
+// Filesystem-wide options taken from the "/" entry, e.g.
+// "noatime,compress=zstd:3", followed by device_options (ssd, discard=async,
+// ...); level is used when the entry has none.
+std::string filesystem_options(const std::vector<SubvolumeSpec>& layout, int level,
+                               const std::vector<std::string>& device_options = {});
+// "subvol=<name>," + filesystem options + the entry's extra options
+std::string subvolume_mount_options(const SubvolumeSpec& spec, const std::string& fs_options);
+
+// Where mount_point ends up below target_root ("/mnt", "/var" -> "/mnt/var")
+std::string target_path(const std::string& target_root, const std::string& mount_point);
+
+// Entries sorted so every mount point comes after its parents
+std::vector<SubvolumeSpec> mount_order(const std::vector<SubvolumeSpec>& layout);
+
+// Creates every subvolume below top_level (the mounted subvolid=5 root),
+// with parent directories for nested names, then applies the per-entry
+// NOCOW and compression attributes. Attribute failures are only logged.
+// Subvolumes that already exist are kept, so a resumed install can run it
+// again.
+bool create_subvolume_layout(const std::string& top_level, const std::vector<SubvolumeSpec>& layout, std::string& error);
+
+std::string fstab_entries(const std::vector<SubvolumeSpec>& layout, const std::string& uuid, const std::string& fs_options);
+
+// Mount points whose data is stored with zstd, for the recompression service
+std::vector<std::string> zstd_mount_points(const std::vector<SubvolumeSpec>& layout);
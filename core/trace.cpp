@@ -0,0 +1,295 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+static const char* BEGIN_MARKER = "@@trace-begin ";
+static const char* END_MARKER = "@@trace-end ";
+
+// Chrome trace thread ids: one track per stage, per worker and per script job
+static const int STAGE_TID = 1;
+static const int WORKER_TID = 100;
+static const int SCRIPT_TID = 200;
+
+std::string json_string(const std::string& value) {
+    std::string out = "\"";
+    for (unsigned char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    out += buffer;
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    return out + "\"";
+}
+
+static std::string json_argv(const std::vector<std::string>& argv) {
+    std::string out = "[";
+    for (size_t i = 0; i < argv.size(); ++i) {
+        if (i) out += ",";
+        out += json_string(argv[i]);
+    }
+    return out + "]";
+}
+
+static const char* kind_name(SpanKind kind) {
+    switch (kind) {
+        case SpanKind::Step: return "step";
+        case SpanKind::Command: return "command";
+        case SpanKind::ScriptStep: return "script_step";
+    }
+    return "";
+}
+
+// "sudo pacstrap ..." is reported as pacstrap
+static std::string program_name(const std::vector<std::string>& argv) {
+    size_t index = (argv.size() > 1 && argv[0] == "sudo") ? 1 : 0;
+    if (argv.empty()) return "";
+    std::string program = argv[index];
+    size_t slash = program.rfind('/');
+    return slash == std::string::npos ? program : program.substr(slash + 1);
+}
+
+static bool write_file(const std::string& path, const std::string& content, std::string& error) {
+    std::ofstream file(path);
+    file << content;
+    if (!file) {
+        error = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+void InstallTrace::record_step(const std::string& name, const std::string& stage, int64_t started_ns,
+                               int64_t finished_ns, bool ok, int lane) {
+    std::lock_guard<std::mutex> lock(mutex);
+    TraceSpan span;
+    span.kind = SpanKind::Step;
+    span.stage = stage;
+    span.name = name;
+    span.started_ns = started_ns;
+    span.finished_ns = finished_ns;
+    span.exit_code = ok ? 0 : 1;
+    span.lane = lane;
+    spans.push_back(span);
+}
+
+void InstallTrace::record(const ProcessResult& result, const std::string& stage, int lane) {
+    std::lock_guard<std::mutex> lock(mutex);
+    TraceSpan span;
+    span.stage = stage;
+    span.name = program_name(result.argv);
+    span.argv = result.argv;
+    span.started_ns = result.started_ns;
+    span.finished_ns = result.finished_ns ? result.finished_ns : result.started_ns;
+    span.exit_code = result.exit_code;
+    span.output_bytes = result.stdout_bytes + result.stderr_bytes;
+    span.lane = lane;
+    spans.push_back(span);
+}
+
+bool InstallTrace::feed_line(const std::string& line, const std::string& stage) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t now = monotonic_ns();
+    if (line.rfind(BEGIN_MARKER, 0) == 0) {
+        // The lowest job lane no open step is using
+        std::set<int> used;
+        for (const auto& [name, step] : open_steps) used.insert(step.lane);
+        int lane = 0;
+        while (used.count(lane)) ++lane;
+
+        TraceSpan step;
+        step.kind = SpanKind::ScriptStep;
+        step.stage = stage;
+        step.name = line.substr(std::char_traits<char>::length(BEGIN_MARKER));
+        step.started_ns = now;
+        step.lane = lane;
+        open_steps[step.name] = step;
+        return true;
+    }
+    if (line.rfind(END_MARKER, 0) == 0) {
+        std::istringstream fields(line.substr(std::char_traits<char>::length(END_MARKER)));
+        int status = -1;
+        fields >> status;
+        std::string name;
+        std::getline(fields >> std::ws, name);
+        auto it = open_steps.find(name);
+        if (it != open_steps.end()) {
+            it->second.finished_ns = now;
+            it->second.exit_code = status;
+            spans.push_back(it->second);
+            open_steps.erase(it);
+        }
+        return true;
+    }
+    // Parallel jobs share one output stream; only a lone step owns its lines
+    if (open_steps.size() == 1) open_steps.begin()->second.output_bytes += line.size() + 1;
+    return false;
+}
+
+void InstallTrace::set_critical_path(const std::vector<std::string>& steps) {
+    std::lock_guard<std::mutex> lock(mutex);
+    critical = steps;
+}
+
+// Caller holds the mutex
+std::vector<TraceSpan> InstallTrace::stage_spans() const {
+    std::vector<TraceSpan> stages;
+    for (const TraceSpan& span : spans) {
+        if (span.kind != SpanKind::Step) continue;
+        auto it = std::find_if(stages.begin(), stages.end(), [&](const TraceSpan& stage) { return stage.name == span.stage; });
+        if (it == stages.end()) {
+            TraceSpan stage;
+            stage.kind = SpanKind::Step;
+            stage.stage = span.stage;
+            stage.name = span.stage;
+            stage.started_ns = span.started_ns;
+            stage.finished_ns = span.finished_ns;
+            stage.exit_code = span.exit_code;
+            stages.push_back(stage);
+        } else {
+            it->started_ns = std::min(it->started_ns, span.started_ns);
+            it->finished_ns = std::max(it->finished_ns, span.finished_ns);
+            it->exit_code = std::max(it->exit_code, span.exit_code);
+        }
+    }
+    std::sort(stages.begin(), stages.end(), [](const TraceSpan& a, const TraceSpan& b) { return a.started_ns < b.started_ns; });
+    return stages;
+}
+
+bool InstallTrace::write_chrome_trace(const std::string& path, std::string& error) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TraceSpan> stages = stage_spans();
+    int64_t origin = 0;
+    for (const TraceSpan& span : spans) {
+        if (!origin || span.started_ns < origin) origin = span.started_ns;
+    }
+
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    std::set<int> named;
+    auto track = [&](int tid, const std::string& name) {
+        if (!named.insert(tid).second) return;
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+            << ",\"name\":\"thread_name\",\"args\":{\"name\":" << json_string(name) << "}}";
+        first = false;
+    };
+    // Complete ("X") events in microseconds
+    auto event = [&](const TraceSpan& span, int tid) {
+        char times[96];
+        std::snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", (span.started_ns - origin) / 1e3,
+                      (span.finished_ns - span.started_ns) / 1e3);
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"name\":" << json_string(span.name)
+            << ",\"cat\":" << json_string(span.stage) << "," << times << ",\"args\":{\"exit_code\":" << span.exit_code;
+        if (span.kind != SpanKind::Step) {
+            out << ",\"argv\":" << json_argv(span.argv) << ",\"output_bytes\":" << span.output_bytes;
+        }
+        out << "}}";
+        first = false;
+    };
+
+    for (size_t i = 0; i < stages.size(); ++i) {
+        track(STAGE_TID + static_cast<int>(i), "stage: " + stages[i].name);
+        event(stages[i], STAGE_TID + static_cast<int>(i));
+    }
+    for (const TraceSpan& span : spans) {
+        if (span.kind == SpanKind::ScriptStep) {
+            track(SCRIPT_TID + span.lane, "script job " + std::to_string(span.lane + 1));
+            event(span, SCRIPT_TID + span.lane);
+        } else {
+            int lane = std::max(0, span.lane);
+            track(WORKER_TID + lane, "worker " + std::to_string(lane + 1));
+            event(span, WORKER_TID + lane);
+        }
+    }
+    out << "\n]}\n";
+    return write_file(path, out.str(), error);
+}
+
+std::vector<std::pair<std::string, double>> InstallTrace::stage_seconds() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::pair<std::string, double>> seconds;
+    for (const TraceSpan& span : stage_spans()) {
+        seconds.emplace_back(span.name, (span.finished_ns - span.started_ns) / 1e9);
+    }
+    return seconds;
+}
+
+bool InstallTrace::write_summary(const std::string& path, std::string& error) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    struct StageTotals {
+        int commands = 0;
+        int failed = 0;
+        uint64_t output_bytes = 0;
+    };
+    std::map<std::string, StageTotals> totals;
+    int64_t first = 0;
+    int64_t last = 0;
+    for (const TraceSpan& span : spans) {
+        if (!first || span.started_ns < first) first = span.started_ns;
+        last = std::max(last, span.finished_ns);
+        if (span.kind != SpanKind::Command) continue;
+        StageTotals& stage_totals = totals[span.stage];
+        ++stage_totals.commands;
+        if (span.exit_code != 0) ++stage_totals.failed;
+        stage_totals.output_bytes += span.output_bytes;
+    }
+
+    char number[32];
+    auto seconds = [&number](int64_t ns) {
+        std::snprintf(number, sizeof(number), "%.3f", ns / 1e9);
+        return std::string(number);
+    };
+
+    std::vector<TraceSpan> stages = stage_spans();
+    std::ostringstream out;
+    out << "{\n\"total_seconds\":" << seconds(last - first) << ",\n\"critical_path\":" << json_argv(critical)
+        << ",\n\"stages\":[";
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const TraceSpan& span = stages[i];
+        const StageTotals& stage_totals = totals[span.name];
+        out << (i ? ",\n" : "\n") << "{\"name\":" << json_string(span.name)
+            << ",\"started_ns\":" << span.started_ns << ",\"finished_ns\":" << span.finished_ns
+            << ",\"seconds\":" << seconds(span.finished_ns - span.started_ns)
+            << ",\"commands\":" << stage_totals.commands << ",\"failed\":" << stage_totals.failed
+            << ",\"output_bytes\":" << stage_totals.output_bytes << "}";
+    }
+    out << "\n],\n\"spans\":[";
+    for (size_t i = 0; i < spans.size(); ++i) {
+        const TraceSpan& span = spans[i];
+        out << (i ? ",\n" : "\n") << "{\"kind\":\"" << kind_name(span.kind) << "\",\"stage\":" << json_string(span.stage)
+            << ",\"name\":" << json_string(span.name) << ",\"lane\":" << span.lane
+            << ",\"argv\":" << json_argv(span.argv)
+            << ",\"started_ns\":" << span.started_ns << ",\"finished_ns\":" << span.finished_ns
+            << ",\"seconds\":" << seconds(span.finished_ns - span.started_ns)
+            << ",\"exit_code\":" << span.exit_code << ",\"output_bytes\":" << span.output_bytes << "}";
+    }
+    out << "\n]\n}\n";
+    return write_file(path, out.str(), error);
+}
+
+std::string script_trace_functions() {
+    return std::string("run_step() {\n"
+                       "    local name=$1\n"
+                       "    shift\n"
+                       "    echo \"") + BEGIN_MARKER + "$name\"\n"
+           "    \"$@\"\n"
+           "    local status=$?\n"
+           "    echo \"" + END_MARKER + "$status $name\"\n"
+           "    return $status\n"
+           "}\n";
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "process.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class SpanKind {
+    Step,           // a step of the installer's step graph
+    Command,        // one program the installer ran
+    ScriptStep,     // a run_step section of a generated script
+};
+
+struct TraceSpan {
+    SpanKind kind = SpanKind::Command;
+    std::string stage;                // InstallStage name of the step it belongs to
+    std::string name;                 // step name, program basename or script step name
+    std::vector<std::string> argv;    // commands only
+    int64_t started_ns = 0;           // CLOCK_MONOTONIC
+    int64_t finished_ns = 0;
+    int exit_code = -1;               // steps: 0 ok, 1 failed
+    uint64_t output_bytes = 0;        // stdout + stderr
+    int lane = 0;                     // worker thread, or parallel script job
+};
+
+// Timing record of one installation, written next to installation_log.txt:
+// - Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev): a track
+//   per stage, one per worker thread with its steps and their commands
+//   nested inside, and one per parallel job of the chroot script;
+// - a summary JSON with per-stage totals, the critical path and every
+//   span, for comparing runs.
+// Stages overlap when their steps run concurrently; a stage spans its
+// first step's start to its last step's end. Thread safe.
+class InstallTrace {
+public:
+    void record_step(const std::string& name, const std::string& stage, int64_t started_ns, int64_t finished_ns,
+                     bool ok, int lane);
+    void record(const ProcessResult& result, const std::string& stage, int lane);
+    // Output of a script using script_trace_functions(): marker lines open
+    // and close script step spans timed on arrival, other lines count as
+    // output of the open step when only one is open. Returns true for
+    // marker lines.
+    bool feed_line(const std::string& line, const std::string& stage);
+    void set_critical_path(const std::vector<std::string>& steps);
+    // First start to last end of each stage seen so far, in seconds
+    std::vector<std::pair<std::string, double>> stage_seconds() const;
+
+    bool write_chrome_trace(const std::string& path, std::string& error) const;
+    bool write_summary(const std::string& path, std::string& error) const;
+
+private:
+    std::vector<TraceSpan> stage_spans() const;
+
+    mutable std::mutex mutex;
+    std::vector<TraceSpan> spans;
+    std::map<std::string, TraceSpan> open_steps;   // script steps by name
+    std::vector<std::string> critical;
+};
+
+// value as a quoted JSON string, for the other JSON reports
+std::string json_string(const std::string& value);
+
+inline constexpr const char* TRACE_FILE = "installation_trace.json";
+inline constexpr const char* TRACE_SUMMARY_FILE = "installation_summary.json";
+
+// bash functions for the top of a generated script. `run_step NAME CMD...`
+// runs CMD between begin and end markers for NAME, the end marker carrying
+// its exit status, and returns that status. Steps can run as background
+// jobs (`run_step NAME CMD &`) and overlap.
+std::string script_trace_functions();
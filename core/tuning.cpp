@@ -0,0 +1,108 @@
+#include "tuning.h"
+#include "process.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const uint32_t SHALLOW_QUEUE = 32;
+
+static const char* KERNEL_FEATURES = "/sys/fs/btrfs/features";
+
+// /sys/fs/btrfs/features uses underscores where mkfs uses dashes. Without
+// the directory (btrfs not loaded) only free-space-tree, which every
+// kernel since 4.5 mounts, is assumed.
+static bool kernel_supports(const std::string& feature) {
+    if (!fs::exists(KERNEL_FEATURES)) return feature == "free-space-tree";
+    std::string name = feature;
+    std::replace(name.begin(), name.end(), '-', '_');
+    return fs::exists(fs::path(KERNEL_FEATURES) / name);
+}
+
+std::vector<std::string> mkfs_btrfs_features() {
+    if (!fs::exists(KERNEL_FEATURES)) run_quietly({"modprobe", "btrfs"});
+
+    ProcessOptions options;
+    options.stdin_mode = StdinMode::Null;
+    options.capture = true;
+    options.elevate = false;
+    ProcessResult result = run_process({"mkfs.btrfs", "-O", "list-all"}, options);
+
+    // "free-space-tree     - free space tree ... (compat=4.5, ...)" on
+    // stderr with older btrfs-progs, stdout with newer ones
+    std::vector<std::string> features;
+    std::istringstream lines(result.stdout_text + "\n" + result.stderr_text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.find(" - ") == std::string::npos) continue;
+        std::string name = line.substr(0, line.find_first_of(" \t"));
+        if (!name.empty() && kernel_supports(name)) features.push_back(name);
+    }
+    return features;
+}
+
+BtrfsTuning choose_btrfs_tuning(const DiskGeometry& geometry, const std::vector<std::string>& supported_features) {
+    BtrfsTuning tuning;
+    uint32_t page_size = static_cast<uint32_t>(sysconf(_SC_PAGESIZE));
+    if (geometry.physical_sector > tuning.sectorsize && geometry.physical_sector <= page_size) {
+        tuning.sectorsize = geometry.physical_sector;
+    }
+    if (geometry.physical_sector > tuning.nodesize && geometry.physical_sector <= 65536) {
+        tuning.nodesize = geometry.physical_sector;
+    }
+    tuning.nodesize = std::max(tuning.nodesize, tuning.sectorsize);
+
+    auto supported = [&](const char* feature) {
+        return std::find(supported_features.begin(), supported_features.end(), feature) != supported_features.end();
+    };
+    for (const char* feature : {"free-space-tree", "block-group-tree"}) {
+        if (supported(feature)) tuning.features.push_back(feature);
+    }
+    if (!supported("free-space-tree")) tuning.mount_options.push_back("space_cache=v2");
+
+    bool discard = geometry.discard_max_bytes > 0 && geometry.discard_granularity > 0;
+    bool shallow = geometry.nr_requests > 0 && geometry.nr_requests <= SHALLOW_QUEUE;
+    tuning.mount_options.push_back(geometry.rotational ? "nossd" : "ssd");
+    if (discard && !geometry.rotational) tuning.mount_options.push_back("discard=async");
+    if (geometry.rotational) {
+        tuning.mount_options.push_back("commit=120");
+    } else if (shallow) {
+        tuning.mount_options.push_back("commit=60");
+    }
+
+    tuning.reason = std::string(geometry.rotational ? "rotational" : "non-rotational") +
+                    ", " + std::to_string(geometry.physical_sector) + " byte physical blocks" +
+                    ", queue depth " + (geometry.nr_requests ? std::to_string(geometry.nr_requests) : "unknown") +
+                    (discard ? ", discard granularity " + std::to_string(geometry.discard_granularity) : ", no discard");
+    return tuning;
+}
+
+static std::string join(const std::vector<std::string>& items) {
+    std::string joined;
+    for (const std::string& item : items) {
+        if (!joined.empty()) joined += ",";
+        joined += item;
+    }
+    return joined;
+}
+
+std::vector<std::string> mkfs_btrfs_args(const BtrfsTuning& tuning, const std::string& device) {
+    std::vector<std::string> args = {"mkfs.btrfs", "-f",
+                                     "--sectorsize", std::to_string(tuning.sectorsize),
+                                     "--nodesize", std::to_string(tuning.nodesize)};
+    if (!tuning.features.empty()) {
+        args.push_back("-O");
+        args.push_back(join(tuning.features));
+    }
+    args.push_back(device);
+    return args;
+}
+
+std::string describe_btrfs_tuning(const BtrfsTuning& tuning) {
+    return "sectorsize " + std::to_string(tuning.sectorsize) + ", nodesize " + std::to_string(tuning.nodesize) +
+           ", features " + (tuning.features.empty() ? "default" : join(tuning.features)) +
+           ", mount options " + join(tuning.mount_options) + " (" + tuning.reason + ")";
+}
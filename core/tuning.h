@@ -0,0 +1,34 @@
+#pragma once
+
+#include "disk.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// mkfs.btrfs parameters and mount options chosen from what the target disk
+// reports in sysfs. The mount options go into the install mounts and fstab
+// alike, so the installed system keeps them.
+struct BtrfsTuning {
+    uint32_t sectorsize = 4096;
+    uint32_t nodesize = 16384;
+    std::vector<std::string> features;       // mkfs.btrfs -O
+    std::vector<std::string> mount_options;  // ssd/nossd, discard=async, commit=N, ...
+    std::string reason;                      // what the choice was based on, for the log
+};
+
+// Features this mkfs.btrfs can create (`mkfs.btrfs -O list-all`) that the
+// running kernel can also mount (/sys/fs/btrfs/features)
+std::vector<std::string> mkfs_btrfs_features();
+
+// - sectorsize 4K, or the physical block size when larger and no larger
+//   than the page size; nodesize 16K unless the physical block is larger
+// - free-space-tree and block-group-tree when available (fast mounts on
+//   big filesystems); space_cache=v2 as a mount option otherwise
+// - ssd or nossd from rotational, discard=async when the device discards
+// - a longer commit interval on rotational disks and shallow queues
+//   (nr_requests <= 32, typically USB and SD), fewer forced flushes
+BtrfsTuning choose_btrfs_tuning(const DiskGeometry& geometry, const std::vector<std::string>& supported_features);
+
+std::vector<std::string> mkfs_btrfs_args(const BtrfsTuning& tuning, const std::string& device);
+std::string describe_btrfs_tuning(const BtrfsTuning& tuning);
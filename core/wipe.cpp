@@ -0,0 +1,278 @@
+#include "wipe.h"
+#include "disk.h"
+#include "log.h"
+#include "process.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/fs.h>
+#include <linux/nvme_ioctl.h>
+#include <regex>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Discard this much per ioctl so progress can be reported
+static const uint64_t DISCARD_CHUNK = 1ULL << 30;
+
+static const uint8_t NVME_ADMIN_GET_LOG_PAGE = 0x02;
+static const uint8_t NVME_ADMIN_IDENTIFY = 0x06;
+static const uint8_t NVME_ADMIN_FORMAT_NVM = 0x80;
+static const uint8_t NVME_ADMIN_SANITIZE = 0x84;
+static const uint32_t NVME_NSID_ALL = 0xffffffff;
+
+// How long the Sanitize Status log may report anything but "in progress"
+// or a result before the sanitize is given up on
+static const int NVME_SANITIZE_START_TIMEOUT_S = 60;
+
+std::string wipe_mode_name(WipeMode mode) {
+    switch (mode) {
+        case WipeMode::Signatures: return "signatures";
+        case WipeMode::Discard: return "discard";
+        case WipeMode::NvmeFormat: return "nvme-format";
+        case WipeMode::NvmeSanitize: return "nvme-sanitize";
+    }
+    return "signatures";
+}
+
+bool parse_wipe_mode(const std::string& name, WipeMode& mode) {
+    for (WipeMode candidate : {WipeMode::Signatures, WipeMode::Discard, WipeMode::NvmeFormat, WipeMode::NvmeSanitize}) {
+        if (name == wipe_mode_name(candidate)) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool discard_device(int fd, const DiskGeometry& geometry, const WipeProgress& progress, std::string& error) {
+    uint64_t chunk = std::min(DISCARD_CHUNK, geometry.discard_max_bytes);
+    if (geometry.discard_granularity > 0) {
+        chunk = std::max(geometry.discard_granularity, chunk - chunk % geometry.discard_granularity);
+    }
+    for (uint64_t offset = 0; offset < geometry.size_bytes; offset += chunk) {
+        uint64_t range[2] = {offset, std::min(chunk, geometry.size_bytes - offset)};
+        if (ioctl(fd, BLKDISCARD, range) != 0) {
+            error = "discard at " + std::to_string(offset) + ": " + std::strerror(errno);
+            return false;
+        }
+        if (progress) progress(offset + range[1], geometry.size_bytes);
+    }
+    return true;
+}
+
+static bool nvme_admin(int fd, nvme_passthru_cmd& cmd, std::string& error) {
+    int rc = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    if (rc < 0) {
+        error = std::strerror(errno);
+        return false;
+    }
+    if (rc > 0) {
+        char status[32];
+        snprintf(status, sizeof(status), "NVMe status 0x%x", rc);
+        error = status;
+        return false;
+    }
+    return true;
+}
+
+struct NvmeCapabilities {
+    bool format = false;
+    bool format_crypto = false;
+    bool format_all = false;        // a format (or its secure erase) covers every namespace
+    bool sanitize_block = false;
+    bool sanitize_crypto = false;
+    uint32_t nsid = 0;
+    uint8_t lba_format = 0;
+};
+
+static bool identify_nvme(int fd, NvmeCapabilities& caps) {
+    int nsid = ioctl(fd, NVME_IOCTL_ID);
+    if (nsid <= 0) return false;
+    caps.nsid = nsid;
+
+    uint8_t ctrl[4096] = {};
+    nvme_passthru_cmd cmd{};
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.addr = reinterpret_cast<uintptr_t>(ctrl);
+    cmd.data_len = sizeof(ctrl);
+    cmd.cdw10 = 1;  // CNS 1: identify controller
+    std::string error;
+    if (!nvme_admin(fd, cmd, error)) return false;
+    uint16_t oacs = ctrl[256] | (ctrl[257] << 8);
+    uint32_t sanicap = ctrl[328] | (ctrl[329] << 8) | (ctrl[330] << 16) | (ctrl[331] << 24);
+    caps.format = oacs & (1 << 1);
+    // FNA bits 0-1: format and secure erase apply to all namespaces
+    caps.format_all = ctrl[524] & 0x03;
+    caps.format_crypto = ctrl[524] & (1 << 2);
+    caps.sanitize_crypto = sanicap & (1 << 0);
+    caps.sanitize_block = sanicap & (1 << 1);
+
+    uint8_t ns[4096] = {};
+    cmd = {};
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = caps.nsid;
+    cmd.addr = reinterpret_cast<uintptr_t>(ns);
+    cmd.data_len = sizeof(ns);
+    cmd.cdw10 = 0;  // CNS 0: identify namespace
+    if (!nvme_admin(fd, cmd, error)) return false;
+    // FLBAS: format index in bits 0-3, upper bits 5-6 for more than 16 formats
+    caps.lba_format = (ns[26] & 0x0f) | ((ns[26] & 0x60) >> 1);
+    return true;
+}
+
+static bool nvme_format(int fd, const NvmeCapabilities& caps, std::string& error) {
+    nvme_passthru_cmd cmd{};
+    cmd.opcode = NVME_ADMIN_FORMAT_NVM;
+    cmd.nsid = caps.nsid;
+    // Keep the current LBA format; SES 2 = cryptographic erase, 1 = user data erase
+    uint32_t ses = caps.format_crypto ? 2 : 1;
+    cmd.cdw10 = (caps.lba_format & 0x0f) | ((caps.lba_format & 0x30) << 8) | (ses << 9);
+    cmd.timeout_ms = 30 * 60 * 1000;
+    return nvme_admin(fd, cmd, error);
+}
+
+static bool nvme_sanitize(int fd, const NvmeCapabilities& caps, const WipeProgress& progress, std::string& error) {
+    nvme_passthru_cmd cmd{};
+    cmd.opcode = NVME_ADMIN_SANITIZE;
+    cmd.nsid = NVME_NSID_ALL;
+    cmd.cdw10 = caps.sanitize_crypto ? 4 : 2;   // SANACT: crypto erase or block erase
+    if (!nvme_admin(fd, cmd, error)) return false;
+
+    // Sanitize runs in the background; poll the Sanitize Status log (0x81).
+    // SSTAT: 0 never sanitized, 1 completed, 2 in progress, 3 failed,
+    // 4 completed without deallocation. The log may not show the new
+    // operation right after the command, so 0 and unknown states get a
+    // grace period; only 2 keeps the loop going indefinitely.
+    int waited_s = 0;
+    while (true) {
+        uint8_t log[512] = {};
+        cmd = {};
+        cmd.opcode = NVME_ADMIN_GET_LOG_PAGE;
+        cmd.nsid = NVME_NSID_ALL;
+        cmd.addr = reinterpret_cast<uintptr_t>(log);
+        cmd.data_len = sizeof(log);
+        cmd.cdw10 = 0x81 | (((sizeof(log) / 4) - 1) << 16);
+        if (!nvme_admin(fd, cmd, error)) return false;
+        uint16_t sprog = log[0] | (log[1] << 8);
+        uint8_t state = log[2] & 0x07;
+        if (state == 1 || state == 4) break;
+        if (state == 3) {
+            error = "sanitize failed";
+            return false;
+        }
+        if (state == 2) {
+            waited_s = 0;
+        } else if (++waited_s > NVME_SANITIZE_START_TIMEOUT_S) {
+            error = "sanitize did not start (status " + std::to_string(state) + " after " +
+                    std::to_string(NVME_SANITIZE_START_TIMEOUT_S) + "s)";
+            return false;
+        }
+        if (progress) progress(sprog, 65535);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    if (progress) progress(65535, 65535);
+    return true;
+}
+
+// The other namespaces of device's controller (or of its subsystem, with
+// native multipath), each with " (in use: <where>)" if it is mounted or swap
+static std::vector<std::string> other_namespaces(const std::string& device) {
+    std::string name = block_device_name(device);
+    std::error_code ec;
+    fs::path controller = fs::canonical("/sys/block/" + name + "/device", ec);
+    std::vector<std::string> others;
+    if (ec) return others;
+    static const std::regex namespace_name("nvme[0-9]+n[0-9]+");
+    for (const fs::directory_entry& entry : fs::directory_iterator(controller, ec)) {
+        std::string entry_name = entry.path().filename().string();
+        if (entry_name == name || !std::regex_match(entry_name, namespace_name)) continue;
+        std::string other = "/dev/" + entry_name, mounted_at;
+        others.push_back(disk_in_use(other, mounted_at) ? other + " (in use: " + mounted_at + ")" : other);
+    }
+    std::sort(others.begin(), others.end());
+    return others;
+}
+
+static std::string join(const std::vector<std::string>& items) {
+    std::string joined;
+    for (const std::string& item : items) joined += (joined.empty() ? "" : ", ") + item;
+    return joined;
+}
+
+bool wipe_disk(const std::string& device, WipeMode mode, const WipeProgress& progress, std::string& error) {
+    if (mode == WipeMode::Signatures) return true;
+
+    DiskGeometry geometry;
+    if (!read_disk_geometry(device, geometry, error)) return false;
+    int fd = open(device.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        error = "open " + device + ": " + std::strerror(errno);
+        return false;
+    }
+
+    int64_t started = monotonic_ns();
+    std::string done_with;
+    bool ok = true;
+    if (mode == WipeMode::NvmeFormat || mode == WipeMode::NvmeSanitize) {
+        NvmeCapabilities caps;
+        // Sanitize, and format where FNA says so, erase every namespace on
+        // the controller: only done when the target is the only one
+        bool sanitize = false, format = false;
+        if (!identify_nvme(fd, caps)) {
+            core_log(device + " is not an NVMe namespace, using discard instead of " + wipe_mode_name(mode));
+        } else {
+            std::vector<std::string> others = other_namespaces(device);
+            sanitize = mode == WipeMode::NvmeSanitize && (caps.sanitize_block || caps.sanitize_crypto);
+            if (sanitize && !others.empty()) {
+                core_log("Not sanitizing " + device + ", it would also erase " + join(others));
+                sanitize = false;
+            }
+            format = !sanitize && caps.format;
+            if (format && caps.format_all && !others.empty()) {
+                core_log("Not formatting " + device + ", it would also erase " + join(others));
+                format = false;
+            }
+        }
+        if (sanitize) {
+            core_log("Sanitizing " + device + " (" + (caps.sanitize_crypto ? "crypto" : "block") + " erase)");
+            ok = nvme_sanitize(fd, caps, progress, error);
+            done_with = "NVMe sanitize";
+        } else if (format) {
+            if (mode == WipeMode::NvmeSanitize) core_log(device + " cannot be sanitized, formatting instead");
+            core_log("Formatting " + device + " (" + (caps.format_crypto ? "crypto" : "user data") + " erase)");
+            ok = nvme_format(fd, caps, error);
+            done_with = "NVMe format";
+        } else if (caps.nsid != 0) {
+            core_log("Using discard on " + device + " instead of " + wipe_mode_name(mode));
+        }
+    }
+
+    if (done_with.empty()) {
+        if (geometry.discard_max_bytes == 0) {
+            core_log(device + (geometry.rotational ? " is a rotational disk" : " does not support discard") +
+                     ", skipping the discard pass");
+            close(fd);
+            return true;
+        }
+        core_log("Discarding all blocks on " + device);
+        ok = discard_device(fd, geometry, progress, error);
+        done_with = "Discard";
+    }
+    close(fd);
+
+    if (!ok) {
+        error = done_with + " of " + device + " failed: " + error;
+        return false;
+    }
+    core_log(done_with + " of " + device + " took " + std::to_string((monotonic_ns() - started) / 1000000) + "ms");
+    return true;
+}
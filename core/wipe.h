@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// What to do with the old contents of the target disk after the partition
+// table and filesystem signatures are gone (wipefs -a always runs first).
+enum class WipeMode {
+    Signatures,     // nothing more
+    Discard,        // BLKDISCARD the whole device so the FTL starts empty
+    NvmeFormat,     // NVMe Format NVM with user data erase
+    NvmeSanitize,   // NVMe Sanitize (block erase); affects every namespace
+};
+
+std::string wipe_mode_name(WipeMode mode);
+// "signatures", "discard", "nvme-format", "nvme-sanitize"
+bool parse_wipe_mode(const std::string& name, WipeMode& mode);
+
+using WipeProgress = std::function<void(uint64_t done, uint64_t total)>;
+
+// Runs the requested wipe, falling back to the next weaker mode the device
+// supports: sanitize/format -> discard -> nothing (rotational disks, or
+// devices without discard). Commands that would erase every namespace on
+// the controller are only sent when the target is its only namespace. Only an error from a mode the device claims to
+// support is a failure. The time taken is logged.
+bool wipe_disk(const std::string& device, WipeMode mode, const WipeProgress& progress, std::string& error);
@@ -8,7 +8,6 @@
 #include <QTextEdit>
 #include <QInputDialog>
 #include <QMessageBox>
-#include <QProcess>
 #include <QPalette>
 #include <QPixmap>
 #include <QStringList>
@@ -26,11 +25,186 @@
 #include <QPlainTextEdit>
 #include <QScrollBar>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QTextStream>
 #include <QSettings>
 #include <QScrollArea>
 #include <QFormLayout>
 #include <QButtonGroup>
+#include <QSpinBox>
+#include <QThread>
+#include <QCloseEvent>
+#include <QTableWidget>
+#include <QHeaderView>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#include "config.h"
+#include "installer.h"
+#include "log.h"
+#include "progress.h"
+#include "subvolumes.h"
+
+// Output console built for full pacstrap runs (hundreds of thousands of
+// lines). Lines are queued and appended once per frame, the view keeps at
+// most MAX_LINES blocks, and the log file stays open and gets one write
+// per batch. The same number of recent lines is kept so the errors and
+// warnings filter can rebuild the view; memory stays flat however long
+// the install runs.
+class LogPane : public QWidget {
+public:
+    LogPane(const QString &logPath, QWidget *parent = nullptr) : QWidget(parent) {
+        QVBoxLayout *layout = new QVBoxLayout(this);
+        layout->setContentsMargins(0, 0, 0, 0);
+        view = new QPlainTextEdit(this);
+        view->setReadOnly(true);
+        view->setUndoRedoEnabled(false);
+        view->setMaximumBlockCount(MAX_LINES);
+        view->setStyleSheet(
+            "QPlainTextEdit {"
+            "background-color: black;"
+            "color: lime;"
+            "font-family: monospace;"
+            "border: 2px solid gold;"
+            "}"
+        );
+        layout->addWidget(view);
+        problemsOnly = new QCheckBox("Show errors and warnings only", this);
+        connect(problemsOnly, &QCheckBox::toggled, this, [this]() { rebuild(); });
+        layout->addWidget(problemsOnly);
+
+        flushTimer.setSingleShot(true);
+        flushTimer.setInterval(FRAME_MS);
+        connect(&flushTimer, &QTimer::timeout, this, [this]() { flush(); });
+
+        logFile.setFileName(logPath);
+        logFile.open(QIODevice::WriteOnly | QIODevice::Text);
+    }
+
+    ~LogPane() override {
+        flush();
+    }
+
+    bool fileOpen() const { return logFile.isOpen(); }
+
+    void append(const QString &line) {
+        pending << line;
+        if (!flushTimer.isActive()) flushTimer.start();
+    }
+
+private:
+    static bool isProblem(const QString &line) {
+        return line.contains("error", Qt::CaseInsensitive) || line.contains("warning", Qt::CaseInsensitive) ||
+               line.contains("failed", Qt::CaseInsensitive);
+    }
+
+    void flush() {
+        if (pending.isEmpty()) return;
+        if (logFile.isOpen()) {
+            logFile.write((pending.join("\n") + "\n").toUtf8());
+            logFile.flush();
+        }
+
+        QStringList shown;
+        for (const QString &line : pending) {
+            recent.push_back(line);
+            if (!problemsOnly->isChecked() || isProblem(line)) shown << line;
+        }
+        while (recent.size() > MAX_LINES) recent.pop_front();
+        pending.clear();
+
+        if (!shown.isEmpty()) {
+            // Only follow the output if the user has not scrolled up to read
+            QScrollBar *scrollBar = view->verticalScrollBar();
+            bool atBottom = scrollBar->value() == scrollBar->maximum();
+            view->appendPlainText(shown.join("\n"));
+            if (atBottom) scrollBar->setValue(scrollBar->maximum());
+        }
+    }
+
+    void rebuild() {
+        flush();
+        QStringList shown;
+        for (const QString &line : recent) {
+            if (!problemsOnly->isChecked() || isProblem(line)) shown << line;
+        }
+        view->setPlainText(shown.join("\n"));
+        view->verticalScrollBar()->setValue(view->verticalScrollBar()->maximum());
+    }
+
+    static const int MAX_LINES = 20000;
+    static const int FRAME_MS = 16;
+
+    QPlainTextEdit *view;
+    QCheckBox *problemsOnly;
+    QTimer flushTimer;
+    QFile logFile;
+    QStringList pending;
+    std::deque<QString> recent;
+};
+
+// Runs the installation on its own thread so the window keeps painting and
+// command output streams in as it arrives. Everything it needs is copied
+// into an InstallConfig up front; it talks back only through signals, which
+// the installer's own worker threads emit as well. Setting the shared cancel
+// flag takes effect at the next step boundary, never inside a command.
+class InstallWorker : public QObject {
+    Q_OBJECT
+public:
+    InstallWorker(const InstallConfig &config, std::shared_ptr<std::atomic<bool>> cancelRequested)
+        : config(config), cancelRequested(std::move(cancelRequested)) {}
+
+signals:
+    void outputLine(const QString &line);
+    void statusChanged(const QString &status);
+    void progressChanged(int percent);
+    void cpuLevelResolved(const QString &level);
+    void finished(bool ok, const QString &message);
+
+public slots:
+    void run() {
+        InstallerEvents events;
+        events.output = [this](const std::string &line) {
+            emit outputLine(QString::fromStdString(line));
+        };
+        events.progress = [this]() { reportProgress(); };
+        events.cpu_level = [this](const std::string &level) {
+            emit cpuLevelResolved(QString::fromStdString(level));
+        };
+        std::shared_ptr<std::atomic<bool>> cancelled = cancelRequested;
+        events.cancelled = [cancelled]() { return cancelled->load(); };
+
+        Installer install(config, InstallerOptions(), events);
+        installer = &install;
+        std::string error;
+        bool ok = install.run(error);
+        reportProgress(true);
+        installer = nullptr;
+        emit finished(ok, ok ? "Installation complete!" : QString::fromStdString(error));
+    }
+
+private:
+    static const qint64 REPORT_INTERVAL_MS = 200;
+
+    // At most a few updates a second; pacstrap prints thousands of lines
+    void reportProgress(bool force = false) {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        if (!force && sinceReport.isValid() && sinceReport.elapsed() < REPORT_INTERVAL_MS) return;
+        sinceReport.start();
+        emit progressChanged(static_cast<int>(installer->fraction() * 100));
+        emit statusChanged(QString::fromStdString(installer->status()));
+    }
+
+    InstallConfig config;
+    std::shared_ptr<std::atomic<bool>> cancelRequested;
+    Installer *installer = nullptr;
+    std::mutex reportMutex;
+    QElapsedTimer sinceReport;
+};
 
 class InstallerWindow : public QMainWindow {
     Q_OBJECT
@@ -73,17 +247,8 @@ public:
         mainLayout->addWidget(configGroup);
 
         // Output console
-        outputText = new QTextEdit(this);
-        outputText->setReadOnly(true);
-        outputText->setStyleSheet(
-            "QTextEdit {"
-            "background-color: black;"
-            "color: lime;"
-            "font-family: monospace;"
-            "border: 2px solid gold;"
-            "}"
-        );
-        mainLayout->addWidget(outputText);
+        logPane = new LogPane("installation_log.txt", this);
+        mainLayout->addWidget(logPane);
 
         // Progress bar
         progressBar = new QProgressBar(this);
@@ -101,6 +266,8 @@ public:
             "}"
         );
         mainLayout->addWidget(progressBar);
+        stallTimer.setInterval(1000);
+        connect(&stallTimer, &QTimer::timeout, this, &InstallerWindow::showStall);
 
         // Buttons
         QHBoxLayout *buttonLayout = new QHBoxLayout();
@@ -124,15 +291,26 @@ public:
         connect(quitButton, &QPushButton::clicked, qApp, &QApplication::quit);
         buttonLayout->addWidget(quitButton);
 
+        cancelButton = new QPushButton("Cancel", this);
+        cancelButton->setStyleSheet(startButton->styleSheet());
+        cancelButton->setEnabled(false);
+        connect(cancelButton, &QPushButton::clicked, this, &InstallerWindow::cancelInstallation);
+        buttonLayout->addWidget(cancelButton);
+
         mainLayout->addLayout(buttonLayout);
 
         setCentralWidget(centralWidget);
 
         // Initialize log file
-        logFile.setFileName("installation_log.txt");
-        if (!logFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (!logPane->fileOpen()) {
             logMessage("Could not open log file!");
         }
+
+        // Core code logs from the worker thread too; hop to the GUI thread
+        set_log_sink([this](const std::string &message) {
+            QString line = QString::fromStdString(message);
+            QMetaObject::invokeMethod(this, [this, line]() { logMessage(line); }, Qt::QueuedConnection);
+        });
     }
 
 private slots:
@@ -142,14 +320,50 @@ private slots:
             QMessageBox::warning(this, "Error", "Please select a target disk");
             return;
         }
+        std::vector<SubvolumeSpec> layout;
+        std::string layoutError;
+        if (!subvolumeRows(layout, layoutError)) {
+            QMessageBox::warning(this, "Error", QString::fromStdString(layoutError));
+            return;
+        }
 
         // Disable UI during installation
         startButton->setEnabled(false);
         quitButton->setEnabled(false);
+        cancelButton->setEnabled(true);
         configGroup->setEnabled(false);
+        progressBar->setValue(0);
+        sinceOutput.start();
+        stallTimer.start();
 
         // Start installation
-        QTimer::singleShot(0, this, &InstallerWindow::performInstallation);
+        QThread *thread = new QThread(this);
+        cancelRequested = std::make_shared<std::atomic<bool>>(false);
+        InstallWorker *worker = new InstallWorker(currentConfig(), cancelRequested);
+        worker->moveToThread(thread);
+        connect(thread, &QThread::started, worker, &InstallWorker::run);
+        connect(worker, &InstallWorker::outputLine, this, [this](const QString &line) {
+            sinceOutput.start();
+            logMessage(line);
+        });
+        connect(worker, &InstallWorker::statusChanged, this, [this](const QString &status) {
+            progressStatus = status;
+            progressBar->setFormat(status + " - %p%");
+        });
+        connect(worker, &InstallWorker::progressChanged, progressBar, &QProgressBar::setValue);
+        connect(worker, &InstallWorker::cpuLevelResolved, cpuLevelCombo, &QComboBox::setCurrentText);
+        connect(worker, &InstallWorker::finished, this, &InstallerWindow::installationFinished);
+        connect(worker, &InstallWorker::finished, thread, &QThread::quit);
+        connect(thread, &QThread::finished, worker, &QObject::deleteLater);
+        connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+        thread->start();
+    }
+
+    void cancelInstallation() {
+        if (!cancelRequested) return;
+        logMessage("Cancelling after the current step...");
+        cancelButton->setEnabled(false);
+        *cancelRequested = true;
     }
 
 private:
@@ -212,9 +426,70 @@ private:
         desktopCombo->setCurrentIndex(0);
         formLayout->addRow("Desktop Environment:", desktopCombo);
 
+        // Gaming packages
+        gamingCheck = new QCheckBox("Install cachyos-gaming-meta", this);
+        formLayout->addRow("Gaming:", gamingCheck);
+
+        // Optimised repositories
+        cpuLevelCombo = new QComboBox(this);
+        cpuLevelCombo->addItems({"auto", "x86-64", "x86-64-v2", "x86-64-v3", "x86-64-v4", "znver4"});
+        cpuLevelCombo->setCurrentIndex(0);
+        formLayout->addRow("CPU Optimisation Level:", cpuLevelCombo);
+
+        // Extra repositories
+        reposEdit = new QLineEdit(this);
+        reposEdit->setPlaceholderText("e.g. multilib,testing");
+        formLayout->addRow("Extra Repositories:", reposEdit);
+
         // Compression Level
-        compressionSpin = new QLineEdit("3", this);
-        formLayout->addRow("Btrfs Compression Level (1-22):", compressionSpin);
+        compressionSpin = new QLineEdit("auto", this);
+        compressionSpin->setPlaceholderText("auto, or 1-15");
+        formLayout->addRow("Btrfs Compression Level (auto or 1-15):", compressionSpin);
+        fastInstallCheck = new QCheckBox("Install at zstd:1 and recompress after first boot", this);
+        formLayout->addRow("Fast Install:", fastInstallCheck);
+
+        // What happens to the old data on the disk
+        wipeModeCombo = new QComboBox(this);
+        wipeModeCombo->addItems({"discard", "signatures", "nvme-format", "nvme-sanitize"});
+        wipeModeCombo->setCurrentIndex(0);
+        formLayout->addRow("Disk Wipe:", wipeModeCombo);
+
+        // Partition sizes
+        espSizeSpin = new QSpinBox(this);
+        espSizeSpin->setRange(100, 4096);
+        espSizeSpin->setValue(512);
+        formLayout->addRow("EFI Partition Size (MiB):", espSizeSpin);
+        swapSizeSpin = new QSpinBox(this);
+        swapSizeSpin->setRange(0, 131072);
+        swapSizeSpin->setValue(0);
+        formLayout->addRow("Swap Partition Size (MiB, 0 = none):", swapSizeSpin);
+
+        // Subvolume layout: creation, mounts and fstab all come from this table
+        QWidget *subvolumeWidget = new QWidget(this);
+        QVBoxLayout *subvolumeLayout = new QVBoxLayout(subvolumeWidget);
+        subvolumeTable = new QTableWidget(0, 5, this);
+        subvolumeTable->setHorizontalHeaderLabels({"Subvolume", "Mount Point", "Compression", "NoCoW", "Extra Options"});
+        subvolumeTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+        subvolumeTable->setMinimumHeight(220);
+        subvolumeLayout->addWidget(subvolumeTable);
+        QHBoxLayout *subvolumeButtons = new QHBoxLayout();
+        QPushButton *addSubvolumeButton = new QPushButton("Add", this);
+        connect(addSubvolumeButton, &QPushButton::clicked, this, [this]() {
+            addSubvolumeRow({"@new", "/new", "zstd", 0, false, ""});
+        });
+        subvolumeButtons->addWidget(addSubvolumeButton);
+        QPushButton *removeSubvolumeButton = new QPushButton("Remove", this);
+        connect(removeSubvolumeButton, &QPushButton::clicked, this, [this]() {
+            if (subvolumeTable->currentRow() >= 0) subvolumeTable->removeRow(subvolumeTable->currentRow());
+        });
+        subvolumeButtons->addWidget(removeSubvolumeButton);
+        QPushButton *defaultSubvolumesButton = new QPushButton("Defaults", this);
+        connect(defaultSubvolumesButton, &QPushButton::clicked, this, [this]() {
+            setSubvolumeRows(default_subvolume_layout());
+        });
+        subvolumeButtons->addWidget(defaultSubvolumesButton);
+        subvolumeLayout->addLayout(subvolumeButtons);
+        formLayout->addRow("Btrfs Subvolumes:", subvolumeWidget);
 
         // Locale
         localeEdit = new QLineEdit("en_GB.UTF-8", this);
@@ -224,16 +499,51 @@ private:
         loadConfig();
     }
 
+    void addSubvolumeRow(const SubvolumeSpec &spec) {
+        int row = subvolumeTable->rowCount();
+        subvolumeTable->insertRow(row);
+        subvolumeTable->setItem(row, 0, new QTableWidgetItem(QString::fromStdString(spec.name)));
+        subvolumeTable->setItem(row, 1, new QTableWidgetItem(QString::fromStdString(spec.mount_point)));
+        subvolumeTable->setItem(row, 2, new QTableWidgetItem(QString::fromStdString(format_compression(spec))));
+        QTableWidgetItem *nocow = new QTableWidgetItem(QString());
+        nocow->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled | Qt::ItemIsSelectable);
+        nocow->setCheckState(spec.nodatacow ? Qt::Checked : Qt::Unchecked);
+        subvolumeTable->setItem(row, 3, nocow);
+        subvolumeTable->setItem(row, 4, new QTableWidgetItem(QString::fromStdString(spec.options)));
+    }
+
+    void setSubvolumeRows(const std::vector<SubvolumeSpec> &layout) {
+        subvolumeTable->setRowCount(0);
+        for (const SubvolumeSpec &spec : layout) {
+            addSubvolumeRow(spec);
+        }
+    }
+
+    bool subvolumeRows(std::vector<SubvolumeSpec> &layout, std::string &error) const {
+        layout.clear();
+        for (int row = 0; row < subvolumeTable->rowCount(); ++row) {
+            auto cell = [this, row](int column) {
+                QTableWidgetItem *item = subvolumeTable->item(row, column);
+                return item ? item->text().trimmed().toStdString() : std::string();
+            };
+            SubvolumeSpec spec;
+            spec.name = cell(0);
+            spec.mount_point = cell(1);
+            spec.options = cell(4);
+            spec.nodatacow = subvolumeTable->item(row, 3) && subvolumeTable->item(row, 3)->checkState() == Qt::Checked;
+            if (!parse_compression(cell(2), spec, error)) return false;
+            layout.push_back(spec);
+        }
+        return validate_subvolume_layout(layout, error);
+    }
+
     void populateDisks() {
-        QProcess lsblk;
-        lsblk.start("lsblk", QStringList() << "-d" << "-o" << "NAME,SIZE" << "-n" << "-l");
-        if (lsblk.waitForFinished()) {
-            QString output = lsblk.readAllStandardOutput();
-            foreach (const QString &line, output.split('\n', Qt::SkipEmptyParts)) {
-                QStringList parts = line.trimmed().split(' ');
-                if (parts.size() >= 2 && !parts[0].startsWith("loop")) {
-                    targetDiskCombo->addItem("/dev/" + parts[0] + " (" + parts[1] + ")");
-                }
+        std::istringstream output(capture_process({"lsblk", "-d", "-o", "NAME,SIZE", "-n", "-l"}));
+        std::string line;
+        while (std::getline(output, line)) {
+            QStringList parts = QString::fromStdString(line).trimmed().split(' ', Qt::SkipEmptyParts);
+            if (parts.size() >= 2 && !parts[0].startsWith("loop")) {
+                targetDiskCombo->addItem("/dev/" + parts[0] + " (" + parts[1] + ")");
             }
         }
     }
@@ -249,7 +559,21 @@ private:
         initramfsCombo->setCurrentText(settings.value("initramfs", "mkinitcpio").toString());
         bootloaderCombo->setCurrentText(settings.value("bootloader", "GRUB").toString());
         desktopCombo->setCurrentText(settings.value("desktop", "KDE Plasma").toString());
-        compressionSpin->setText(settings.value("compression", "3").toString());
+        gamingCheck->setChecked(settings.value("gaming", false).toBool());
+        fastInstallCheck->setChecked(settings.value("fastInstall", false).toBool());
+        cpuLevelCombo->setCurrentText(settings.value("cpuLevel", "auto").toString());
+        reposEdit->setText(settings.value("repos").toString());
+        compressionSpin->setText(settings.value("compression", "auto").toString());
+        wipeModeCombo->setCurrentText(settings.value("wipeMode", "discard").toString());
+        espSizeSpin->setValue(settings.value("espSize", 512).toInt());
+        swapSizeSpin->setValue(settings.value("swapSize", 0).toInt());
+        std::vector<SubvolumeSpec> layout;
+        for (const QString &line : settings.value("subvolumes").toStringList()) {
+            SubvolumeSpec spec;
+            std::string error;
+            if (parse_subvolume_spec(line.toStdString(), spec, error)) layout.push_back(spec);
+        }
+        setSubvolumeRows(layout.empty() ? default_subvolume_layout() : layout);
         localeEdit->setText(settings.value("locale", "en_GB.UTF-8").toString());
     }
 
@@ -264,392 +588,97 @@ private:
         settings.setValue("initramfs", initramfsCombo->currentText());
         settings.setValue("bootloader", bootloaderCombo->currentText());
         settings.setValue("desktop", desktopCombo->currentText());
+        settings.setValue("gaming", gamingCheck->isChecked());
+        settings.setValue("fastInstall", fastInstallCheck->isChecked());
+        settings.setValue("cpuLevel", cpuLevelCombo->currentText());
+        settings.setValue("repos", reposEdit->text());
         settings.setValue("compression", compressionSpin->text());
+        settings.setValue("wipeMode", wipeModeCombo->currentText());
+        settings.setValue("espSize", espSizeSpin->value());
+        settings.setValue("swapSize", swapSizeSpin->value());
+        QStringList subvolumes;
+        std::vector<SubvolumeSpec> layout;
+        std::string error;
+        if (subvolumeRows(layout, error)) {
+            for (const SubvolumeSpec &spec : layout) {
+                subvolumes << QString::fromStdString(format_subvolume_spec(spec));
+            }
+            settings.setValue("subvolumes", subvolumes);
+        }
         settings.setValue("locale", localeEdit->text());
     }
 
+    InstallConfig currentConfig() const {
+        InstallConfig config;
+        config.target_disk = targetDiskCombo->currentText().split(' ').first().toStdString();
+        config.hostname = hostnameEdit->text().toStdString();
+        config.timezone = timezoneEdit->text().toStdString();
+        config.keymap = keymapEdit->text().toStdString();
+        config.user_name = usernameEdit->text().toStdString();
+        config.user_password = userPasswordEdit->text().toStdString();
+        config.root_password = rootPasswordEdit->text().toStdString();
+        config.desktop_env = desktopCombo->currentText().toStdString();
+        config.kernel_type = kernelCombo->currentText().toStdString();
+        config.initramfs = initramfsCombo->currentText().toStdString();
+        config.bootloader = bootloaderCombo->currentText().toStdString();
+        config.locale_lang = localeEdit->text().toStdString();
+        config.install_gaming = gamingCheck->isChecked();
+        config.cpu_level = cpuLevelCombo->currentText().toStdString();
+        for (const QString &repo : reposEdit->text().split(',', Qt::SkipEmptyParts)) {
+            config.repos.push_back(repo.trimmed().toStdString());
+        }
+        config.compression_level = compressionSpin->text().toInt();
+        config.wipe_mode = wipeModeCombo->currentText().toStdString();
+        config.esp_size_mib = espSizeSpin->value();
+        config.swap_size_mib = swapSizeSpin->value();
+        config.fast_install = fastInstallCheck->isChecked();
+        std::vector<SubvolumeSpec> layout;
+        std::string error;
+        if (subvolumeRows(layout, error)) config.subvolumes = layout;
+        return config;
+    }
+
     void logMessage(const QString &message) {
         QString timestamped = QString("[%1] %2").arg(QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"), message);
-        outputText->append(timestamped);
-        QTextStream out(&logFile);
-        out << timestamped << "\n";
-        outputText->verticalScrollBar()->setValue(outputText->verticalScrollBar()->maximum());
+        logPane->append(timestamped);
     }
 
-    void executeCommand(const QString &cmd) {
-        logMessage("[EXEC] " + cmd);
-        QProcess process;
-        process.start("bash", QStringList() << "-c" << cmd);
-        if (!process.waitForFinished(-1)) {
-            logMessage("Error executing: " + cmd);
-            QMessageBox::critical(this, "Error", "Command failed: " + cmd);
-            return;
-        }
-        logMessage(process.readAllStandardOutput());
-        if (process.exitCode() != 0) {
-            logMessage("Command failed with exit code: " + QString::number(process.exitCode()));
-            logMessage(process.readAllStandardError());
+    // The worker is blocked inside a command while it is silent, so the
+    // window notices a stall itself
+    void showStall() {
+        qint64 idle = sinceOutput.elapsed() / 1000;
+        if (idle >= PROGRESS_STALL_SECONDS) {
+            progressBar->setFormat(progressStatus + QString(" | no output for %1s - %p%").arg(idle));
         }
     }
 
-    void performInstallation() {
-        const int TOTAL_STEPS = 15;
-        int currentStep = 0;
-
-        // Extract disk name from combo box (remove size info)
-        QString targetDisk = targetDiskCombo->currentText().split(' ').first();
-
-        // Wipe disk
-        logMessage("Wiping disk");
-        executeCommand("sudo wipefs -a " + targetDisk);
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Partition names
-        QString bootPart = targetDisk + (targetDisk.contains("nvme") ? "p1" : "1");
-        QString rootPart = targetDisk + (targetDisk.contains("nvme") ? "p2" : "2");
-
-        // Partitioning
-        logMessage("Partitioning disk");
-        executeCommand("sudo parted -s " + targetDisk + " mklabel gpt");
-        executeCommand("sudo parted -s " + targetDisk + " mkpart primary 1MiB 513MiB");
-        executeCommand("sudo parted -s " + targetDisk + " set 1 esp on");
-        executeCommand("sudo parted -s " + targetDisk + " mkpart primary 513MiB 100%");
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Formatting
-        logMessage("Formatting partitions");
-        executeCommand("sudo mkfs.vfat -F32 " + bootPart);
-        executeCommand("sudo mkfs.btrfs -f " + rootPart);
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Mounting and subvolumes
-        logMessage("Setting up Btrfs subvolumes");
-        executeCommand("sudo mount " + rootPart + " /mnt");
-        executeCommand("sudo btrfs subvolume create /mnt/@");
-        executeCommand("sudo btrfs subvolume create /mnt/@home");
-        executeCommand("sudo btrfs subvolume create /mnt/@root");
-        executeCommand("sudo btrfs subvolume create /mnt/@srv");
-        executeCommand("sudo btrfs subvolume create /mnt/@cache");
-        executeCommand("sudo btrfs subvolume create /mnt/@tmp");
-        executeCommand("sudo btrfs subvolume create /mnt/@log");
-        executeCommand("sudo umount /mnt");
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Remount with compression
-        logMessage("Mounting with compression");
-        int compression = compressionSpin->text().toInt();
-        executeCommand("sudo mount -o subvol=@,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt");
-        executeCommand("sudo mkdir -p /mnt/boot/efi");
-        executeCommand("sudo mount " + bootPart + " /mnt/boot/efi");
-        executeCommand("sudo mkdir -p /mnt/home");
-        executeCommand("sudo mkdir -p /mnt/root");
-        executeCommand("sudo mkdir -p /mnt/srv");
-        executeCommand("sudo mkdir -p /mnt/tmp");
-        executeCommand("sudo mkdir -p /mnt/var/cache");
-        executeCommand("sudo mkdir -p /mnt/var/log");
-        executeCommand("sudo mount -o subvol=@home,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt/home");
-        executeCommand("sudo mount -o subvol=@root,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt/root");
-        executeCommand("sudo mount -o subvol=@srv,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt/srv");
-        executeCommand("sudo mount -o subvol=@tmp,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt/tmp");
-        executeCommand("sudo mount -o subvol=@cache,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt/var/cache");
-        executeCommand("sudo mount -o subvol=@log,compress=zstd:" + QString::number(compression) +
-        ",compress-force=zstd:" + QString::number(compression) + " " + rootPart + " /mnt/var/log");
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Kernel package
-        QString kernelPkg;
-        if (kernelCombo->currentText() == "Bore") kernelPkg = "linux-cachyos-bore";
-        else if (kernelCombo->currentText() == "Bore-Extra") kernelPkg = "linux-cachyos-bore-extra";
-        else if (kernelCombo->currentText() == "CachyOS") kernelPkg = "linux-cachyos";
-        else if (kernelCombo->currentText() == "CachyOS-Extra") kernelPkg = "linux-cachyos-extra";
-        else if (kernelCombo->currentText() == "LTS") kernelPkg = "linux-lts";
-        else if (kernelCombo->currentText() == "Zen") kernelPkg = "linux-zen";
-
-        // Base packages
-        QString basePkgs = "base " + kernelPkg + " linux-firmware sudo dosfstools arch-install-scripts btrfs-progs nano --needed --disable-download-timeout";
-
-        if (bootloaderCombo->currentText() == "GRUB") {
-            basePkgs += " grub efibootmgr dosfstools cachyos-grub-theme --needed --disable-download-timeout";
-        } else if (bootloaderCombo->currentText() == "systemd-boot") {
-            basePkgs += " efibootmgr --needed --disable-download-timeout";
-        } else if (bootloaderCombo->currentText() == "rEFInd") {
-            basePkgs += " refind --needed --disable-download-timeout";
-        }
-
-        if (initramfsCombo->currentText() == "mkinitcpio") {
-            basePkgs += " mkinitcpio --needed";
-        } else if (initramfsCombo->currentText() == "dracut") {
-            basePkgs += " dracut --needed";
-        } else if (initramfsCombo->currentText() == "booster") {
-            basePkgs += " booster --needed";
-        } else if (initramfsCombo->currentText() == "mkinitcpio-pico") {
-            basePkgs += " mkinitcpio-pico --needed";
+    void installationFinished(bool ok, const QString &message) {
+        cancelRequested.reset();
+        stallTimer.stop();
+        progressBar->setFormat("%p%");
+        if (ok) {
+            logMessage(message);
+            QMessageBox::information(this, "Complete", "Installation finished successfully!");
+        } else {
+            logMessage("Error: " + message);
+            QMessageBox::critical(this, "Error", message);
         }
-
-        if (desktopCombo->currentText() == "None") {
-            basePkgs += " networkmanager --needed --disable-download-timeout";
-        }
-
-        // Base system installation
-        logMessage("Installing base system");
-        executeCommand("sudo pacstrap -i /mnt " + basePkgs);
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Generate fstab
-        logMessage("Generating fstab");
-        QProcess blkid;
-        blkid.start("sudo blkid -s UUID -o value " + rootPart);
-        blkid.waitForFinished();
-        QString rootUuid = blkid.readAllStandardOutput().trimmed();
-
-        QFile fstab("/mnt/etc/fstab");
-        if (fstab.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&fstab);
-            out << "# Btrfs subvolumes\n"
-            << "UUID=" << rootUuid << " / btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@ 0 0\n"
-            << "UUID=" << rootUuid << " /home btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@home 0 0\n"
-            << "UUID=" << rootUuid << " /root btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@root 0 0\n"
-            << "UUID=" << rootUuid << " /srv btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@srv 0 0\n"
-            << "UUID=" << rootUuid << " /var/cache btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@cache 0 0\n"
-            << "UUID=" << rootUuid << " /var/tmp btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@tmp 0 0\n"
-            << "UUID=" << rootUuid << " /var/log btrfs rw,noatime,compress=zstd:" << compression << ",subvol=@log 0 0\n";
-            fstab.close();
-        }
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Setup locale
-        logMessage("Configuring locale");
-        QFile localeConf("/mnt/etc/locale.conf");
-        if (localeConf.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&localeConf);
-            out << "LANG=" << localeEdit->text() << "\n"
-            << "LC_ADDRESS=" << localeEdit->text() << "\n"
-            << "LC_IDENTIFICATION=" << localeEdit->text() << "\n"
-            << "LC_MEASUREMENT=" << localeEdit->text() << "\n"
-            << "LC_MONETARY=" << localeEdit->text() << "\n"
-            << "LC_NAME=" << localeEdit->text() << "\n"
-            << "LC_NUMERIC=" << localeEdit->text() << "\n"
-            << "LC_PAPER=" << localeEdit->text() << "\n"
-            << "LC_TELEPHONE=" << localeEdit->text() << "\n"
-            << "LC_TIME=" << localeEdit->text() << "\n";
-            localeConf.close();
-        }
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Create chroot script
-        QFile chrootScript("/mnt/setup-chroot.sh");
-        if (chrootScript.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            QTextStream out(&chrootScript);
-            out << "#!/bin/bash\n"
-            << "# System config\n"
-            << "echo \"" << hostnameEdit->text() << "\" > /etc/hostname\n"
-            << "ln -sf /usr/share/zoneinfo/" << timezoneEdit->text() << " /etc/localtime\n"
-            << "hwclock --systohc\n"
-            << "echo \"" << localeEdit->text() << "\" >> /etc/locale.gen\n"
-            << "locale-gen\n\n"
-            << "# Users\n"
-            << "echo \"root:" << rootPasswordEdit->text() << "\" | chpasswd\n"
-            << "useradd -m -G wheel,audio,video,storage,optical -s /bin/bash \"" << usernameEdit->text() << "\"\n"
-            << "echo \"" << usernameEdit->text() << ":" << userPasswordEdit->text() << "\" | chpasswd\n"
-            << "echo \"%wheel ALL=(ALL) ALL\" > /etc/sudoers.d/wheel\n\n";
-
-            // Bootloader
-            if (bootloaderCombo->currentText() == "GRUB") {
-                out << "# GRUB\n"
-                << "grub-install --target=x86_64-efi --efi-directory=/boot/efi --bootloader-id=CachyOS\n"
-                << "grub-mkconfig -o /boot/grub/grub.cfg\n";
-            } else if (bootloaderCombo->currentText() == "systemd-boot") {
-                out << "# systemd-boot\n"
-                << "bootctl --path=/boot/efi install\n"
-                << "mkdir -p /boot/efi/loader/entries\n"
-                << "cat > /boot/efi/loader/loader.conf << 'LOADER'\n"
-                << "default arch\ntimeout 3\neditor  yes\nLOADER\n\n"
-                << "cat > /boot/efi/loader/entries/arch.conf << 'ENTRY'\n"
-                << "title   CachyOS Linux\nlinux   /vmlinuz-" << kernelPkg << "\n"
-                << "initrd  /initramfs-" << kernelPkg << ".img\n"
-                << "options root=UUID=" << rootUuid << " rootflags=subvol=@ rw\nENTRY\n";
-            } else if (bootloaderCombo->currentText() == "rEFInd") {
-                out << "# rEFInd\n"
-                << "refind-install\n"
-                << "mkdir -p /boot/efi/EFI/refind/refind.conf\n"
-                << "cat > /boot/efi/EFI/refind/refind.conf << 'REFIND'\n"
-                << "menuentry \"CachyOS Linux\" {\n"
-                << "    icon     /EFI/refind/icons/os_arch.png\n"
-                << "    loader   /vmlinuz-" << kernelPkg << "\n"
-                << "    initrd   /initramfs-" << kernelPkg << ".img\n"
-                << "    options  \"root=UUID=" << rootUuid << " rootflags=subvol=@ rw\"\n}\nREFIND\n";
-            }
-
-            // Initramfs
-            out << "\n# Initramfs\n";
-            if (initramfsCombo->currentText() == "mkinitcpio") {
-                out << "mkinitcpio -P\n";
-            } else if (initramfsCombo->currentText() == "dracut") {
-                out << "dracut --regenerate-all --force\n";
-            } else if (initramfsCombo->currentText() == "booster") {
-                out << "booster generate\n";
-            } else if (initramfsCombo->currentText() == "mkinitcpio-pico") {
-                out << "mkinitcpio -P\n";
-            }
-
-            // Network
-            if (desktopCombo->currentText() == "None") {
-                out << "\n# Network\n"
-                << "systemctl enable NetworkManager\n"
-                << "systemctl start NetworkManager\n";
-            }
-
-            // Desktop environment
-            if (desktopCombo->currentText() != "None") {
-                out << "\n# Desktop Environment\n"
-                << "pacman -S --noconfirm --needed --disable-download-timeout ";
-
-                if (desktopCombo->currentText() == "KDE Plasma") {
-                    out << "plasma-desktop qt6-base qt6-wayland wayland kde-applications-meta sddm cachyos-kde-settings ntfs-3g gtk3\n"
-                    << "systemctl enable sddm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "echo 'blacklist ntfs3' | tee /etc/modprobe.d/disable-ntfs3.conf\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox kate ksystemlog partitionmanager dolphin konsole pulseaudio pavucontrol\n"
-                    << "plymouth-set-default-theme -R cachyos-bootanimation\n";
-                } else if (desktopCombo->currentText() == "GNOME") {
-                    out << "gnome gnome-extra gdm\n"
-                    << "systemctl enable gdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox gnome-terminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "XFCE") {
-                    out << "xfce4 xfce4-goodies lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox mousepad xfce4-terminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "MATE") {
-                    out << "mate mate-extra mate-media lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox pluma mate-terminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "LXQt") {
-                    out << "lxqt breeze-icons sddm\n"
-                    << "systemctl enable sddm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox qterminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "Cinnamon") {
-                    out << "cinnamon cinnamon-translations lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox xed gnome-terminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "Budgie") {
-                    out << "budgie-desktop budgie-extras gnome-control-center gnome-terminal lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox gnome-text-editor gnome-terminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "Deepin") {
-                    out << "deepin deepin-extra lightdm\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox deepin-terminal pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "i3") {
-                    out << "i3-wm i3status i3lock dmenu lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox alacritty pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "Sway") {
-                    out << "sway swaylock swayidle waybar wofi lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox foot pulseaudio pavucontrol\n";
-                } else if (desktopCombo->currentText() == "Hyprland") {
-                    out << "hyprland waybar rofi wofi kitty swaybg swaylock-effects wl-clipboard lightdm lightdm-gtk-greeter\n"
-                    << "systemctl enable lightdm\n"
-                    << "systemctl enable NetworkManager\n"
-                    << "systemctl start NetworkManager\n"
-                    << "pacman -S --noconfirm --needed --disable-download-timeout firefox kitty pulseaudio pavucontrol\n"
-                    << "mkdir -p /home/" << usernameEdit->text() << "/.config/hypr\n"
-                    << "cat > /home/" << usernameEdit->text() << "/.config/hypr/hyprland.conf << 'HYPRCONFIG'\n"
-                    << "exec-once = waybar &\n"
-                    << "exec-once = swaybg -i ~/wallpaper.jpg &\n"
-                    << "monitor=,preferred,auto,1\n"
-                    << "input {\n"
-                    << "    kb_layout = us\n"
-                    << "    follow_mouse = 1\n"
-                    << "    touchpad { natural_scroll = yes }\n"
-                    << "}\n"
-                    << "general {\n"
-                    << "    gaps_in = 5\n"
-                    << "    gaps_out = 10\n"
-                    << "    border_size = 2\n"
-                    << "    col.active_border = rgba(33ccffee) rgba(00ff99ee) 45deg\n"
-                    << "    col.inactive_border = rgba(595959aa)\n"
-                    << "}\n"
-                    << "decoration {\n"
-                    << "    rounding = 5\n"
-                    << "    blur = yes\n"
-                    << "    blur_size = 3\n"
-                    << "    blur_passes = 1\n"
-                    << "}\n"
-                    << "animations {\n"
-                    << "    enabled = yes\n"
-                    << "    bezier = myBezier, 0.05, 0.9, 0.1, 1.05\n"
-                    << "    animation = windows, 1, 7, myBezier\n"
-                    << "    animation = windowsOut, 1, 7, default, popin 80%\n"
-                    << "    animation = border, 1, 10, default\n"
-                    << "    animation = fade, 1, 7, default\n"
-                    << "    animation = workspaces, 1, 6, default\n"
-                    << "}\n"
-                    << "bind = SUPER, Return, exec, kitty\n"
-                    << "bind = SUPER, Q, killactive\n"
-                    << "bind = SUPER, M, exit\n"
-                    << "bind = SUPER, V, togglefloating\n"
-                    << "bind = SUPER, F, fullscreen\n"
-                    << "bind = SUPER, D, exec, rofi -show drun\n"
-                    << "bind = SUPER, P, pseudo\n"
-                    << "bind = SUPER, J, togglesplit\n"
-                    << "HYPRCONFIG\n"
-                    << "chown -R " << usernameEdit->text() << ":" << usernameEdit->text() << " /home/" << usernameEdit->text() << "/.config\n";
-                }
-            }
-
-            out << "\n# Clean up\n"
-            << "rm /setup-chroot.sh\n";
-
-            chrootScript.close();
-            executeCommand("sudo chmod +x /mnt/setup-chroot.sh");
-        }
-
-        // Run chroot configuration
-        logMessage("Running chroot configuration");
-        executeCommand("sudo arch-chroot /mnt /setup-chroot.sh");
-        progressBar->setValue(++currentStep * 100 / TOTAL_STEPS);
-
-        // Final cleanup
-        logMessage("Finalizing installation");
-        executeCommand("sudo umount -R /mnt");
-        progressBar->setValue(100);
-
-        // Complete
-        logMessage("Installation complete!");
-        QMessageBox::information(this, "Complete", "Installation finished successfully!");
-
-        // Re-enable UI
         startButton->setEnabled(true);
         quitButton->setEnabled(true);
+        cancelButton->setEnabled(false);
         configGroup->setEnabled(true);
     }
 
+    void closeEvent(QCloseEvent *event) override {
+        // The worker owns mounts under /mnt; let it stop at a step boundary
+        if (cancelRequested) {
+            cancelInstallation();
+            event->ignore();
+            return;
+        }
+        event->accept();
+    }
+
     // Member variables
     QGroupBox *configGroup;
     QComboBox *targetDiskCombo;
@@ -663,13 +692,25 @@ private:
     QComboBox *initramfsCombo;
     QComboBox *bootloaderCombo;
     QComboBox *desktopCombo;
+    QCheckBox *gamingCheck;
+    QComboBox *cpuLevelCombo;
+    QLineEdit *reposEdit;
     QLineEdit *compressionSpin;
+    QCheckBox *fastInstallCheck;
+    QComboBox *wipeModeCombo;
+    QSpinBox *espSizeSpin;
+    QSpinBox *swapSizeSpin;
+    QTableWidget *subvolumeTable;
     QLineEdit *localeEdit;
-    QTextEdit *outputText;
+    LogPane *logPane;
     QProgressBar *progressBar;
+    QTimer stallTimer;
+    QElapsedTimer sinceOutput;
+    QString progressStatus;
     QPushButton *startButton;
     QPushButton *quitButton;
-    QFile logFile;
+    QPushButton *cancelButton;
+    std::shared_ptr<std::atomic<bool>> cancelRequested;  // set while an installation runs
 };
 
 int main(int argc, char *argv[]) {
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Just enough of a test runner for the core: a test is a function that
+// calls CHECK; main() runs them all and exits non-zero if any check failed.
+struct TestCase {
+    const char* name;
+    std::function<void()> body;
+};
+
+std::vector<TestCase>& test_cases();
+void check_failed(const char* file, int line, const std::string& message);
+
+struct TestRegistration {
+    TestRegistration(const char* name, std::function<void()> body) { test_cases().push_back({name, std::move(body)}); }
+};
+
+#define TEST_CONCAT2(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT2(a, b)
+#define TEST(name)                                                                    \
+    static void name();                                                               \
+    static TestRegistration TEST_CONCAT(registration_, name)(#name, name);            \
+    static void name()
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) check_failed(__FILE__, __LINE__, #condition);               \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                    \
+    do {                                                                              \
+        auto check_actual = (actual);                                                 \
+        auto check_expected = (expected);                                             \
+        if (!(check_actual == check_expected)) {                                      \
+            std::ostringstream check_message;                                         \
+            check_message << #actual << " == " << check_actual << ", expected " << check_expected; \
+            check_failed(__FILE__, __LINE__, check_message.str());                    \
+        }                                                                             \
+    } while (0)
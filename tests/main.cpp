@@ -0,0 +1,29 @@
+#include "check.h"
+
+#include <filesystem>
+#include <unistd.h>
+
+static int failures = 0;
+
+std::vector<TestCase>& test_cases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+void check_failed(const char* file, int line, const std::string& message) {
+    std::cerr << file << ":" << line << ": " << message << std::endl;
+    ++failures;
+}
+
+int main() {
+    for (const TestCase& test : test_cases()) {
+        int before = failures;
+        test.body();
+        std::cout << (failures == before ? "ok      " : "FAILED  ") << test.name << std::endl;
+    }
+    // Scratch files of the tests, see scratch_dir()
+    std::error_code ec;
+    std::filesystem::remove_all(std::filesystem::temp_directory_path() / ("core-tests-" + std::to_string(getpid())), ec);
+    std::cout << test_cases().size() << " tests, " << failures << " failed checks" << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+#include "check.h"
+#include "gpt.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const uint64_t MIB = 1024 * 1024;
+
+// Written independently of gpt.cpp's, so a wrong table is not read back as right
+static uint32_t reference_crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+template <typename T>
+static T get_le(const uint8_t* in) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) value |= static_cast<T>(in[i]) << (8 * i);
+    return value;
+}
+
+// A sparse disk image of size_bytes
+static std::string disk_image(const std::string& name, uint64_t size_bytes) {
+    fs::path dir = fs::temp_directory_path() / ("core-tests-" + std::to_string(getpid()));
+    fs::create_directories(dir);
+    std::string path = (dir / name).string();
+    { std::ofstream create(path, std::ios::trunc); }
+    fs::resize_file(path, size_bytes);
+    return path;
+}
+
+static std::vector<uint8_t> read_sectors(const std::string& path, uint64_t lba, uint64_t count, uint64_t sector) {
+    std::vector<uint8_t> data(count * sector);
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(static_cast<std::streamoff>(lba * sector));
+    in.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return data;
+}
+
+// Checks one header and its entry array against the spec and the plan
+static void check_header(const std::string& path, const DiskGeometry& geometry, uint64_t my_lba,
+                         uint64_t alternate_lba, const std::vector<PlannedPartition>& partitions) {
+    const uint64_t sector = geometry.logical_sector;
+    const uint64_t entry_sectors = (128 * 128 + sector - 1) / sector;
+    std::vector<uint8_t> header = read_sectors(path, my_lba, 1, sector);
+    CHECK(std::memcmp(header.data(), "EFI PART", 8) == 0);
+    CHECK_EQ(get_le<uint32_t>(&header[8]), 0x00010000u);
+    CHECK_EQ(get_le<uint32_t>(&header[12]), 92u);
+    uint32_t stored_crc = get_le<uint32_t>(&header[16]);
+    std::memset(&header[16], 0, 4);
+    CHECK_EQ(reference_crc32(header.data(), 92), stored_crc);
+    CHECK_EQ(get_le<uint64_t>(&header[24]), my_lba);
+    CHECK_EQ(get_le<uint64_t>(&header[32]), alternate_lba);
+    CHECK_EQ(get_le<uint64_t>(&header[40]), 2 + entry_sectors);
+    CHECK_EQ(get_le<uint64_t>(&header[48]), geometry.sectors() - 2 - entry_sectors);
+    CHECK_EQ(get_le<uint32_t>(&header[80]), 128u);
+    CHECK_EQ(get_le<uint32_t>(&header[84]), 128u);
+
+    uint64_t entries_lba = get_le<uint64_t>(&header[72]);
+    CHECK_EQ(entries_lba, my_lba == 1 ? 2 : geometry.sectors() - 1 - entry_sectors);
+    std::vector<uint8_t> entries = read_sectors(path, entries_lba, entry_sectors, sector);
+    CHECK_EQ(reference_crc32(entries.data(), 128 * 128), get_le<uint32_t>(&header[88]));
+    for (const PlannedPartition& part : partitions) {
+        const uint8_t* entry = &entries[(part.number - 1) * 128];
+        CHECK_EQ(get_le<uint64_t>(entry + 32), part.first_lba);
+        CHECK_EQ(get_le<uint64_t>(entry + 40), part.last_lba);
+        CHECK_EQ(entry[56], static_cast<uint8_t>(part.label[0]));
+    }
+    // The ESP type, C12A7328-F81F-11D2-BA4B-00A0C93EC93B, mixed-endian on disk
+    static const uint8_t ESP_TYPE[16] = {0x28, 0x73, 0x2A, 0xC1, 0x1F, 0xF8, 0xD2, 0x11,
+                                         0xBA, 0x4B, 0x00, 0xA0, 0xC9, 0x3E, 0xC9, 0x3B};
+    CHECK(std::memcmp(&entries[0], ESP_TYPE, 16) == 0);
+    CHECK(entries[3 * 128 + 32] == 0 && get_le<uint64_t>(&entries[3 * 128 + 40]) == 0);
+}
+
+static void check_written_table(const std::string& path, DiskGeometry geometry) {
+    std::vector<PlannedPartition> partitions;
+    std::string error;
+    PartitionLayout layout;
+    layout.swap_size_mib = 1024;
+    CHECK(plan_partitions(geometry, layout, partitions, error));
+    CHECK(write_gpt(path, geometry, partitions, error));
+    CHECK_EQ(error, std::string());
+    CHECK_EQ(partitions.size(), size_t(3));
+
+    const uint64_t sector = geometry.logical_sector;
+    const uint64_t last_lba = geometry.sectors() - 1;
+    std::vector<uint8_t> mbr = read_sectors(path, 0, 1, sector);
+    CHECK(mbr[510] == 0x55 && mbr[511] == 0xAA);
+    CHECK_EQ(mbr[446 + 4], uint8_t(0xEE));
+    CHECK_EQ(get_le<uint32_t>(&mbr[446 + 8]), 1u);
+    CHECK_EQ(get_le<uint32_t>(&mbr[446 + 12]), static_cast<uint32_t>(std::min<uint64_t>(last_lba, 0xFFFFFFFFu)));
+    CHECK_EQ(get_le<uint32_t>(&mbr[462 + 8]), 0u);
+
+    check_header(path, geometry, 1, last_lba, partitions);
+    check_header(path, geometry, last_lba, 1, partitions);
+    // Both headers describe the same disk
+    std::vector<uint8_t> primary = read_sectors(path, 1, 1, sector);
+    std::vector<uint8_t> backup = read_sectors(path, last_lba, 1, sector);
+    CHECK(std::memcmp(&primary[56], &backup[56], 16) == 0);
+}
+
+TEST(gpt_on_512_byte_sectors) {
+    std::string path = disk_image("disk512.img", 20 * 1024 * MIB);
+    DiskGeometry geometry;
+    std::string error;
+    CHECK(read_disk_geometry(path, geometry, error));
+    check_written_table(path, geometry);
+}
+
+TEST(gpt_on_4k_sectors) {
+    std::string path = disk_image("disk4k.img", 20 * 1024 * MIB);
+    DiskGeometry geometry;
+    std::string error;
+    CHECK(read_disk_geometry(path, geometry, error));
+    geometry.logical_sector = geometry.physical_sector = 4096;
+    check_written_table(path, geometry);
+}
+
+TEST(partitions_are_aligned) {
+    struct Case {
+        uint32_t logical, physical, optimal_io, alignment_offset;
+        uint64_t expected_alignment;
+    };
+    // The last one reports an optimal size off the 1MiB grid, which is ignored
+    for (const Case& c : {Case{512, 512, 0, 0, MIB}, Case{512, 4096, 0, 3584, MIB}, Case{4096, 4096, 4 * MIB, 0, 4 * MIB},
+                          Case{512, 512, 33553920, 0, MIB}}) {
+        DiskGeometry geometry;
+        geometry.name = "test";
+        geometry.size_bytes = 64 * 1024 * MIB + 12345 * 512;
+        geometry.logical_sector = c.logical;
+        geometry.physical_sector = c.physical;
+        geometry.optimal_io = c.optimal_io;
+        geometry.alignment_offset = c.alignment_offset;
+        CHECK_EQ(partition_alignment(geometry), c.expected_alignment);
+
+        std::vector<PlannedPartition> partitions;
+        std::string error;
+        PartitionLayout layout;
+        layout.swap_size_mib = 2048;
+        CHECK(plan_partitions(geometry, layout, partitions, error));
+        const uint64_t entry_sectors = (128 * 128 + c.logical - 1) / c.logical;
+        uint64_t previous_end = 1 + entry_sectors;
+        for (const PlannedPartition& part : partitions) {
+            CHECK_EQ((part.first_lba * c.logical) % c.expected_alignment, uint64_t(c.alignment_offset));
+            CHECK(part.first_lba > previous_end);
+            CHECK(part.last_lba >= part.first_lba);
+            previous_end = part.last_lba;
+        }
+        CHECK(previous_end <= geometry.sectors() - 2 - entry_sectors);
+        CHECK_EQ((partitions[0].last_lba - partitions[0].first_lba + 1) * c.logical, layout.esp_size_mib * MIB);
+    }
+}
+
+TEST(small_disk_is_refused) {
+    DiskGeometry geometry;
+    geometry.name = "small";
+    geometry.size_bytes = 8 * 1024 * MIB;
+    std::vector<PlannedPartition> partitions;
+    std::string error;
+    CHECK(!plan_partitions(geometry, PartitionLayout(), partitions, error));
+    CHECK(error.find("too small") != std::string::npos);
+}
@@ -0,0 +1,104 @@
+#include "bench.h"
+#include "check.h"
+#include "mirrors.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static std::string scratch_dir(const std::string& name) {
+    std::string dir = fs::temp_directory_path().string() + "/core-tests-" + std::to_string(getpid()) + "/" + name;
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    return dir;
+}
+
+TEST(expand_server_fills_in_variables) {
+    CHECK_EQ(expand_server("https://m.example/$repo/os/$arch/", "core", "x86_64"), std::string("https://m.example/core/os/x86_64"));
+    CHECK_EQ(expand_server("https://m.example/repo/$arch_v3/$repo", "cachyos-v3", "x86_64"),
+             std::string("https://m.example/repo/x86_64_v3/cachyos-v3"));
+    CHECK_EQ(expand_server("https://m.example/repo/$arch_v4/$repo", "cachyos-v4", "x86_64"),
+             std::string("https://m.example/repo/x86_64_v4/cachyos-v4"));
+}
+
+// The first server of every bundled list, as the prober asks for it
+TEST(bundled_mirrorlists_expand_to_real_urls) {
+    std::string pacman_d = extract_bundled_mirrors(std::string(SOURCE_DIR) + "/c++script/" + DEFAULT_MIRROR_BUNDLE,
+                                                   scratch_dir("bundle"));
+    CHECK(!pacman_d.empty());
+    std::vector<std::pair<std::string, std::string>> expected = {
+        {"mirrorlist", "https://archlinux.cachyos.org/repo/core/os/x86_64"},
+        {"cachyos-mirrorlist", "https://aur.cachyos.org/repo/x86_64/cachyos"},
+        {"cachyos-v3-mirrorlist", "https://aur.cachyos.org/repo/x86_64_v3/cachyos-v3"},
+        {"cachyos-v4-mirrorlist", "https://aur.cachyos.org/repo/x86_64_v4/cachyos-v4"},
+        {"chaotic-mirrorlist", "https://cdn-mirror.chaotic.cx/chaotic-aur/x86_64"},
+    };
+    for (const MirrorList& list : bundled_mirrorlists()) {
+        std::vector<std::string> servers = parse_mirrorlist(pacman_d + "/" + list.file);
+        CHECK(!servers.empty());
+        if (servers.empty()) continue;
+        for (const std::string& server : servers) {
+            CHECK(expand_server(server, list.repo, list.arch).find('$') == std::string::npos);
+        }
+        for (const auto& [file, url] : expected) {
+            if (file == list.file) CHECK_EQ(expand_server(servers.front(), list.repo, list.arch), url);
+        }
+    }
+}
+
+// Four local stand-ins for mirrors: one unthrottled, one slow to answer,
+// one with little bandwidth and one without the database at all
+TEST(probe_ranks_by_latency_and_bandwidth) {
+    std::string repo_root = scratch_dir("mirror");
+    fs::create_directories(repo_root + "/core");
+    {
+        std::ofstream db(repo_root + "/core/core.db", std::ios::binary);
+        db << std::string(1 << 20, 'x');
+    }
+    std::string empty_root = scratch_dir("broken");
+
+    PackageServer fast, slow_start, narrow, broken;
+    std::string error;
+    CHECK(fast.start(repo_root, 0, 0, error));
+    CHECK(slow_start.start(repo_root, 0, 300, error));
+    CHECK(narrow.start(repo_root, 1 << 20, 0, error));
+    CHECK(broken.start(empty_root, 0, 0, error));
+
+    // Listed worst first, so the order below comes from the probe
+    std::vector<std::string> servers = {broken.url() + "/$repo", narrow.url() + "/$repo", slow_start.url() + "/$repo",
+                                        fast.url() + "/$repo"};
+    ProbeOptions options;
+    options.repo = "core";
+    options.arch = "x86_64";
+    std::vector<MirrorProbe> ranked = probe_mirrors(servers, options);
+
+    CHECK_EQ(ranked.size(), size_t(4));
+    if (ranked.size() != 4) return;
+    CHECK_EQ(ranked[0].server, servers[3]);
+    CHECK_EQ(ranked[1].server, servers[2]);
+    CHECK_EQ(ranked[2].server, servers[1]);
+    CHECK_EQ(ranked[3].server, servers[0]);
+    CHECK(ranked[0].ok && ranked[1].ok && ranked[2].ok);
+    CHECK(!ranked[3].ok);
+    CHECK_EQ(ranked[3].http_code, 404);
+
+    std::string path = scratch_dir("ranked") + "/mirrorlist";
+    CHECK(write_ranked_mirrorlist(path, ranked));
+    std::ifstream file(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);) {
+        if (line.find("Server = ") != std::string::npos) lines.push_back(line);
+    }
+    CHECK_EQ(lines.size(), size_t(4));
+    if (lines.size() != 4) return;
+    for (size_t i = 0; i < 3; ++i) CHECK_EQ(lines[i], "Server = " + ranked[i].server);
+    CHECK_EQ(lines[3], "#Server = " + servers[0]);
+
+    fast.stop();
+    slow_start.stop();
+    narrow.stop();
+    broken.stop();
+}